@@ -0,0 +1,118 @@
+/**
+ * Benchmark of the builtins.
+ *
+ * Runs a script of simple commands (echo, printf, [, true, :, false and
+ * pwd) twice: once with the builtins of the shell and once with the same
+ * commands written as the full path of the external programs, which are
+ * started as child processes. Prints the time of each run and the time per
+ * command.
+ *
+ * The output of the commands is discarded: stdout is redirected to
+ * /dev/null while the scripts run.
+ *
+ * Usage: builtin_bench [iterations]
+ *
+ * Defaults to 100000 commands per script.
+ */
+#include "executor.h"
+#include "stats.h"
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <print>
+#include <span>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <unistd.h>
+
+// Commands of the scripts, the external ones are the same commands run from
+// their full path
+static constexpr std::array<std::string_view, 7> builtin_commands{
+    "echo hello world",
+    "printf '%s=%d\\n' x 42",
+    "[ -f /etc/passwd ]",
+    "true",
+    ":",
+    "false",
+    "pwd",
+};
+
+static constexpr std::array<std::string_view, 7> external_commands{
+    "/bin/echo hello world",
+    "/usr/bin/printf '%s=%d\\n' x 42",
+    "/usr/bin/[ -f /etc/passwd ]",
+    "/bin/true",
+    "/bin/true",
+    "/bin/false",
+    "/bin/pwd",
+};
+
+static std::string script(std::span<const std::string_view> commands,
+                          size_t iterations) {
+    std::string script{};
+
+    for (size_t i = 0; i < iterations; ++i) {
+        script += commands[i % commands.size()];
+        script += '\n';
+    }
+
+    return script;
+}
+
+static std::chrono::nanoseconds run(const std::string &text) {
+    std::istringstream input{text};
+    Executor executor{};
+
+    const auto start = std::chrono::steady_clock::now();
+    executor.script(input);
+    return std::chrono::steady_clock::now() - start;
+}
+
+int main(int argc, char *argv[]) {
+    const size_t iterations =
+        argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 100000;
+
+    Stats::init();
+
+    const std::string builtins = script(builtin_commands, iterations);
+    const std::string externals = script(external_commands, iterations);
+
+    const int null = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    const int saved_stdout = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 10);
+    if (null == -1 || saved_stdout == -1) {
+        std::println(stderr, "builtin_bench: {}", std::strerror(errno));
+        return 1;
+    }
+
+    std::fflush(stdout);
+    dup2(null, STDOUT_FILENO);
+
+    const auto builtin_time = run(builtins);
+    const auto external_time = run(externals);
+
+    std::fflush(stdout);
+    dup2(saved_stdout, STDOUT_FILENO);
+
+    const auto seconds = [](std::chrono::nanoseconds time) {
+        return std::chrono::duration<double>(time).count();
+    };
+    const auto micros = [&](std::chrono::nanoseconds time) {
+        return std::chrono::duration<double, std::micro>(time).count() /
+               static_cast<double>(iterations);
+    };
+
+    std::println("{:<10} {:>10} {:>16}", "", "time (s)", "per command (us)");
+    std::println("{:<10} {:>10.3f} {:>16.2f}", "builtin",
+                 seconds(builtin_time), micros(builtin_time));
+    std::println("{:<10} {:>10.3f} {:>16.2f}", "external",
+                 seconds(external_time), micros(external_time));
+    std::println("speedup: {:.1f}x",
+                 seconds(external_time) / seconds(builtin_time));
+
+    return 0;
+}
@@ -0,0 +1,115 @@
+/**
+ * Random cross-check of the lexers and of the parsers.
+ *
+ * Generates random sequences of words and operators, most of them not
+ * valid commands, and lexes each one with TESTSH_LEXER=check: the table
+ * scanner and the re2 reference run on every token and the program aborts
+ * on the first disagreement. The tokens are then parsed by SyntaxTree and
+ * by the predictive Parser, as TESTSH_PARSER=check does: both must build
+ * the same tree, or both must reject the input.
+ *
+ * Usage: check_fuzz [sequences] [seed]
+ *
+ * Defaults to 100000 sequences from a random seed, printed so that a
+ * failure can be reproduced.
+ */
+#include "parser.h"
+#include "syntax.h"
+#include "tokenizer.h"
+#include <cstdlib>
+#include <format>
+#include <optional>
+#include <print>
+#include <random>
+#include <span>
+#include <string>
+#include <string_view>
+
+// Words, operators and a few pieces the lexer rejects, such as `#`
+static constexpr std::string_view pieces[] = {
+    "echo",  "a",         "x=1", "$HOME", "'q w'", "\"d q\"",
+    "a\\ b", "$(echo x)", "$(",  ")",     "(",     "|",
+    "||",    "&&",        "&",   ";",     "!",     "<",
+    ">",     ">>",        "2>&1", "<&0",  "<>",    "<<",
+    "\n",    "\n",        "\\\n", "ls -l", "cd /tmp", "#",
+};
+
+static std::string sequence(std::mt19937 &rng) {
+    std::uniform_int_distribution<size_t> length{1, 12};
+    std::uniform_int_distribution<size_t> piece{0, std::size(pieces) - 1};
+    std::bernoulli_distribution spaced{0.8};
+
+    std::string text{};
+    const size_t count = length(rng);
+
+    for (size_t i = 0; i < count; ++i) {
+        text += pieces[piece(rng)];
+        if (spaced(rng))
+            text += ' ';
+    }
+
+    if (!text.ends_with('\n'))
+        text += '\n';
+
+    return text;
+}
+
+int main(int argc, char *argv[]) {
+    const size_t count =
+        argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 100000;
+    const unsigned seed = argc > 2 ? std::strtoul(argv[2], nullptr, 10)
+                                   : std::random_device{}();
+
+    // Read once, by the first scan
+    setenv("TESTSH_LEXER", "check", 1);
+
+    std::mt19937 rng{seed};
+    size_t parsed = 0;
+    Ast ast{};
+
+    for (size_t i = 0; i < count; ++i) {
+        const std::string text = sequence(rng);
+
+        IncrementalLexer lexer{};
+        lexer.feed(text);
+
+        const std::span<const Token> tokens = lexer.finish();
+        const std::string_view input = lexer.input();
+
+        const auto tree = [&](const ThisProgram &program) {
+            return std::format("{:?}", InAst{ast, program});
+        };
+
+        TokenIter tokenizer{tokens, input};
+        const auto reference = SyntaxTree<TokenIter>{ast}.program(tokenizer);
+        const bool complete = reference && tokenizer.next_is_eof();
+        const std::string reference_tree = complete ? tree(*reference) : "";
+
+        Parser parser{tokens, input, ast};
+        const auto predictive = parser.program();
+
+        // SyntaxTree ignores what follows the longest prefix it can parse,
+        // the predictive parser must reject those inputs
+        const bool agree = complete ? predictive && tree(*predictive) ==
+                                                        reference_tree
+                                    : !predictive;
+
+        if (!agree) {
+            std::println(stderr,
+                         "check_fuzz: parser mismatch on {:?} (seed {}, "
+                         "sequence {}): predictive={} tree={}",
+                         text, seed, i,
+                         predictive ? "parsed" : parser.error_message(),
+                         complete ? "parsed" : "rejected");
+            return 1;
+        }
+
+        parsed += predictive.has_value();
+        ast.clear();
+    }
+
+    std::println("seed {}: {} sequences, {} parsed, no mismatch", seed, count,
+                 parsed);
+
+    return 0;
+}
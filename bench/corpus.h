@@ -0,0 +1,43 @@
+#ifndef TESTSH_BENCH_CORPUS_H
+#define TESTSH_BENCH_CORPUS_H
+
+#include <cstddef>
+#include <fstream>
+#include <iterator>
+#include <optional>
+#include <string>
+#include <string_view>
+
+/**
+ * Script of about `size` bytes, made of valid commands that cover every
+ * kind of token and every production of the grammar.
+ */
+inline std::string synthetic_script(size_t size) {
+    static constexpr std::string_view lines[] = {
+        "echo hello world 'quoted text' $HOME | grep -v x > /dev/null\n",
+        "FOO=bar BAZ=qux env 2>&1 >> /tmp/out && cat < /tmp/in || true\n",
+        "ls -la /usr/local/bin ; cd .. & jobs\n",
+        "echo escaped\\ space long-argument-with-dashes=and.dots/and/slashes\n",
+        "echo $(echo nested $USER) 3<&0 ; (subshell; echo héllo ☃) &\n",
+        "echo continued \\\n    on the next line | wc -l\n",
+        "! (cd /tmp &&\n    ls) 2> /dev/null || echo failed\n",
+    };
+
+    std::string script{};
+    script.reserve(size + 128);
+
+    for (size_t i = 0; script.size() < size; ++i)
+        script += lines[i % std::size(lines)];
+
+    return script;
+}
+
+inline std::optional<std::string> read_script(const char *path) {
+    std::ifstream file{path, std::ios::binary};
+    if (!file)
+        return std::nullopt;
+
+    return std::string(std::istreambuf_iterator<char>(file), {});
+}
+
+#endif // TESTSH_BENCH_CORPUS_H
@@ -0,0 +1,124 @@
+/**
+ * Benchmark of the image of the programs to exec.
+ *
+ * Exports the given number of variables and builds the argv and envp of
+ * `cmd a b` and of `FOO=1 BAR=2 cmd a b` many times, reusing one Exec as
+ * the shell does. For comparison, each command is also laid out by copying
+ * every exported variable into a new environment, as the shell did before
+ * it kept the environment built. Prints the time per build of each.
+ *
+ * No process is created: only the layout of the image is measured.
+ *
+ * Usage: exec_bench [variables] [builds]
+ *
+ * Defaults to 2000 variables and 100000 builds.
+ */
+#include "exec_prog.h"
+#include "shell.h"
+#include "syntax.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <format>
+#include <print>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * Lays out the environment of `cmd` from scratch: the exported variables
+ * that are not assigned by the command, then its assignments.
+ */
+static char *const *rebuild(const SimpleCommand &cmd, const Shell &shell,
+                            std::vector<char> &strings,
+                            std::vector<char *> &envp) {
+    strings.clear();
+    envp.clear();
+
+    std::vector<size_t> offsets{};
+
+    const auto push = [&](std::string_view str) {
+        offsets.push_back(strings.size());
+        strings.insert(strings.end(), str.begin(), str.end());
+        strings.push_back('\0');
+    };
+
+    for (const auto &var : shell.vars) {
+        const bool assigned =
+            std::ranges::any_of(cmd.envs, [&](std::string_view env) {
+                return env.substr(0, env.find('=')) == var.name();
+            });
+
+        if (var.attr.external && !assigned)
+            push(var.str);
+    }
+
+    for (const auto env : cmd.envs)
+        push(env);
+
+    for (const size_t offset : offsets)
+        envp.push_back(strings.data() + offset);
+    envp.push_back(nullptr);
+
+    return envp.data();
+}
+
+int main(int argc, char *argv[]) {
+    const size_t variables =
+        argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 2000;
+    const size_t builds =
+        argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 100000;
+
+    Shell shell{};
+    for (size_t i = 0; i < variables; ++i)
+        shell.vars.upsert(std::format("BENCH_VAR_{}=value of {}", i, i),
+                          VarAttr{.external = true});
+
+    const SimpleCommand plain{
+        .program = "cmd",
+        .arguments = {"a", "b"},
+    };
+    const SimpleCommand assigned{
+        .program = "cmd",
+        .arguments = {"a", "b"},
+        .envs = {"FOO=1", "BAR=2"},
+    };
+
+    const auto per_build = [&](auto &&build) {
+        // Keeps the builds from being optimized away
+        size_t sink = 0;
+
+        const auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < builds; ++i)
+            sink += build() != nullptr;
+        const auto time = std::chrono::steady_clock::now() - start;
+
+        if (sink != builds)
+            std::abort();
+
+        return std::chrono::duration<double, std::micro>(time).count() /
+               static_cast<double>(builds);
+    };
+
+    std::println("{} exported variables, {} builds", variables, builds);
+    std::println("{:<18} {:>12} {:>12}", "command", "rebuilt us", "exec us");
+
+    for (const auto &[name, cmd] :
+         {std::pair{"plain command", &plain},
+          std::pair{"two assignments", &assigned}}) {
+        std::vector<char> strings{};
+        std::vector<char *> envp{};
+        Exec exec{};
+
+        const double rebuilt =
+            per_build([&] { return rebuild(*cmd, shell, strings, envp); });
+        const double kept = per_build([&] {
+            exec.build(*cmd, shell);
+            return exec.envp();
+        });
+
+        std::println("{:<18} {:>12.2f} {:>12.2f}", name, rebuilt, kept);
+    }
+
+    return 0;
+}
@@ -0,0 +1,103 @@
+/**
+ * Benchmark of the table of the background jobs.
+ *
+ * Fills a table with the given number of jobs of one process each, with
+ * made up pids, and completes them one at a time as the prompt of the
+ * shell would see them: once with the JobTable, routing the status by pid
+ * and removing the job, and once with a vector of jobs scanned and rebuilt
+ * without the completed ones at every prompt, as the shell did before.
+ * Prints the time per prompt of each.
+ *
+ * No process is created: only the bookkeeping of the shell is measured.
+ *
+ * Usage: job_bench [jobs]
+ *
+ * Defaults to 1, 10, 100, 1000 and 10000 jobs.
+ */
+#include "job.h"
+#include <chrono>
+#include <cstdlib>
+#include <print>
+#include <ranges>
+#include <sys/types.h>
+#include <vector>
+
+static Job make_job(pid_t pid) {
+    Job job{};
+    job.add(ExecStats{
+        .exit_code = 0,
+        .child_pid = pid,
+        .pipeline_pgid = pid,
+    });
+    return job;
+}
+
+static std::chrono::nanoseconds run_table(size_t count) {
+    JobTable jobs{};
+    for (size_t i = 0; i < count; ++i)
+        jobs.add(make_job(static_cast<pid_t>(i + 1000)));
+
+    const auto start = std::chrono::steady_clock::now();
+
+    for (size_t i = 0; i < count; ++i) {
+        const auto process = jobs.process(static_cast<pid_t>(i + 1000));
+        jobs.find(process->job)->processes[process->index].completed = true;
+        jobs.update(process->job);
+
+        if (jobs.find(process->job)->completed())
+            jobs.remove(process->job);
+    }
+
+    return std::chrono::steady_clock::now() - start;
+}
+
+static std::chrono::nanoseconds run_vector(size_t count) {
+    std::vector<Job> jobs{};
+    for (size_t i = 0; i < count; ++i)
+        jobs.push_back(make_job(static_cast<pid_t>(i + 1000)));
+
+    const auto start = std::chrono::steady_clock::now();
+
+    for (size_t i = 0; i < count; ++i) {
+        const pid_t pid = static_cast<pid_t>(i + 1000);
+
+        for (auto &job : jobs) {
+            if (auto *process = job.processes.find(pid))
+                process->completed = true;
+        }
+
+        jobs = jobs | std::views::filter([](const auto &job) {
+                   return !job.completed();
+               }) |
+               std::ranges::to<std::vector>();
+    }
+
+    return std::chrono::steady_clock::now() - start;
+}
+
+int main(int argc, char *argv[]) {
+    std::vector<size_t> counts{1, 10, 100, 1000, 10000};
+    if (argc > 1)
+        counts = {std::strtoull(argv[1], nullptr, 10)};
+
+    const auto per_prompt = [](std::chrono::nanoseconds time, size_t count) {
+        return std::chrono::duration<double, std::micro>(time).count() /
+               static_cast<double>(count);
+    };
+
+    std::println("{:>8} {:>20} {:>21} {:>8}", "jobs", "table (us/prompt)",
+                 "vector (us/prompt)", "speedup");
+
+    for (const size_t count : counts) {
+        if (count == 0)
+            continue;
+
+        const auto table = per_prompt(run_table(count), count);
+        const auto vector = per_prompt(run_vector(count), count);
+
+        std::println("{:>8} {:>20.3f} {:>21.3f} {:>7.1f}x", count, table,
+                     vector, vector / table);
+    }
+
+    return 0;
+}
@@ -0,0 +1,100 @@
+/**
+ * Benchmark of the parallel lexer.
+ *
+ * Lexes a script with an increasing number of threads, from 1 to the number
+ * of online CPUs, checks that every run produces the same input and tokens
+ * of the sequential lexing and prints the throughput of each run.
+ *
+ * Usage: lex_bench [script] [max threads]
+ *
+ * Without a script a synthetic one of about 64 MiB is generated.
+ */
+#include "corpus.h"
+#include "parallel_lexer.h"
+#include "tokenizer.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <format>
+#include <print>
+#include <ranges>
+#include <span>
+#include <string>
+#include <vector>
+
+// Runs of each configuration, the fastest one is reported
+static constexpr int repetitions = 3;
+
+struct Run {
+    std::chrono::nanoseconds elapsed;
+    bool identical;
+};
+
+static Run run(std::string_view script, size_t threads,
+               std::string_view expected_input,
+               std::span<const Token> expected) {
+    Run best{.elapsed = std::chrono::nanoseconds::max(), .identical = true};
+
+    for (int i = 0; i < repetitions; ++i) {
+        IncrementalLexer lexer{};
+
+        const auto start = std::chrono::steady_clock::now();
+        lex_script(script, lexer, threads);
+        const auto elapsed = std::chrono::steady_clock::now() - start;
+
+        const auto tokens = lexer.finish();
+
+        best.elapsed = std::min<std::chrono::nanoseconds>(best.elapsed,
+                                                          elapsed);
+        best.identical = best.identical &&
+                         lexer.input() == expected_input &&
+                         std::ranges::equal(tokens, expected);
+    }
+
+    return best;
+}
+
+int main(int argc, char *argv[]) {
+    const auto script =
+        argc > 1 ? read_script(argv[1]) : synthetic_script(size_t{64} << 20);
+    if (!script) {
+        std::println(stderr, "lex_bench: cannot open {}", argv[1]);
+        return 1;
+    }
+
+    const size_t max_threads =
+        argc > 2 ? std::strtoul(argv[2], nullptr, 10) : lex_threads();
+
+    IncrementalLexer reference{};
+    lex_script(*script, reference, 1);
+    const auto expected = reference.finish();
+
+    const double megabytes = static_cast<double>(script->size()) / (1 << 20);
+    std::println("script: {:.1f} MiB, {} tokens", megabytes, expected.size());
+    std::println("{:>8} {:>10} {:>10} {:>8} {:>10}", "threads", "time (ms)",
+                 "MiB/s", "speedup", "identical");
+
+    std::chrono::nanoseconds sequential{};
+    bool all_identical = true;
+
+    for (size_t threads = 1; threads <= max_threads;
+         threads = threads < max_threads ? std::min(threads * 2, max_threads)
+                                         : max_threads + 1) {
+        const Run result =
+            run(*script, threads, reference.input(), expected);
+        if (threads == 1)
+            sequential = result.elapsed;
+
+        const double seconds = std::chrono::duration<double>(result.elapsed).count();
+        const double speedup =
+            std::chrono::duration<double>(sequential).count() / seconds;
+
+        std::println("{:>8} {:>10.1f} {:>10.1f} {:>7.2f}x {:>10}", threads,
+                     seconds * 1000, megabytes / seconds, speedup,
+                     result.identical ? "yes" : "NO");
+
+        all_identical = all_identical && result.identical;
+    }
+
+    return all_identical ? 0 : 1;
+}
@@ -0,0 +1,83 @@
+/**
+ * Benchmark of the `parallel` builtin.
+ *
+ * Runs many short tasks, `/bin/true` and `/bin/sleep 0.005`, once one
+ * after the other as a script of one command per line and then through
+ * `parallel -j n` with n of 1, 2, 4, ... up to the number of online CPUs.
+ * Prints the tasks run per second of each run.
+ *
+ * Usage: parallel_bench [tasks]
+ *
+ * Defaults to 1000 tasks per run.
+ */
+#include "executor.h"
+#include "stats.h"
+#include <array>
+#include <chrono>
+#include <cstdlib>
+#include <format>
+#include <print>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <unistd.h>
+
+// The item of every task is the duration of the sleep
+static constexpr std::string_view item = "0.005";
+
+static constexpr std::array<std::string_view, 2> programs{
+    "/bin/true",
+    "/bin/sleep",
+};
+
+static std::chrono::nanoseconds run(const std::string &script) {
+    std::istringstream input{script};
+    Executor executor{};
+
+    const auto start = std::chrono::steady_clock::now();
+    executor.script(input);
+    return std::chrono::steady_clock::now() - start;
+}
+
+int main(int argc, char *argv[]) {
+    const size_t tasks = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1000;
+
+    Stats::init();
+
+    const long online = sysconf(_SC_NPROCESSORS_ONLN);
+    const size_t cpus = online > 0 ? static_cast<size_t>(online) : 1;
+
+    const auto throughput = [&](std::chrono::nanoseconds time) {
+        return static_cast<double>(tasks) /
+               std::chrono::duration<double>(time).count();
+    };
+
+    std::println("{:<12} {:>10} {:>12} {:>8}", "program", "jobs",
+                 "tasks/s", "speedup");
+
+    for (const auto program : programs) {
+        std::string sequential{};
+        std::string items{};
+
+        for (size_t i = 0; i < tasks; ++i) {
+            sequential += std::format("{} {}\n", program, item);
+            items += std::format(" {}", item);
+        }
+
+        const auto base = run(sequential);
+
+        std::println("{:<12} {:>10} {:>12.0f} {:>7.2f}x", program,
+                     "sequential", throughput(base), 1.0);
+
+        for (size_t jobs = 1; jobs <= cpus; jobs *= 2) {
+            const std::string script =
+                std::format("parallel -j {} {} :::{}\n", jobs, program, items);
+            const auto time = run(script);
+
+            std::println("{:<12} {:>10} {:>12.0f} {:>7.2f}x", program, jobs,
+                         throughput(time), throughput(time) / throughput(base));
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,143 @@
+/**
+ * Benchmark of the parsers.
+ *
+ * Parses a script with SyntaxTree and with the predictive Parser, checks
+ * that both produce the same syntax tree and prints the throughput of each
+ * one, with the time spent to free the tree and the heap allocations made.
+ * The allocations are counted on a new Ast (cold) and on an Ast that was
+ * cleared after parsing the same script (warm), as the shell does between
+ * two commands.
+ *
+ * Usage: parse_bench [script]
+ *
+ * Without a script a synthetic one of about 8 MiB is generated.
+ */
+#include "corpus.h"
+#include "parallel_lexer.h"
+#include "parser.h"
+#include "syntax.h"
+#include "tokenizer.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <format>
+#include <new>
+#include <optional>
+#include <print>
+#include <span>
+#include <string>
+
+// Heap allocations made by the program
+static size_t allocations = 0;
+
+void *operator new(std::size_t size) {
+    ++allocations;
+
+    if (void *ptr = std::malloc(size == 0 ? 1 : size))
+        return ptr;
+
+    throw std::bad_alloc{};
+}
+
+void operator delete(void *ptr) noexcept { std::free(ptr); }
+
+void operator delete(void *ptr, std::size_t) noexcept { std::free(ptr); }
+
+// Runs of each parser, the fastest one is reported
+static constexpr int repetitions = 5;
+
+struct Run {
+    // Parsing time of the fastest run, and the time to free its tree
+    std::chrono::nanoseconds elapsed;
+    std::chrono::nanoseconds free;
+    // Allocations of the first run and of the following ones
+    size_t cold_allocations;
+    size_t warm_allocations;
+    // Debug representation of the tree, empty if the parsing failed
+    std::string tree;
+};
+
+template <typename Fn> static Run run(Fn &&parse) {
+    Run best{.elapsed = std::chrono::nanoseconds::max()};
+    Ast ast{};
+
+    for (int i = 0; i < repetitions; ++i) {
+        const size_t allocated = allocations;
+
+        const auto start = std::chrono::steady_clock::now();
+        const std::optional<ThisProgram> program = parse(ast);
+        const auto parsed = std::chrono::steady_clock::now();
+
+        (i == 0 ? best.cold_allocations : best.warm_allocations) =
+            allocations - allocated;
+
+        if (i == 0 && program)
+            best.tree = std::format("{:?}", InAst{ast, *program});
+
+        const auto freeing = std::chrono::steady_clock::now();
+        ast.clear();
+        const auto freed = std::chrono::steady_clock::now();
+
+        if (parsed - start < best.elapsed) {
+            best.elapsed = parsed - start;
+            best.free = freed - freeing;
+        }
+    }
+
+    return best;
+}
+
+int main(int argc, char *argv[]) {
+    const auto script =
+        argc > 1 ? read_script(argv[1]) : synthetic_script(size_t{8} << 20);
+    if (!script) {
+        std::println(stderr, "parse_bench: cannot open {}", argv[1]);
+        return 1;
+    }
+
+    IncrementalLexer lexer{};
+    lex_script(*script, lexer, 1);
+
+    const std::span<const Token> tokens = lexer.finish();
+    const std::string_view input = lexer.input();
+
+    const Run tree = run([&](Ast &ast) {
+        TokenIter tokenizer{tokens, input};
+        auto program = SyntaxTree<TokenIter>{ast}.program(tokenizer);
+
+        // The tree must cover the whole input to be compared
+        return tokenizer.next_is_eof() ? program : std::nullopt;
+    });
+
+    const Run predictive = run(
+        [&](Ast &ast) { return Parser{tokens, input, ast}.program(); });
+
+    const double megabytes = static_cast<double>(input.size()) / (1 << 20);
+    std::println("script: {:.1f} MiB, {} tokens", megabytes, tokens.size());
+    std::println("{:>12} {:>10} {:>10} {:>10} {:>12} {:>10} {:>10}", "parser",
+                 "time (ms)", "free (ms)", "MiB/s", "Mtokens/s", "allocs",
+                 "warm");
+
+    for (const auto &[name, result] :
+         {std::pair{"tree", &tree}, std::pair{"predictive", &predictive}}) {
+        const double seconds =
+            std::chrono::duration<double>(result->elapsed).count();
+        const double free_ms =
+            std::chrono::duration<double, std::milli>(result->free).count();
+
+        std::println("{:>12} {:>10.1f} {:>10.3f} {:>10.1f} {:>12.2f} {:>10} "
+                     "{:>10}",
+                     name, seconds * 1000, free_ms, megabytes / seconds,
+                     static_cast<double>(tokens.size()) / seconds / 1e6,
+                     result->cold_allocations, result->warm_allocations);
+    }
+
+    if (tree.tree.empty() || tree.tree != predictive.tree) {
+        std::println(stderr, "parse_bench: the syntax trees differ");
+        return 1;
+    }
+
+    std::println("syntax trees: identical");
+
+    return 0;
+}
@@ -0,0 +1,102 @@
+/**
+ * Benchmark of the pipes of the pipelines.
+ *
+ * Writes a file of the given size and runs `cat file | cat | cat >
+ * /dev/null` with pipes of 64 KiB, 128 KiB, ... up to
+ * /proc/sys/fs/pipe-max-size, set through TESTSH_PIPE_SIZE. Every size is
+ * run twice: once executing /bin/cat and once with the `cat` commands run
+ * as splice() relays of the shell. Prints the throughput of each run.
+ *
+ * Usage: pipe_bench [file MiB]
+ *
+ * Defaults to a file of 512 MiB.
+ */
+#include "executor.h"
+#include "stats.h"
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <format>
+#include <fstream>
+#include <optional>
+#include <print>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+static int pipe_max_size() {
+    std::ifstream proc{"/proc/sys/fs/pipe-max-size"};
+    int size = 0;
+
+    if (!(proc >> size) || size <= 0)
+        return 1 << 20;
+
+    return size;
+}
+
+static std::chrono::nanoseconds run(const std::string &script, int pipe_size,
+                                    bool relay) {
+    std::istringstream input{script};
+    Executor executor{};
+    executor.splice_relay = relay;
+    executor.shell.vars.upsert(
+        "TESTSH_PIPE_SIZE=" + std::to_string(pipe_size), std::nullopt);
+
+    const auto start = std::chrono::steady_clock::now();
+    executor.script(input);
+    return std::chrono::steady_clock::now() - start;
+}
+
+int main(int argc, char *argv[]) {
+    const size_t mib = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 512;
+
+    Stats::init();
+
+    char path[] = "/tmp/testsh-pipe-bench-XXXXXX";
+    const int file = mkstemp(path);
+    if (file == -1) {
+        std::println(stderr, "pipe_bench: mkstemp: {}", std::strerror(errno));
+        return 1;
+    }
+
+    std::vector<char> block(size_t{1} << 20);
+    for (size_t i = 0; i < block.size(); ++i)
+        block[i] = static_cast<char>('a' + i % 26);
+
+    for (size_t i = 0; i < mib; ++i) {
+        if (write(file, block.data(), block.size()) !=
+            static_cast<ssize_t>(block.size())) {
+            std::println(stderr, "pipe_bench: write: {}",
+                         std::strerror(errno));
+            unlink(path);
+            return 1;
+        }
+    }
+    close(file);
+
+    const std::string script =
+        std::format("cat {} | cat | cat > /dev/null\n", path);
+
+    const auto throughput = [&](std::chrono::nanoseconds time) {
+        return static_cast<double>(mib) /
+               std::chrono::duration<double>(time).count();
+    };
+
+    std::println("{:>15} {:>14} {:>15} {:>8}", "pipe size (KiB)",
+                 "exec (MiB/s)", "splice (MiB/s)", "speedup");
+
+    for (int size = 64 << 10; size <= pipe_max_size(); size *= 2) {
+        const auto exec_time = run(script, size, false);
+        const auto relay_time = run(script, size, true);
+
+        std::println("{:>15} {:>14.0f} {:>15.0f} {:>7.2f}x", size >> 10,
+                     throughput(exec_time), throughput(relay_time),
+                     throughput(relay_time) / throughput(exec_time));
+    }
+
+    unlink(path);
+    return 0;
+}
@@ -0,0 +1,139 @@
+/**
+ * Benchmark of the spawn engines.
+ *
+ * Starts /bin/true many times with each engine of spawn_program(), waiting
+ * for every child before starting the next one, and prints the commands
+ * run per second. The runs are repeated while the heap of the process
+ * grows from 0 up to the given size, to show how the cost of fork()
+ * follows the memory of the shell while the cost of posix_spawn() does
+ * not. Every page of the heap is touched, so that it is really mapped.
+ *
+ * The fork-to-exec latency is the time from the call to spawn_program() to
+ * the exec of the child. It is measured with a pipe whose write end is
+ * inherited by the child and closed on exec: the parent reads the end of
+ * file when the exec happened. The median of the commands is printed.
+ *
+ * Usage: spawn_bench [max heap MiB] [commands]
+ *
+ * Defaults to a heap of up to 1024 MiB and 500 commands per run.
+ */
+#include "spawn.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <memory>
+#include <print>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+struct Run {
+    double commands_per_second;
+    // Median fork-to-exec latency
+    std::chrono::nanoseconds exec_latency;
+};
+
+static pid_t spawn(SpawnEngine engine, char *const argv[]) {
+    char *const envp[] = {nullptr};
+
+    const pid_t pid =
+        spawn_program(engine, Program{}, argv, envp, ProcessSetup{});
+    if (pid == -1) {
+        std::println(stderr, "spawn_bench: {}: {}", argv[0],
+                     std::strerror(errno));
+        std::exit(1);
+    }
+
+    return pid;
+}
+
+// Runs a command at a time
+static Run run(SpawnEngine engine, size_t commands) {
+    std::string program{"/bin/true"};
+    char *const argv[] = {program.data(), nullptr};
+    int wstatus;
+
+    const auto start = std::chrono::steady_clock::now();
+
+    for (size_t i = 0; i < commands; ++i)
+        waitpid(spawn(engine, argv), &wstatus, 0);
+
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+
+    std::vector<std::chrono::nanoseconds> latencies{};
+
+    for (size_t i = 0; i < commands; ++i) {
+        int pipefd[2];
+        if (pipe2(pipefd, O_CLOEXEC) == -1) {
+            std::perror("pipe2");
+            std::exit(1);
+        }
+
+        const auto spawned = std::chrono::steady_clock::now();
+        const pid_t pid = spawn(engine, argv);
+        close(pipefd[1]);
+
+        char byte;
+        while (read(pipefd[0], &byte, 1) > 0)
+            ;
+        latencies.push_back(std::chrono::steady_clock::now() - spawned);
+
+        close(pipefd[0]);
+        waitpid(pid, &wstatus, 0);
+    }
+
+    std::ranges::nth_element(latencies,
+                             latencies.begin() + latencies.size() / 2);
+
+    return Run{
+        .commands_per_second =
+            static_cast<double>(commands) /
+            std::chrono::duration<double>(elapsed).count(),
+        .exec_latency = latencies[latencies.size() / 2],
+    };
+}
+
+int main(int argc, char *argv[]) {
+    const size_t max_heap = argc > 1 ? std::strtoull(argv[1], nullptr, 10)
+                                     : 1024;
+    const size_t commands =
+        argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 500;
+
+    // Blocks of the heap, allocated one at a time as the heap grows
+    std::vector<std::unique_ptr<char[]>> heap{};
+    constexpr size_t block = size_t{1} << 20;
+
+    std::println("{:>10} {:>14} {:>14} {:>8} {:>15} {:>15}", "heap (MiB)",
+                 "spawn (cmd/s)", "fork (cmd/s)", "speedup",
+                 "spawn exec (us)", "fork exec (us)");
+
+    for (size_t heap_size = 0; heap_size <= max_heap;
+         heap_size = heap_size == 0 ? 16 : heap_size * 4) {
+        while (heap.size() < heap_size) {
+            auto &memory = heap.emplace_back(new char[block]);
+            std::memset(memory.get(), 1, block);
+        }
+
+        const Run spawned = run(SpawnEngine::spawn, commands);
+        const Run forked = run(SpawnEngine::fork, commands);
+
+        const auto micros = [](std::chrono::nanoseconds latency) {
+            return std::chrono::duration<double, std::micro>(latency).count();
+        };
+
+        std::println("{:>10} {:>14.0f} {:>14.0f} {:>7.2f}x {:>15.1f} "
+                     "{:>15.1f}",
+                     heap_size, spawned.commands_per_second,
+                     forked.commands_per_second,
+                     spawned.commands_per_second / forked.commands_per_second,
+                     micros(spawned.exec_latency),
+                     micros(forked.exec_latency));
+    }
+
+    return 0;
+}
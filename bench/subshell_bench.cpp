@@ -0,0 +1,116 @@
+/**
+ * Benchmark of the virtual subshells.
+ *
+ * Runs a script heavy in command substitutions and subshells whose bodies
+ * only use builtins, such as `x=$(printf ...)` and `(cd / && pwd)`, twice:
+ * once with the subshells run by the shell itself and once with every
+ * subshell forked, as with TESTSH_SUBSHELL=fork. Prints the time of each
+ * run, the time per command and the forks it made.
+ *
+ * The output of the commands is discarded: stdout is redirected to
+ * /dev/null while the scripts run.
+ *
+ * Usage: subshell_bench [iterations]
+ *
+ * Defaults to 20000 commands per script.
+ */
+#include "executor.h"
+#include "stats.h"
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <print>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <unistd.h>
+
+static constexpr std::array<std::string_view, 6> commands{
+    "x=$(printf '%s' value)",
+    "y=$(echo $x)",
+    "d=$(cd / && pwd)",
+    "(cd /tmp && z=1)",
+    "(x=other; echo $x)",
+    "[ $(echo a) = a ]",
+};
+
+static std::string script(size_t iterations) {
+    std::string script{};
+
+    for (size_t i = 0; i < iterations; ++i) {
+        script += commands[i % commands.size()];
+        script += '\n';
+    }
+
+    return script;
+}
+
+struct Run {
+    std::chrono::nanoseconds time;
+    size_t forks;
+};
+
+static Run run(const std::string &text, bool virtual_subshells) {
+    std::istringstream input{text};
+    Executor executor{};
+    executor.virtual_subshells = virtual_subshells;
+
+    const size_t forks = stats().forks;
+    const auto start = std::chrono::steady_clock::now();
+    executor.script(input);
+
+    return Run{
+        .time = std::chrono::steady_clock::now() - start,
+        .forks = stats().forks - forks,
+    };
+}
+
+int main(int argc, char *argv[]) {
+    const size_t iterations =
+        argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 20000;
+
+    Stats::init();
+
+    const std::string text = script(iterations);
+
+    const int null = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    const int saved_stdout = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 10);
+    if (null == -1 || saved_stdout == -1) {
+        std::println(stderr, "subshell_bench: {}", std::strerror(errno));
+        return 1;
+    }
+
+    std::fflush(stdout);
+    dup2(null, STDOUT_FILENO);
+
+    const Run virtual_run = run(text, true);
+    const Run forked_run = run(text, false);
+
+    std::fflush(stdout);
+    dup2(saved_stdout, STDOUT_FILENO);
+
+    const auto seconds = [](std::chrono::nanoseconds time) {
+        return std::chrono::duration<double>(time).count();
+    };
+    const auto micros = [&](std::chrono::nanoseconds time) {
+        return std::chrono::duration<double, std::micro>(time).count() /
+               static_cast<double>(iterations);
+    };
+
+    std::println("{:<10} {:>10} {:>16} {:>10}", "", "time (s)",
+                 "per command (us)", "forks");
+    std::println("{:<10} {:>10.3f} {:>16.2f} {:>10}", "virtual",
+                 seconds(virtual_run.time), micros(virtual_run.time),
+                 virtual_run.forks);
+    std::println("{:<10} {:>10.3f} {:>16.2f} {:>10}", "fork",
+                 seconds(forked_run.time), micros(forked_run.time),
+                 forked_run.forks);
+    std::println("speedup: {:.1f}x",
+                 seconds(forked_run.time) / seconds(virtual_run.time));
+
+    return 0;
+}
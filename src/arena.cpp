@@ -0,0 +1,108 @@
+#include "arena.h"
+#include "util.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <format>
+#include <stdexcept>
+#include <sys/mman.h>
+
+// Offsets inside the arena must fit in 32 bits
+static constexpr size_t max_reservation = size_t{1} << 32;
+static constexpr size_t min_reservation = size_t{1} << 20;
+
+// Size of the smallest chunk of a ScratchArena
+static constexpr size_t scratch_chunk = size_t{4} << 10;
+
+// Above this size the pages are given back to the kernel on clear()
+static constexpr size_t release_threshold = size_t{1} << 20;
+
+InputArena::InputArena() {
+    /* Reserve only the address space: with MAP_NORESERVE the memory is not
+     * accounted until it is touched. If the reservation is refused (e.g.
+     * overcommit is disabled) retry with a smaller one.
+     */
+    for (size_t size = max_reservation; size >= min_reservation; size /= 2) {
+        void *addr = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+        if (addr != MAP_FAILED) {
+            this->base = static_cast<char *>(addr);
+            this->capacity = size;
+            return;
+        }
+    }
+
+    throw std::runtime_error(
+        std::format("InputArena: mmap: {}", std::strerror(errno)));
+}
+
+InputArena::~InputArena() {
+    if (this->base != nullptr)
+        munmap(this->base, this->capacity);
+}
+
+std::string_view InputArena::append(std::string_view text) {
+    if (text.size() > this->capacity - this->length) {
+        throw std::runtime_error(std::format(
+            "InputArena: input larger than {} bytes", this->capacity));
+    }
+
+    char *dest = this->base + this->length;
+    std::memcpy(dest, text.data(), text.size());
+    this->length += text.size();
+
+    return {dest, text.size()};
+}
+
+void InputArena::truncate(size_t size) {
+    assertm(size <= this->length, "truncate() can only shrink the arena");
+
+    this->length = size;
+}
+
+void InputArena::clear() {
+    if (this->length > release_threshold) {
+        madvise(this->base, this->length, MADV_DONTNEED);
+    }
+
+    this->length = 0;
+}
+
+// ------------------------------------
+// ScratchArena
+// ------------------------------------
+
+char *ScratchArena::allocate(size_t size) {
+    // Move to the next chunk that can fit the request
+    while (this->current < this->chunks.size() &&
+           this->chunk_sizes[this->current] - this->used < size) {
+        ++this->current;
+        this->used = 0;
+    }
+
+    if (this->current == this->chunks.size()) {
+        const size_t chunk_size = std::max(size, scratch_chunk);
+
+        this->chunks.emplace_back(std::make_unique<char[]>(chunk_size));
+        this->chunk_sizes.push_back(chunk_size);
+        this->used = 0;
+    }
+
+    char *memory = this->chunks[this->current].get() + this->used;
+    this->used += size;
+
+    return memory;
+}
+
+std::string_view ScratchArena::store(std::string_view text) {
+    char *dest = this->allocate(text.size());
+    std::memcpy(dest, text.data(), text.size());
+
+    return {dest, text.size()};
+}
+
+void ScratchArena::clear() {
+    this->current = 0;
+    this->used = 0;
+}
@@ -0,0 +1,75 @@
+#ifndef TESTSH_ARENA_H
+#define TESTSH_ARENA_H
+
+#include <cstddef>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+/**
+ * Append-only buffer that holds the text of the command being read.
+ *
+ * The address space is reserved once when the arena is created and the
+ * pages are only committed when they are written, so appending never moves
+ * the content. Views returned by the arena stay valid until clear() or
+ * truncate() drop the bytes they point to.
+ */
+class InputArena {
+    char *base = nullptr;
+    size_t capacity = 0;
+    size_t length = 0;
+
+  public:
+    InputArena();
+    ~InputArena();
+
+    InputArena(const InputArena &) = delete;
+    InputArena(InputArena &&) = delete;
+    InputArena &operator=(const InputArena &) = delete;
+    InputArena &operator=(InputArena &&) = delete;
+
+    /**
+     * Copies `text` at the end of the arena and returns the view over the
+     * copied bytes.
+     */
+    std::string_view append(std::string_view text);
+
+    /**
+     * Drops every byte after the first `size` bytes.
+     */
+    void truncate(size_t size);
+
+    void clear();
+
+    size_t size() const { return length; }
+
+    std::string_view view() const { return {base, length}; }
+};
+
+/**
+ * Bump allocator for the text produced while a command is expanded
+ * (unescaped words, substitutions, ...). The memory is grabbed in chunks
+ * that are never moved, and kept after clear() to be reused by the
+ * following commands.
+ */
+class ScratchArena {
+    std::vector<std::unique_ptr<char[]>> chunks;
+    std::vector<size_t> chunk_sizes;
+    size_t current = 0;
+    size_t used = 0;
+
+  public:
+    /**
+     * Returns `size` bytes valid until the next clear().
+     */
+    char *allocate(size_t size);
+
+    /**
+     * Copies `text` inside the arena.
+     */
+    std::string_view store(std::string_view text);
+
+    void clear();
+};
+
+#endif // TESTSH_ARENA_H
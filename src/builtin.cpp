@@ -1,25 +1,137 @@
 #include "builtin.h"
 #include "exec_prog.h"
+#include <algorithm>
+#include <array>
 #include <cerrno>
+#include <charconv>
+#include <csignal>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <fcntl.h>
 #include <filesystem>
+#include <format>
+#include <optional>
 #include <print>
+#include <ranges>
+#include <span>
+#include <string>
+#include <string_view>
+#include <sys/stat.h>
+#include <type_traits>
 #include <unistd.h>
+#include <utility>
 
 namespace fs = std::filesystem;
 
-int builtin_bg(const SimpleCommand &bg, std::vector<Job> &jobs,
-               const Waiter &waiter) {
+// ------------------------------------
+// Output
+// ------------------------------------
 
-    if (jobs.empty()) {
-        std::println(stderr, "bg: no jobs to resume in background");
+/**
+ * Output of a builtin. It is written on the fd once, when the builtin
+ * terminates, unless a lot of it is buffered.
+ */
+class BufferedWriter {
+    static constexpr size_t capacity = size_t{64} << 10;
+
+    int fd;
+    // Name of the builtin, for the error messages
+    std::string_view name;
+    std::string buffer{};
+    bool failed = false;
+
+  public:
+    BufferedWriter(int fd, std::string_view name) : fd(fd), name(name) {}
+
+    BufferedWriter(const BufferedWriter &) = delete;
+    BufferedWriter &operator=(const BufferedWriter &) = delete;
+
+    ~BufferedWriter() { this->flush(); }
+
+    void write(std::string_view str) {
+        this->buffer.append(str);
+
+        if (this->buffer.size() >= capacity)
+            this->flush();
+    }
+
+    void put(char c) { this->write(std::string_view{&c, 1}); }
+
+    /**
+     * Writes what is buffered. Returns false if this or a previous write
+     * failed, the error is printed once.
+     */
+    bool flush() {
+        std::string_view pending{this->buffer};
+
+        while (!pending.empty() && !this->failed) {
+            const ssize_t written =
+                ::write(this->fd, pending.data(), pending.size());
+
+            if (written == -1 && errno == EINTR)
+                continue;
+
+            if (written == -1) {
+                std::println(stderr, "{}: write error: {}", this->name,
+                             std::strerror(errno));
+                this->failed = true;
+                break;
+            }
+
+            pending.remove_prefix(static_cast<size_t>(written));
+        }
+
+        this->buffer.clear();
+        return !this->failed;
+    }
+
+    // Flushes and returns the exit code of the builtin
+    int finish(int exit_code) { return this->flush() ? exit_code : 1; }
+};
+
+/**
+ * Returns the job of `spec`, `%n`, `%%` or `%+`, or the current job if
+ * `spec` is empty. Prints the error of `builtin` and returns 0 if there is
+ * no such job.
+ */
+static JobId find_job(std::string_view builtin, std::string_view spec,
+                      const JobTable &jobs) {
+    if (spec.empty() || spec == "%%" || spec == "%+") {
+        if (jobs.empty())
+            std::println(stderr, "{}: no current job", builtin);
+
+        return jobs.current();
+    }
+
+    JobId id = 0;
+    const auto number = spec.substr(1);
+    const auto [end, error] =
+        std::from_chars(number.data(), number.data() + number.size(), id);
+
+    if (!spec.starts_with('%') || error != std::errc{} ||
+        end != number.data() + number.size() || jobs.find(id) == nullptr) {
+        std::println(stderr, "{}: {}: no such job", builtin, spec);
+        return 0;
+    }
+
+    return id;
+}
+
+int builtin_bg(const SimpleCommand &bg, JobTable &jobs, const Waiter &waiter) {
+    if (bg.arguments.size() > 1) {
+        std::println(stderr, "bg: too many arguments");
         return 1;
     }
 
-    auto &job = jobs[jobs.size() - 1];
+    const JobId id =
+        find_job("bg", bg.arguments.empty() ? "" : bg.arguments[0], jobs);
+    if (id == 0)
+        return 1;
 
-    waiter.bg(job);
+    waiter.bg(*jobs.find(id));
 
     return 0;
 }
@@ -55,6 +167,135 @@ int builtin_cd(const SimpleCommand &cd) {
     return 0;
 }
 
+int builtin_colon(const SimpleCommand &) { return 0; }
+
+/**
+ * Expands the escape sequence of echo and printf that starts at `str[i]`,
+ * after the backslash, and moves `i` to its last character. Returns false
+ * on `\c`, which terminates the output. Numeric escapes are `\0NNN` for
+ * echo and %b, `\NNN` in a format of printf.
+ */
+static bool escape(std::string_view str, size_t &i, bool leading_zero,
+                   BufferedWriter &out) {
+    const auto octal = [&](size_t max_digits) {
+        unsigned value = 0;
+        for (size_t n = 0; n < max_digits && i + 1 < str.size() &&
+                           str[i + 1] >= '0' && str[i + 1] <= '7';
+             ++n) {
+            value = value * 8 + static_cast<unsigned>(str[++i] - '0');
+        }
+        out.put(static_cast<char>(value));
+    };
+
+    switch (str[i]) {
+    case 'a':
+        out.put('\a');
+        break;
+    case 'b':
+        out.put('\b');
+        break;
+    case 'c':
+        return false;
+    case 'e':
+        out.put('\x1b');
+        break;
+    case 'f':
+        out.put('\f');
+        break;
+    case 'n':
+        out.put('\n');
+        break;
+    case 'r':
+        out.put('\r');
+        break;
+    case 't':
+        out.put('\t');
+        break;
+    case 'v':
+        out.put('\v');
+        break;
+    case '\\':
+        out.put('\\');
+        break;
+    case '0':
+        octal(leading_zero ? 3 : 2);
+        break;
+    case '1':
+    case '2':
+    case '3':
+    case '4':
+    case '5':
+    case '6':
+    case '7':
+        if (leading_zero) {
+            out.put('\\');
+            out.put(str[i]);
+            break;
+        }
+        --i;
+        octal(3);
+        break;
+    default:
+        out.put('\\');
+        out.put(str[i]);
+        break;
+    }
+
+    return true;
+}
+
+// Writes `str` expanding its escapes, returns false on `\c`
+static bool write_escaped(std::string_view str, bool leading_zero,
+                          BufferedWriter &out) {
+    for (size_t i = 0; i < str.size(); ++i) {
+        if (str[i] != '\\' || i + 1 == str.size()) {
+            out.put(str[i]);
+            continue;
+        }
+
+        ++i;
+        if (!escape(str, i, leading_zero, out))
+            return false;
+    }
+
+    return true;
+}
+
+int builtin_echo(const SimpleCommand &echo) {
+    BufferedWriter out{STDOUT_FILENO, "echo"};
+    std::span<const std::string_view> args{echo.arguments};
+
+    bool newline = true;
+    bool escapes = false;
+
+    // Options as the ones of coreutils: -n, -e and -E, possibly merged
+    while (!args.empty() && args[0].size() > 1 && args[0][0] == '-' &&
+           args[0].find_first_not_of("neE", 1) == std::string_view::npos) {
+        for (const char option : args[0].substr(1)) {
+            newline = newline && option != 'n';
+            escapes = (option == 'e') || (escapes && option != 'E');
+        }
+
+        args = args.subspan(1);
+    }
+
+    for (size_t i = 0; i < args.size(); ++i) {
+        if (i > 0)
+            out.put(' ');
+
+        if (!escapes) {
+            out.write(args[i]);
+        } else if (!write_escaped(args[i], true, out)) {
+            return out.finish(0);
+        }
+    }
+
+    if (newline)
+        out.put('\n');
+
+    return out.finish(0);
+}
+
 int builtin_exec(const SimpleCommand &exec, const Shell &shell) {
     assert(exec.program == "exec");
 
@@ -90,7 +331,7 @@ int builtin_exit(const SimpleCommand &exit) {
     int exit_code{};
 
     if (exit.arguments.size() == 1) {
-        exit_code = std::atoi(exit.arguments[0].c_str());
+        exit_code = std::atoi(std::string(exit.arguments[0]).c_str());
     } else {
         exit_code = 0;
     }
@@ -98,31 +339,992 @@ int builtin_exit(const SimpleCommand &exit) {
     std::exit(exit_code);
 }
 
-int builtin_fg(const SimpleCommand &fg, std::vector<Job> &jobs,
-               const Waiter &waiter) {
+int builtin_false(const SimpleCommand &) { return 1; }
 
-    if (jobs.empty()) {
-        std::println(stderr, "bg: no jobs to resume in background");
+int builtin_fg(const SimpleCommand &fg, JobTable &jobs, const Waiter &waiter) {
+    if (fg.arguments.size() > 1) {
+        std::println(stderr, "fg: too many arguments");
         return 1;
     }
 
-    auto &job = jobs[jobs.size() - 1];
+    const JobId id =
+        find_job("fg", fg.arguments.empty() ? "" : fg.arguments[0], jobs);
+    if (id == 0)
+        return 1;
 
+    Job &job = *jobs.find(id);
     waiter.fg(job);
 
-    return 0;
+    // The job was waited outside of the table
+    jobs.update(id);
+    if (!job.completed())
+        return 0;
+
+    const int exit_code = job.exec_stats().exit_code;
+    jobs.remove(id);
+    return exit_code;
 }
 
-int builtin_jobs(const SimpleCommand &jobs, const std::vector<Job> &bg_jobs) {
+int builtin_hash(const SimpleCommand &hash, CommandHash &commands,
+                 const ShellVars &vars) {
+    assert(hash.program == "hash");
+
+    if (hash.arguments.empty()) {
+        if (commands.table().empty()) {
+            std::println("hash: hash table empty");
+        } else {
+            std::println("hits\tcommand");
+            for (const auto &[_, entry] : commands.table())
+                std::println("{:4}\t{}", entry.hits, entry.path);
+        }
+
+        std::println("hash: {} hits, {} misses", commands.hits(),
+                     commands.misses());
+        return 0;
+    }
+
+    int exit_code = 0;
+
+    for (const auto name : hash.arguments) {
+        if (name == "-r") {
+            commands.clear();
+            continue;
+        }
+
+        if (!commands.find(name, vars)) {
+            std::println(stderr, "hash: {}: not found", name);
+            exit_code = 1;
+        }
+    }
+
+    return exit_code;
+}
+
+int builtin_jobs(const SimpleCommand &jobs, const JobTable &table) {
     assert(jobs.program == "jobs");
 
     std::println("=== JOBS ===");
-    for (const auto &job : bg_jobs) {
+    table.for_each([](JobId id, const Job &job) {
         const auto state = job.stopped() ? "Stopped" : "Backgournd";
 
-        std::println("{}: Job state={}", job.pgid, state);
-    }
+        std::println("[{}] {}: Job state={}", id, job.pgid, state);
+    });
     std::println();
 
     return 0;
 }
+
+static constexpr std::pair<std::string_view, int> signal_names[] = {
+    {"HUP", SIGHUP},   {"INT", SIGINT},   {"QUIT", SIGQUIT},
+    {"KILL", SIGKILL}, {"USR1", SIGUSR1}, {"USR2", SIGUSR2},
+    {"PIPE", SIGPIPE}, {"ALRM", SIGALRM}, {"TERM", SIGTERM},
+    {"CHLD", SIGCHLD}, {"CONT", SIGCONT}, {"STOP", SIGSTOP},
+    {"TSTP", SIGTSTP}, {"TTIN", SIGTTIN}, {"TTOU", SIGTTOU},
+};
+
+// Returns the signal called `name`, with or without SIG, or numbered `name`
+static std::optional<int> find_signal(std::string_view name) {
+    int number = 0;
+    const auto [end, error] =
+        std::from_chars(name.data(), name.data() + name.size(), number);
+    if (error == std::errc{} && end == name.data() + name.size())
+        return number;
+
+    if (name.starts_with("SIG"))
+        name.remove_prefix(3);
+
+    for (const auto &[signal_name, signal] : signal_names) {
+        if (signal_name == name)
+            return signal;
+    }
+
+    return std::nullopt;
+}
+
+int builtin_kill(const SimpleCommand &kill, const JobTable &jobs) {
+    assert(kill.program == "kill");
+
+    std::span<const std::string_view> targets = kill.arguments;
+    int signal = SIGTERM;
+
+    if (!targets.empty() && targets[0] == "-s") {
+        const auto found =
+            targets.size() > 1 ? find_signal(targets[1]) : std::nullopt;
+        if (!found.has_value()) {
+            std::println(stderr, "kill: -s: invalid signal");
+            return 1;
+        }
+
+        signal = *found;
+        targets = targets.subspan(2);
+    } else if (!targets.empty() && targets[0] == "--") {
+        targets = targets.subspan(1);
+    } else if (!targets.empty() && targets[0].size() > 1 &&
+               targets[0].starts_with('-')) {
+        const auto found = find_signal(targets[0].substr(1));
+        if (!found.has_value()) {
+            std::println(stderr, "kill: {}: invalid signal", targets[0]);
+            return 1;
+        }
+
+        signal = *found;
+        targets = targets.subspan(1);
+    }
+
+    if (targets.empty()) {
+        std::println(stderr, "kill: usage: kill [-s sigspec | -signum | "
+                             "-sigspec] pid | %n ...");
+        return 1;
+    }
+
+    int exit_code = 0;
+
+    const auto send = [&](pid_t pid) {
+        if (::kill(pid, signal) == -1) {
+            std::println(stderr, "kill: ({}) - {}", pid, std::strerror(errno));
+            exit_code = 1;
+        }
+    };
+
+    for (const auto target : targets) {
+        if (target.starts_with('%')) {
+            const JobId id = find_job("kill", target, jobs);
+            if (id == 0) {
+                exit_code = 1;
+                continue;
+            }
+
+            // A non interactive shell runs its jobs in its own group
+            const Job &job = *jobs.find(id);
+            if (job.pgid > 0 && job.pgid != getpgrp()) {
+                send(-job.pgid);
+                continue;
+            }
+
+            for (const auto &process : job.processes) {
+                if (!process.completed)
+                    send(process.child_pid);
+            }
+            continue;
+        }
+
+        pid_t pid = 0;
+        const auto [end, error] =
+            std::from_chars(target.data(), target.data() + target.size(), pid);
+        if (error != std::errc{} || end != target.data() + target.size()) {
+            std::println(stderr,
+                         "kill: {}: arguments must be process or job IDs",
+                         target);
+            exit_code = 1;
+            continue;
+        }
+
+        send(pid);
+    }
+
+    return exit_code;
+}
+
+/**
+ * Formats a conversion of printf with snprintf(). `spec` is the conversion
+ * as written in the format, with the length modifier added by the caller.
+ */
+template <typename T>
+static void format_conversion(const std::string &spec, T value,
+                              BufferedWriter &out) {
+    std::array<char, 128> small;
+    const int size =
+        std::snprintf(small.data(), small.size(), spec.c_str(), value);
+
+    if (size < 0)
+        return;
+
+    if (static_cast<size_t>(size) < small.size()) {
+        out.write(std::string_view{small.data(), static_cast<size_t>(size)});
+        return;
+    }
+
+    std::string large(static_cast<size_t>(size), '\0');
+    std::snprintf(large.data(), large.size() + 1, spec.c_str(), value);
+    out.write(large);
+}
+
+/**
+ * Arguments of printf, consumed by the conversions. Numbers are parsed as
+ * by strtoll(): decimal, octal with a leading 0 or hexadecimal with a
+ * leading 0x. A leading quote gives the value of the next character.
+ */
+class PrintfArgs {
+    std::span<const std::string_view> args;
+    size_t next = 0;
+
+  public:
+    bool failed = false;
+
+    explicit PrintfArgs(std::span<const std::string_view> args)
+        : args(args) {}
+
+    bool empty() const { return this->args.empty(); }
+    bool exhausted() const { return this->next >= this->args.size(); }
+    size_t consumed() const { return this->next; }
+
+    std::string_view string() {
+        return this->exhausted() ? std::string_view{}
+                                 : this->args[this->next++];
+    }
+
+    template <typename T> T number() {
+        const std::string arg{this->string()};
+
+        if (arg.size() > 1 && (arg[0] == '\'' || arg[0] == '"'))
+            return static_cast<T>(static_cast<unsigned char>(arg[1]));
+
+        if (arg.empty())
+            return 0;
+
+        char *end = nullptr;
+        errno = 0;
+        const T value = std::is_floating_point_v<T>
+                            ? static_cast<T>(std::strtold(arg.c_str(), &end))
+                        : std::is_signed_v<T>
+                            ? static_cast<T>(std::strtoll(arg.c_str(), &end, 0))
+                            : static_cast<T>(
+                                  std::strtoull(arg.c_str(), &end, 0));
+
+        if (*end != '\0' || errno == ERANGE) {
+            std::println(stderr, "printf: {}: invalid number", arg);
+            this->failed = true;
+        }
+
+        return value;
+    }
+};
+
+// Reads `fd` until its end into `text`
+static bool read_all(int fd, std::string &text) {
+    char buffer[64 << 10];
+
+    for (;;) {
+        const ssize_t bytes = read(fd, buffer, sizeof(buffer));
+        if (bytes == 0)
+            return true;
+
+        if (bytes == -1) {
+            if (errno == EINTR)
+                continue;
+
+            return false;
+        }
+
+        text.append(buffer, static_cast<size_t>(bytes));
+    }
+}
+
+int builtin_parallel(const SimpleCommand &parallel, Executor &executor) {
+    assert(parallel.program == "parallel");
+
+    std::span<const std::string_view> args = parallel.arguments;
+
+    const long online = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t limit = online > 0 ? static_cast<size_t>(online) : 1;
+
+    // -j N, -jN or --jobs N
+    while (!args.empty() && args[0].starts_with('-')) {
+        std::string_view value{};
+
+        if ((args[0] == "-j" || args[0] == "--jobs") && args.size() > 1) {
+            value = args[1];
+            args = args.subspan(2);
+        } else if (args[0].starts_with("-j") && args[0].size() > 2) {
+            value = args[0].substr(2);
+            args = args.subspan(1);
+        } else {
+            std::println(stderr, "parallel: {}: invalid option", args[0]);
+            return 255;
+        }
+
+        const auto [end, error] =
+            std::from_chars(value.data(), value.data() + value.size(), limit);
+        if (error != std::errc{} || end != value.data() + value.size() ||
+            limit == 0) {
+            std::println(stderr, "parallel: {}: invalid number of jobs",
+                         value);
+            return 255;
+        }
+    }
+
+    const auto separator = std::ranges::find(args, std::string_view{":::"});
+    if (separator == args.begin()) {
+        std::println(stderr, "parallel: usage: parallel [-j n] command "
+                             "[argument ...] [::: item ...]");
+        return 255;
+    }
+
+    const SimpleCommand command{
+        .program = args[0],
+        .arguments = {args.begin() + 1, separator},
+        // The prefix assignments of `parallel` are exported to the tasks
+        .envs = parallel.envs,
+    };
+
+    std::string input{};
+    std::vector<std::string_view> items{};
+
+    if (separator != args.end()) {
+        items.assign(separator + 1, args.end());
+    } else {
+        // One item per line of the stdin
+        if (!read_all(STDIN_FILENO, input)) {
+            std::println(stderr, "parallel: read: {}", std::strerror(errno));
+            return 255;
+        }
+
+        for (const auto line : std::views::split(input, '\n')) {
+            if (!line.empty())
+                items.emplace_back(line.begin(), line.end());
+        }
+    }
+
+    return executor.parallel(command, items, limit);
+}
+
+int builtin_printf(const SimpleCommand &printf) {
+    if (printf.arguments.empty()) {
+        std::println(stderr, "printf: usage: printf format [arguments]");
+        return 2;
+    }
+
+    BufferedWriter out{STDOUT_FILENO, "printf"};
+    const std::string_view format = printf.arguments[0];
+    PrintfArgs args{std::span{printf.arguments}.subspan(1)};
+
+    // The format is reused as long as there are arguments left
+    do {
+        const size_t consumed = args.consumed();
+
+        for (size_t i = 0; i < format.size(); ++i) {
+            if (format[i] == '\\' && i + 1 < format.size()) {
+                ++i;
+                if (!escape(format, i, false, out))
+                    return out.finish(args.failed ? 1 : 0);
+                continue;
+            }
+
+            if (format[i] != '%' || i + 1 == format.size()) {
+                out.put(format[i]);
+                continue;
+            }
+
+            if (format[i + 1] == '%') {
+                out.put('%');
+                ++i;
+                continue;
+            }
+
+            // %[flags][width][.precision]conversion, the width and the
+            // precision can be taken from the arguments with `*`
+            std::string spec{"%"};
+            ++i;
+
+            while (i < format.size() &&
+                   std::string_view{"-+ #0"}.contains(format[i]))
+                spec += format[i++];
+
+            const auto digits = [&]() {
+                if (i < format.size() && format[i] == '*') {
+                    spec += std::to_string(args.number<int>());
+                    ++i;
+                    return;
+                }
+
+                while (i < format.size() && format[i] >= '0' &&
+                       format[i] <= '9')
+                    spec += format[i++];
+            };
+
+            digits();
+            if (i < format.size() && format[i] == '.') {
+                spec += format[i++];
+                digits();
+            }
+
+            if (i == format.size()) {
+                std::println(stderr, "printf: {}: invalid format", format);
+                return out.finish(1);
+            }
+
+            const char conversion = format[i];
+
+            switch (conversion) {
+            case 's':
+            case 'c': {
+                const std::string arg{args.string()};
+                if (conversion == 'c') {
+                    spec += 'c';
+                    format_conversion(spec, arg.empty() ? '\0' : arg[0], out);
+                } else {
+                    spec += 's';
+                    format_conversion(spec, arg.c_str(), out);
+                }
+                break;
+            }
+            case 'b':
+                if (!write_escaped(args.string(), true, out))
+                    return out.finish(args.failed ? 1 : 0);
+                break;
+            case 'd':
+            case 'i':
+                spec += "ll";
+                spec += conversion;
+                format_conversion(spec, args.number<long long>(), out);
+                break;
+            case 'o':
+            case 'u':
+            case 'x':
+            case 'X':
+                spec += "ll";
+                spec += conversion;
+                format_conversion(spec, args.number<unsigned long long>(),
+                                  out);
+                break;
+            case 'a':
+            case 'A':
+            case 'e':
+            case 'E':
+            case 'f':
+            case 'F':
+            case 'g':
+            case 'G':
+                spec += 'L';
+                spec += conversion;
+                format_conversion(spec, args.number<long double>(), out);
+                break;
+            default:
+                std::println(stderr, "printf: %{}: invalid conversion",
+                             conversion);
+                return out.finish(1);
+            }
+        }
+
+        // A format without conversions is printed only once
+        if (args.consumed() == consumed)
+            break;
+    } while (!args.exhausted());
+
+    return out.finish(args.failed ? 1 : 0);
+}
+
+int builtin_pwd(const SimpleCommand &pwd) {
+    for (const auto arg : pwd.arguments) {
+        if (arg != "-L" && arg != "-P") {
+            std::println(stderr, "pwd: {}: invalid option", arg);
+            return 2;
+        }
+    }
+
+    // The shell does not keep a logical path, both print the physical one
+    std::error_code ec;
+    const fs::path cwd = fs::current_path(ec);
+
+    if (ec) {
+        std::println(stderr, "pwd: {}", ec.message());
+        return 1;
+    }
+
+    BufferedWriter out{STDOUT_FILENO, "pwd"};
+    out.write(cwd.native());
+    out.put('\n');
+
+    return out.finish(0);
+}
+
+/**
+ * Evaluates the expression of `test` and `[`.
+ *
+ * The grammar is the one of POSIX with the XSI `-a`, `-o` and parentheses:
+ *
+ * expr    : and ('-o' and)*
+ * and     : not ('-a' not)*
+ * not     : '!' not | primary
+ * primary : '(' expr ')' | arg binary_op arg | unary_op arg | arg
+ *
+ * A binary operator is preferred over an unary one, so that `-f = -f`
+ * compares two strings, and the operators are plain strings when there is
+ * nothing after them, like in `-n` or `!`.
+ *
+ * The file operators share the stat() of their file: a path is stat'ed once
+ * for all the operators of the expression that test it.
+ */
+class TestExpression {
+    std::span<const std::string_view> args;
+    size_t pos = 0;
+
+    // Last file stat'ed, and its result
+    std::string stat_path{};
+    std::optional<struct stat> stat_result{};
+    bool stat_valid = false;
+
+  public:
+    // Set on a syntax error, test exits with 2
+    bool failed = false;
+
+  private:
+    size_t remaining() const { return this->args.size() - this->pos; }
+
+    bool next_is(std::string_view arg) const {
+        return this->remaining() > 0 && this->args[this->pos] == arg;
+    }
+
+    void error(std::string_view message) {
+        if (!this->failed)
+            std::println(stderr, "test: {}", message);
+        this->failed = true;
+    }
+
+    const std::optional<struct stat> &file(std::string_view path) {
+        if (!this->stat_valid || this->stat_path != path) {
+            this->stat_path = path;
+            this->stat_valid = true;
+
+            struct stat st;
+            if (stat(this->stat_path.c_str(), &st) == 0)
+                this->stat_result = st;
+            else
+                this->stat_result.reset();
+        }
+
+        return this->stat_result;
+    }
+
+    long long integer(std::string_view arg) {
+        const std::string str{arg};
+        char *end = nullptr;
+
+        errno = 0;
+        const long long value = std::strtoll(str.c_str(), &end, 10);
+
+        while (end != nullptr && (*end == ' ' || *end == '\t'))
+            ++end;
+
+        if (str.empty() || *end != '\0' || errno == ERANGE)
+            this->error(std::format("{}: integer expression expected", arg));
+
+        return value;
+    }
+
+    static bool is_unary(std::string_view op) {
+        static constexpr std::string_view ops[] = {
+            "-b", "-c", "-d", "-e", "-f", "-g", "-G", "-h", "-k", "-L",
+            "-n", "-O", "-p", "-r", "-s", "-S", "-t", "-u", "-w", "-x",
+            "-z",
+        };
+
+        return std::ranges::find(ops, op) != std::end(ops);
+    }
+
+    static bool is_binary(std::string_view op) {
+        static constexpr std::string_view ops[] = {
+            "=",   "==",  "!=",  "<",   ">",   "-eq", "-ne",
+            "-lt", "-le", "-gt", "-ge", "-nt", "-ot", "-ef",
+        };
+
+        return std::ranges::find(ops, op) != std::end(ops);
+    }
+
+    bool unary(std::string_view op, std::string_view arg) {
+        if (op == "-n")
+            return !arg.empty();
+        if (op == "-z")
+            return arg.empty();
+        if (op == "-t")
+            return isatty(static_cast<int>(this->integer(arg)));
+
+        const std::string path{arg};
+
+        if (op == "-h" || op == "-L") {
+            struct stat st;
+            return lstat(path.c_str(), &st) == 0 && S_ISLNK(st.st_mode);
+        }
+
+        if (op == "-r" || op == "-w" || op == "-x") {
+            const int mode = op == "-r" ? R_OK : op == "-w" ? W_OK : X_OK;
+            return faccessat(AT_FDCWD, path.c_str(), mode, AT_EACCESS) == 0;
+        }
+
+        const auto &st = this->file(arg);
+        if (!st)
+            return false;
+
+        const mode_t mode = st->st_mode;
+
+        switch (op[1]) {
+        case 'b':
+            return S_ISBLK(mode);
+        case 'c':
+            return S_ISCHR(mode);
+        case 'd':
+            return S_ISDIR(mode);
+        case 'e':
+            return true;
+        case 'f':
+            return S_ISREG(mode);
+        case 'g':
+            return mode & S_ISGID;
+        case 'G':
+            return st->st_gid == getegid();
+        case 'k':
+            return mode & S_ISVTX;
+        case 'O':
+            return st->st_uid == geteuid();
+        case 'p':
+            return S_ISFIFO(mode);
+        case 's':
+            return st->st_size > 0;
+        case 'S':
+            return S_ISSOCK(mode);
+        case 'u':
+            return mode & S_ISUID;
+        }
+
+        std::unreachable();
+    }
+
+    bool binary(std::string_view lhs, std::string_view op,
+                std::string_view rhs) {
+        if (op == "=" || op == "==")
+            return lhs == rhs;
+        if (op == "!=")
+            return lhs != rhs;
+        if (op == "<")
+            return lhs < rhs;
+        if (op == ">")
+            return lhs > rhs;
+
+        if (op == "-nt" || op == "-ot" || op == "-ef") {
+            const auto left = this->file(lhs);
+            const auto right = this->file(rhs);
+
+            if (op == "-ef")
+                return left && right && left->st_dev == right->st_dev &&
+                       left->st_ino == right->st_ino;
+
+            const auto newer = [](const auto &a, const auto &b) {
+                return a && (!b || a->st_mtim.tv_sec > b->st_mtim.tv_sec ||
+                             (a->st_mtim.tv_sec == b->st_mtim.tv_sec &&
+                              a->st_mtim.tv_nsec > b->st_mtim.tv_nsec));
+            };
+
+            return op == "-nt" ? newer(left, right) : newer(right, left);
+        }
+
+        const long long a = this->integer(lhs);
+        const long long b = this->integer(rhs);
+
+        if (op == "-eq")
+            return a == b;
+        if (op == "-ne")
+            return a != b;
+        if (op == "-lt")
+            return a < b;
+        if (op == "-le")
+            return a <= b;
+        if (op == "-gt")
+            return a > b;
+        return a >= b;
+    }
+
+    bool primary() {
+        const size_t remaining = this->remaining();
+
+        if (remaining == 0) {
+            this->error("argument expected");
+            return false;
+        }
+
+        const auto arg = this->args[this->pos];
+
+        if (remaining >= 3 && is_binary(this->args[this->pos + 1])) {
+            this->pos += 3;
+            return this->binary(arg, this->args[this->pos - 2],
+                                this->args[this->pos - 1]);
+        }
+
+        if (arg == "(" && remaining >= 2) {
+            ++this->pos;
+            const bool value = this->expr();
+
+            if (!this->next_is(")")) {
+                this->error("`)' expected");
+                return false;
+            }
+
+            ++this->pos;
+            return value;
+        }
+
+        if (remaining >= 2 && is_unary(arg)) {
+            this->pos += 2;
+            return this->unary(arg, this->args[this->pos - 1]);
+        }
+
+        ++this->pos;
+        return !arg.empty();
+    }
+
+    bool negation() {
+        if (this->next_is("!") && this->remaining() > 1) {
+            ++this->pos;
+            return !this->negation();
+        }
+
+        return this->primary();
+    }
+
+    bool conjunction() {
+        bool value = this->negation();
+
+        while (this->next_is("-a") && this->remaining() > 1) {
+            ++this->pos;
+            value = this->negation() && value;
+        }
+
+        return value;
+    }
+
+    bool expr() {
+        bool value = this->conjunction();
+
+        while (this->next_is("-o") && this->remaining() > 1) {
+            ++this->pos;
+            value = this->conjunction() || value;
+        }
+
+        return value;
+    }
+
+  public:
+    explicit TestExpression(std::span<const std::string_view> args)
+        : args(args) {}
+
+    // Returns the exit code of test
+    int evaluate() {
+        // No expression is false
+        if (this->args.empty())
+            return 1;
+
+        const bool value = this->expr();
+
+        if (this->remaining() > 0)
+            this->error(std::format("{}: unexpected argument",
+                                    this->args[this->pos]));
+
+        return this->failed ? 2 : !value;
+    }
+};
+
+int builtin_test(const SimpleCommand &test) {
+    std::span<const std::string_view> args{test.arguments};
+
+    if (test.program == "[") {
+        if (args.empty() || args.back() != "]") {
+            std::println(stderr, "[: missing `]'");
+            return 2;
+        }
+
+        args = args.first(args.size() - 1);
+    }
+
+    return TestExpression{args}.evaluate();
+}
+
+int builtin_true(const SimpleCommand &) { return 0; }
+
+// ------------------------------------
+// Registry
+// ------------------------------------
+
+// Adding a builtin only takes an entry here
+static constexpr Builtin builtins[] = {
+    {
+        .name = ":",
+        .run = [](Executor &, const SimpleCommand &cmd) {
+            return builtin_colon(cmd);
+        },
+        .traits = {.special = true, .pipeline_no_fork = true},
+    },
+    {
+        .name = "[",
+        .run = [](Executor &, const SimpleCommand &cmd) {
+            return builtin_test(cmd);
+        },
+        .traits = {.pipeline_no_fork = true},
+    },
+    {
+        .name = "bg",
+        .run = [](Executor &executor, const SimpleCommand &cmd) {
+            return builtin_bg(cmd, executor.jobs, Waiter(executor.shell));
+        },
+        .traits = {.job_table = true},
+    },
+    {
+        .name = "cd",
+        .run = [](Executor &, const SimpleCommand &cmd) {
+            return builtin_cd(cmd);
+        },
+        .traits = {},
+    },
+    {
+        .name = "echo",
+        .run = [](Executor &, const SimpleCommand &cmd) {
+            return builtin_echo(cmd);
+        },
+        .traits = {.pipeline_no_fork = true},
+    },
+    {
+        .name = "exec",
+        .run = [](Executor &executor, const SimpleCommand &cmd) {
+            return builtin_exec(cmd, executor.shell);
+        },
+        .traits = {.special = true, .forks_subshell = true},
+    },
+    {
+        .name = "exit",
+        .run = [](Executor &, const SimpleCommand &cmd) {
+            return builtin_exit(cmd);
+        },
+        .traits = {.special = true, .forks_subshell = true},
+    },
+    {
+        .name = "false",
+        .run = [](Executor &, const SimpleCommand &cmd) {
+            return builtin_false(cmd);
+        },
+        .traits = {.pipeline_no_fork = true},
+    },
+    {
+        .name = "fg",
+        .run = [](Executor &executor, const SimpleCommand &cmd) {
+            return builtin_fg(cmd, executor.jobs, Waiter(executor.shell));
+        },
+        .traits = {.job_table = true},
+    },
+    {
+        .name = "hash",
+        .run = [](Executor &executor, const SimpleCommand &cmd) {
+            return builtin_hash(cmd, executor.command_hash,
+                                executor.shell.vars);
+        },
+        .traits = {.forks_subshell = true},
+    },
+    {
+        .name = "jobs",
+        .run = [](Executor &executor, const SimpleCommand &cmd) {
+            return builtin_jobs(cmd, executor.jobs);
+        },
+        .traits = {.pipeline_no_fork = true, .job_table = true},
+    },
+    {
+        .name = "kill",
+        .run = [](Executor &executor, const SimpleCommand &cmd) {
+            return builtin_kill(cmd, executor.jobs);
+        },
+        .traits = {.job_table = true},
+    },
+    {
+        .name = "parallel",
+        .run = [](Executor &executor, const SimpleCommand &cmd) {
+            return builtin_parallel(cmd, executor);
+        },
+        .traits = {.job_table = true},
+    },
+    {
+        .name = "printf",
+        .run = [](Executor &, const SimpleCommand &cmd) {
+            return builtin_printf(cmd);
+        },
+        .traits = {.pipeline_no_fork = true},
+    },
+    {
+        .name = "pwd",
+        .run = [](Executor &, const SimpleCommand &cmd) {
+            return builtin_pwd(cmd);
+        },
+        .traits = {.pipeline_no_fork = true},
+    },
+    {
+        .name = "test",
+        .run = [](Executor &, const SimpleCommand &cmd) {
+            return builtin_test(cmd);
+        },
+        .traits = {.pipeline_no_fork = true},
+    },
+    {
+        .name = "true",
+        .run = [](Executor &, const SimpleCommand &cmd) {
+            return builtin_true(cmd);
+        },
+        .traits = {.pipeline_no_fork = true},
+    },
+};
+
+// FNV-1a, starting from a different basis for every seed
+static constexpr uint32_t name_hash(std::string_view name, uint32_t seed) {
+    uint32_t hash = 2166136261u ^ seed;
+
+    for (const char c : name) {
+        hash ^= static_cast<uint8_t>(c);
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+/**
+ * Slots of the builtins, indexed by the hash of their names. The seed is
+ * searched at compile time so that no two names share a slot.
+ */
+struct BuiltinTable {
+    static constexpr size_t size = 64;
+    static constexpr uint8_t empty = UINT8_MAX;
+
+    uint32_t seed = 0;
+    std::array<uint8_t, size> slots{};
+
+    static constexpr size_t slot(std::string_view name, uint32_t seed) {
+        return name_hash(name, seed) % size;
+    }
+
+    static consteval BuiltinTable build() {
+        static_assert(std::size(builtins) < size);
+
+        for (uint32_t seed = 0; seed < 1000; ++seed) {
+            BuiltinTable table{.seed = seed};
+            table.slots.fill(empty);
+
+            bool collision = false;
+            for (size_t i = 0; i < std::size(builtins) && !collision; ++i) {
+                auto &index = table.slots[slot(builtins[i].name, seed)];
+
+                collision = index != empty;
+                index = static_cast<uint8_t>(i);
+            }
+
+            if (!collision)
+                return table;
+        }
+
+        throw "no seed gives a perfect hash of the builtins";
+    }
+};
+
+static constexpr BuiltinTable builtin_table = BuiltinTable::build();
+
+const Builtin *find_builtin(std::string_view name) {
+    const uint8_t index =
+        builtin_table.slots[BuiltinTable::slot(name, builtin_table.seed)];
+
+    if (index == BuiltinTable::empty || builtins[index].name != name)
+        return nullptr;
+
+    return &builtins[index];
+}
@@ -1,24 +1,95 @@
 #ifndef TESTSH_BUILTIN_H
 #define TESTSH_BUILTIN_H
 
+#include "command_hash.h"
 #include "executor.h"
 #include "job.h"
 #include "shell.h"
 #include "syntax.h"
+#include <string_view>
 #include <vector>
 
-int builtin_bg(const SimpleCommand &bg, std::vector<Job> &jobs,
-               const Waiter &waiter);
+// ------------------------------------
+// Registry
+// ------------------------------------
+
+/**
+ * What the shell has to know about a builtin before running it.
+ */
+struct BuiltinTraits {
+    // POSIX special builtin (`:`, `exec`, `exit`). Only recorded: the shell
+    // does not apply the rules of the special builtins to their errors and
+    // prefix assignments
+    bool special = false;
+    // Can run inside a pipeline without forking a child
+    bool pipeline_no_fork = false;
+    // Reads or changes the jobs of the shell
+    bool job_table = false;
+    // Replaces or terminates the process, or changes a state of the shell
+    // that is not restored after a subshell run by the shell itself: a
+    // subshell running it is always forked
+    bool forks_subshell = false;
+};
+
+struct Builtin {
+    std::string_view name;
+    int (*run)(Executor &executor, const SimpleCommand &cmd);
+    BuiltinTraits traits;
+};
+
+/**
+ * Returns the builtin called `name`, or nullptr. The builtins are found
+ * with a perfect hash built at compile time: a single hash and a single
+ * comparison of the name.
+ */
+const Builtin *find_builtin(std::string_view name);
+
+// ------------------------------------
+// Builtins
+// ------------------------------------
+
+// `bg [%n]`, the current job without an argument
+int builtin_bg(const SimpleCommand &bg, JobTable &jobs, const Waiter &waiter);
 
 int builtin_cd(const SimpleCommand &cd);
 
+int builtin_colon(const SimpleCommand &colon);
+
+int builtin_echo(const SimpleCommand &echo);
+
 int builtin_exec(const SimpleCommand &exec, const Shell &shell);
 
 int builtin_exit(const SimpleCommand &exit);
 
-int builtin_fg(const SimpleCommand &fg, std::vector<Job> &jobs,
-               const Waiter &waiter);
+int builtin_false(const SimpleCommand &false_);
+
+// `fg [%n]`, the current job without an argument
+int builtin_fg(const SimpleCommand &fg, JobTable &jobs, const Waiter &waiter);
+
+int builtin_hash(const SimpleCommand &hash, CommandHash &commands,
+                 const ShellVars &vars);
+
+int builtin_jobs(const SimpleCommand &jobs, const JobTable &table);
+
+// `kill [-s name | -name | -n] pid | %n ...`
+int builtin_kill(const SimpleCommand &kill, const JobTable &jobs);
+
+/**
+ * `parallel [-j n] command [argument ...] [::: item ...]`: runs the command
+ * for every item, read one per line from the stdin without `:::`, with n
+ * of them at the same time, the online CPUs by default. Returns the number
+ * of commands that failed, up to 101, 128 + SIGTSTP if they were stopped,
+ * or 255 on a wrong usage.
+ */
+int builtin_parallel(const SimpleCommand &parallel, Executor &executor);
+
+int builtin_printf(const SimpleCommand &printf);
+
+int builtin_pwd(const SimpleCommand &pwd);
+
+// `test` and `[`
+int builtin_test(const SimpleCommand &test);
 
-int builtin_jobs(const SimpleCommand &jobs, const std::vector<Job> &bg_jobs);
+int builtin_true(const SimpleCommand &true_);
 
 #endif // TESTSH_BUILTIN_H
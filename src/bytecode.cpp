@@ -0,0 +1,193 @@
+#include "bytecode.h"
+#include "syntax.h"
+#include "util.h"
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <variant>
+#include <vector>
+
+void Bytecode::clear() {
+    this->code.clear();
+    this->tokens.clear();
+    this->redirects.clear();
+    this->assignments.clear();
+}
+
+// ------------------------------------
+// Lowering
+// ------------------------------------
+
+/**
+ * Walks the syntax tree once and emits its code. The jumps forward are
+ * emitted with a placeholder target and patched when the target is known.
+ */
+class Lowering {
+    const Ast &ast;
+    Bytecode &bytecode;
+
+    uint32_t here() const {
+        return static_cast<uint32_t>(this->bytecode.code.size());
+    }
+
+    uint32_t emit(OpCode op, uint32_t a = 0, uint32_t b = 0) {
+        const uint32_t at = this->here();
+        this->bytecode.code.push_back(Instr{.op = op, .a = a, .b = b});
+        return at;
+    }
+
+    // Makes the instruction at `at` jump to the next instruction emitted
+    void patch(uint32_t at) { this->bytecode.code[at].a = this->here(); }
+
+    uint32_t token(const Token &token) {
+        const auto index = static_cast<uint32_t>(this->bytecode.tokens.size());
+        this->bytecode.tokens.push_back(token);
+        return index;
+    }
+
+    template <typename T>
+    void emit_range(OpCode op, std::vector<T> &pool,
+                    std::span<const T> nodes) {
+        if (nodes.empty())
+            return;
+
+        const auto begin = static_cast<uint32_t>(pool.size());
+        pool.append_range(nodes);
+        this->emit(op, begin, static_cast<uint32_t>(nodes.size()));
+    }
+
+  public:
+    Lowering(const Ast &ast, Bytecode &bytecode)
+        : ast(ast), bytecode(bytecode) {}
+
+    void word(const Word &word) {
+        std::visit(overloads{
+                       [&](const Token &token) {
+                           this->emit(OpCode::token, this->token(token));
+                       },
+                       [&](const Substitution &sub) {
+                           std::visit(
+                               overloads{
+                                   [&](const VarSub &var) {
+                                       this->emit(OpCode::varsub,
+                                                  this->token(var.token));
+                                   },
+                                   [&](const CmdSub &cmd) {
+                                       const auto at =
+                                           this->emit(OpCode::cmdsub);
+                                       this->list(cmd.seq_list);
+                                       this->emit(OpCode::exit);
+                                       this->patch(at);
+                                   },
+                               },
+                               sub);
+                       },
+                   },
+                   word);
+    }
+
+    // The pipe is created after the words are expanded, right before the
+    // command is spawned
+    void command(const Command &command, bool piped) {
+        std::visit(
+            overloads{
+                [&](const UnsubCommand &cmd) {
+                    this->word(cmd.program);
+                    for (const auto &arg : this->ast[cmd.arguments])
+                        this->word(arg);
+
+                    this->emit_range(OpCode::assign, this->bytecode.assignments,
+                                     this->ast[cmd.envs]);
+                    this->emit_range(OpCode::redirect, this->bytecode.redirects,
+                                     this->ast[cmd.redirections]);
+                    if (piped)
+                        this->emit(OpCode::pipe);
+                    this->emit(OpCode::command);
+                },
+                [&](const SimpleAssignment &assign) {
+                    this->emit_range(OpCode::assign, this->bytecode.assignments,
+                                     this->ast[assign.envs]);
+                    this->emit_range(OpCode::redirect, this->bytecode.redirects,
+                                     this->ast[assign.redirections]);
+                    if (piped)
+                        this->emit(OpCode::pipe);
+                    this->emit(OpCode::assignment);
+                },
+                [&](const Subshell &subshell) {
+                    this->emit_range(OpCode::redirect, this->bytecode.redirects,
+                                     this->ast[subshell.redirections]);
+                    if (piped)
+                        this->emit(OpCode::pipe);
+                    const auto at = this->emit(OpCode::subshell);
+                    this->list(subshell.seq_list);
+                    this->emit(OpCode::exit);
+                    this->patch(at);
+                },
+            },
+            command);
+    }
+
+    void pipeline(const Pipeline &pipeline) {
+        const auto cmds = this->ast[pipeline.cmds];
+        assertm(!cmds.empty(), "A pipeline must always contain something");
+
+        this->emit(OpCode::pipeline, pipeline.negated);
+        for (size_t i = 0; i < cmds.size(); ++i)
+            this->command(cmds[i], i + 1 < cmds.size());
+        this->emit(OpCode::wait);
+    }
+
+    void op_list(const OpList &op_list) {
+        const auto items = this->ast[op_list.items];
+        assertm(!items.empty(), "An and_or must always contain something");
+
+        // JOB CONTROL: the pipelines after one terminated with a SIGINT
+        // are not executed
+        std::vector<uint32_t> interrupted{};
+
+        for (size_t i = 0; i < items.size(); ++i) {
+            const auto &item = items[i];
+            std::optional<uint32_t> skip{};
+
+            // Skip the pipeline if the previous ones terminated with an
+            // error (`&&`) or with a success (`||`)
+            if (item.op == AndOrOp::and_if)
+                skip = this->emit(OpCode::jump_if_failure);
+            if (item.op == AndOrOp::or_if)
+                skip = this->emit(OpCode::jump_if_success);
+
+            this->pipeline(item.pipeline);
+
+            if (i + 1 < items.size())
+                interrupted.push_back(
+                    this->emit(OpCode::jump_if_interrupted));
+
+            if (skip.has_value())
+                this->patch(*skip);
+        }
+
+        for (const auto at : interrupted)
+            this->patch(at);
+    }
+
+    void list(const List &list) {
+        for (const auto &item : this->ast[list.items]) {
+            if (item.op == ListOp::sequential) {
+                this->op_list(item.op_list);
+                continue;
+            }
+
+            const auto at = this->emit(OpCode::async);
+            this->op_list(item.op_list);
+            this->emit(OpCode::exit, 1);
+            this->patch(at);
+        }
+    }
+};
+
+void lower(const ThisProgram &program, const Ast &ast, Bytecode &bytecode) {
+    Lowering lowering{ast, bytecode};
+
+    for (const auto &complete_command : ast[program.child])
+        lowering.list(complete_command);
+}
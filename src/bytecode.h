@@ -0,0 +1,139 @@
+#ifndef TESTSH_BYTECODE_H
+#define TESTSH_BYTECODE_H
+
+#include "syntax.h"
+#include "tokenizer.h"
+#include "util.h"
+#include <cstddef>
+#include <cstdint>
+#include <format>
+#include <string_view>
+#include <vector>
+
+/**
+ * Instructions of the bytecode run by the Executor.
+ *
+ * The interpreter keeps a few registers: the status of the last pipeline,
+ * the command being built (its words, assignments and redirections) and the
+ * pipeline being spawned. The code of a subshell, of a command substitution
+ * and of an async list is inlined after the instruction that forks it: the
+ * child runs it up to its `exit`, the parent jumps over it.
+ */
+enum class OpCode : uint8_t {
+    // Starts a pipeline. a: 1 if the pipeline is negated
+    pipeline,
+    // Pipes the stdout of the next command to the stdin of the following one
+    pipe,
+    // Adds a word to the command. a: index of the token
+    token,
+    // Adds the value of a variable to the command. a: index of the token
+    varsub,
+    // Adds the output of the code that follows to the command.
+    // a: end of the code
+    cmdsub,
+    // Adds assignments to the command. a, b: first and number of assignments
+    assign,
+    // Adds redirections to the command. a, b: first and number of redirects
+    redirect,
+    // Spawns the command that was built
+    command,
+    // Runs the assignments of a command without words
+    assignment,
+    // Spawns a subshell running the code that follows. a: end of the code
+    subshell,
+    // Runs the code that follows in the background. a: end of the code
+    async,
+    // Terminates a child with the status. a: 1 if the background jobs are
+    // waited first
+    exit,
+    // Waits for the pipeline and sets the status
+    wait,
+    // Jumps to a if the status is a failure
+    jump_if_failure,
+    // Jumps to a if the status is a success
+    jump_if_success,
+    // Jumps to a if the last pipeline was terminated by SIGINT
+    jump_if_interrupted,
+};
+
+struct Instr {
+    OpCode op;
+    uint32_t a = 0;
+    uint32_t b = 0;
+};
+
+static_assert(sizeof(Instr) <= 12);
+
+/**
+ * Linear code of a program. The operands that do not fit in an instruction
+ * are copied in the tables, so the code does not refer to the Ast and can
+ * be run many times after the Ast is cleared. The tokens and the filenames
+ * still refer to the input.
+ */
+struct Bytecode {
+    std::vector<Instr> code;
+    std::vector<Token> tokens;
+    std::vector<Redirect> redirects;
+    std::vector<AssignmentWord> assignments;
+
+    size_t size() const { return this->code.size(); }
+
+    void clear();
+};
+
+/**
+ * Appends the code of `program` to `bytecode`.
+ */
+void lower(const ThisProgram &program, const Ast &ast, Bytecode &bytecode);
+
+// ------------------------------------
+// FORMATTER
+// ------------------------------------
+
+constexpr std::string_view to_string(const OpCode op) {
+    switch (op) {
+    case OpCode::pipeline:
+        return "pipeline";
+    case OpCode::pipe:
+        return "pipe";
+    case OpCode::token:
+        return "token";
+    case OpCode::varsub:
+        return "varsub";
+    case OpCode::cmdsub:
+        return "cmdsub";
+    case OpCode::assign:
+        return "assign";
+    case OpCode::redirect:
+        return "redirect";
+    case OpCode::command:
+        return "command";
+    case OpCode::assignment:
+        return "assignment";
+    case OpCode::subshell:
+        return "subshell";
+    case OpCode::async:
+        return "async";
+    case OpCode::exit:
+        return "exit";
+    case OpCode::wait:
+        return "wait";
+    case OpCode::jump_if_failure:
+        return "jump_if_failure";
+    case OpCode::jump_if_success:
+        return "jump_if_success";
+    case OpCode::jump_if_interrupted:
+        return "jump_if_interrupted";
+    }
+
+    std::unreachable();
+}
+
+template <typename CharT> struct std::formatter<Instr, CharT> : debug_spec {
+    auto format(const Instr &instr, auto &ctx) const {
+        return std::format_to(ctx.out(), "{} {} {}", to_string(instr.op),
+                              instr.a, instr.b);
+    }
+};
+
+#endif // TESTSH_BYTECODE_H
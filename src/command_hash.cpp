@@ -0,0 +1,100 @@
+#include "command_hash.h"
+#include <fcntl.h>
+#include <optional>
+#include <string_view>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Used by execvpe() when the PATH is not set
+static constexpr std::string_view default_path = "/bin:/usr/bin";
+
+CommandHash::~CommandHash() { this->clear(); }
+
+int CommandHash::dir_fd(Dir &dir) {
+    if (!dir.fd)
+        dir.fd = open(dir.path.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+
+    return *dir.fd;
+}
+
+void CommandHash::clear() {
+    for (const auto &dir : this->dirs) {
+        if (dir.fd && *dir.fd != -1)
+            close(*dir.fd);
+    }
+
+    this->dirs.clear();
+    this->entries.clear();
+    this->path_generation.reset();
+}
+
+void CommandHash::reset(const ShellVars &vars) {
+    this->clear();
+
+    std::string_view path = vars.get("PATH").value_or(default_path);
+
+    for (;;) {
+        const auto colon = path.find(':');
+        this->dirs.push_back(Dir{.path = std::string{path.substr(0, colon)}});
+
+        if (colon == std::string_view::npos)
+            break;
+
+        path.remove_prefix(colon + 1);
+    }
+
+    this->path_generation = vars.path_generation();
+}
+
+std::optional<Program> CommandHash::find(std::string_view name,
+                                         const ShellVars &vars) {
+    if (name.empty() || name.contains('/'))
+        return std::nullopt;
+
+    if (this->path_generation != vars.path_generation())
+        this->reset(vars);
+
+    if (const auto it = this->entries.find(name); it != this->entries.end()) {
+        ++this->hits_;
+        ++it->second.hits;
+
+        return Program{
+            .path = it->second.path.c_str(),
+            .dir_fd = it->second.dir_fd,
+        };
+    }
+
+    ++this->misses_;
+
+    const std::string file{name};
+
+    for (auto &dir : this->dirs) {
+        if (!dir.path.starts_with('/'))
+            break;
+
+        const int fd = this->dir_fd(dir);
+        if (fd == -1)
+            continue;
+
+        struct stat st;
+        if (fstatat(fd, file.c_str(), &st, 0) == -1 || !S_ISREG(st.st_mode))
+            continue;
+        if (faccessat(fd, file.c_str(), X_OK, AT_EACCESS) == -1)
+            continue;
+
+        const auto separator = dir.path.ends_with('/') ? "" : "/";
+        const auto [it, _] = this->entries.emplace(
+            file, Entry{
+                      .path = dir.path + separator + file,
+                      .dir_fd = fd,
+                      .hits = 0,
+                  });
+
+        return Program{
+            .path = it->second.path.c_str(),
+            .dir_fd = it->second.dir_fd,
+        };
+    }
+
+    return std::nullopt;
+}
@@ -0,0 +1,85 @@
+#ifndef TESTSH_COMMAND_HASH_H
+#define TESTSH_COMMAND_HASH_H
+
+#include "shell.h"
+#include "spawn.h"
+#include "util.h"
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Programs already found in the PATH, by name.
+ *
+ * The directories of the PATH are opened with O_PATH the first time they
+ * are searched and kept open, a program is executed relative to its
+ * directory (see Program). The table is emptied when the PATH is upserted
+ * in the ShellVars, and by `hash -r`.
+ *
+ * Only the names without a slash are hashed, and only the directories
+ * before the first relative one in the PATH are searched: the programs
+ * found after it depend on the current directory.
+ */
+class CommandHash {
+    struct Dir {
+        std::string path;
+        // nullopt until the directory is searched, -1 if it cannot be opened
+        std::optional<int> fd;
+    };
+
+    struct Entry {
+        // Full path of the program
+        std::string path;
+        int dir_fd;
+        size_t hits;
+    };
+
+    // Projects for the names of the entries
+    struct NameP {
+        std::string_view operator()(const std::string &name) const {
+            return name;
+        }
+        std::string_view operator()(std::string_view name) const {
+            return name;
+        }
+    };
+
+    std::vector<Dir> dirs;
+    std::unordered_map<std::string, Entry, ProjHash<NameP>, ProjEq<NameP>>
+        entries;
+    // PATH generation the table was filled with
+    std::optional<uint64_t> path_generation;
+    size_t hits_ = 0;
+    size_t misses_ = 0;
+
+    int dir_fd(Dir &dir);
+    void reset(const ShellVars &vars);
+
+  public:
+    CommandHash() = default;
+    CommandHash(const CommandHash &) = delete;
+    CommandHash &operator=(const CommandHash &) = delete;
+    ~CommandHash();
+
+    /**
+     * Returns where `name` is executed from, searching the PATH if it was
+     * not hashed yet. Returns nullopt if the program is not hashable or
+     * cannot be found: it is left to exec to search it.
+     */
+    std::optional<Program> find(std::string_view name, const ShellVars &vars);
+
+    /**
+     * Empties the table, the counters are kept.
+     */
+    void clear();
+
+    const auto &table() const { return this->entries; }
+    size_t hits() const { return this->hits_; }
+    size_t misses() const { return this->misses_; }
+};
+
+#endif // TESTSH_COMMAND_HASH_H
@@ -1,95 +1,120 @@
 #include "exec_prog.h"
+#include "reactor.h"
+#include "stats.h"
+#include <algorithm>
+#include <cassert>
 #include <cstddef>
-#include <memory>
-#include <ranges>
+#include <string_view>
 #include <unistd.h>
-#include <unordered_set>
 
-namespace vw = std::ranges::views;
-
-// TODO: take ownership of cmd (?)
-void Exec::init_args(const SimpleCommand &cmd) {
-    const auto &args = cmd.arguments;
-
-    // +1 from program
-    // +1 from NULL terminator
-    this->args_size = args.size() + 2;
-
-    this->args_array = std::make_unique<char_array_t>(this->args_size);
-
-    this->args_owner.reserve(args.size() + 2);
-
-    // Push program first
-    this->args_owner.emplace_back(cmd.program);
-    this->args_array[0] = this->args_owner[0].c_str();
-
-    for (size_t i{}; i < args.size(); ++i) {
-        auto &s = this->args_owner.emplace_back(args[i]);
-        this->args_array[i + 1] = s.c_str();
-    }
+static std::string_view env_name(std::string_view env) {
+    return env.substr(0, env.find('='));
+}
 
-    // The args array needs to be null-terminated
-    this->args_array[this->args_size - 1] = nullptr;
+// Whether one of the assignments of the command from `from` sets `name`
+static bool assigned(const SimpleCommand &cmd, size_t from,
+                     std::string_view name) {
+    return std::ranges::any_of(
+        cmd.envs.begin() + from, cmd.envs.end(),
+        [&](std::string_view env) { return env_name(env) == name; });
 }
 
-void Exec::init_envp(const SimpleCommand &cmd, const Shell &shell) {
-    std::unordered_set<std::string_view> cmd_env_names{};
-    for (const auto &env : cmd.envs) {
-        cmd_env_names.insert(env.key);
+void Exec::apply_overlay(const SimpleCommand &cmd, const ShellVars &vars) {
+    char *const *environment = vars.environment();
+    const size_t size = vars.environment_size();
+
+    if (this->overlay_generation != vars.generation()) {
+        this->overlay.assign(environment, environment + size);
+        this->overlay_generation = vars.generation();
+        ++stats().environment_copies;
+    } else {
+        // Undo the assignments of the previous command
+        for (const size_t slot : this->patched)
+            this->overlay[slot] = environment[slot];
+        this->overlay.resize(size);
     }
 
-    /* Add external envs from the shell that are not present in the current
-     * command.
-     */
-    for (const auto &env : shell.vars) {
-        if (!env.attr.external)
-            continue;
+    this->patched.clear();
 
-        if (cmd_env_names.contains(env.name()))
-            continue;
-
-        this->envp_owner.emplace_back(env.str);
-    }
-
-    /* Now add envs from the current command. If names are duplicated, the last
-     * value has to be passed down to the child. Add them in reverse order and
-     * check if they are still in the set, remove it from the set after you the
-     * env once, subsequent vars will be ignored.
+    /* If names are duplicated, the last value has to be passed down to the
+     * child. The assignments of a command are few, they are searched
+     * linearly.
      */
-    for (const auto &cmd_env : cmd.envs | vw::reverse) {
-        if (!cmd_env_names.contains(cmd_env.key))
+    for (size_t i = cmd.envs.size(); i-- > 0;) {
+        const auto name = env_name(cmd.envs[i]);
+        if (assigned(cmd, i + 1, name))
             continue;
 
-        cmd_env_names.erase(cmd_env.key);
-        this->envp_owner.emplace_back(cmd_env.whole.text());
+        char *str = this->strings.data() + this->strings.size();
+        this->strings.insert(this->strings.end(), cmd.envs[i].begin(),
+                             cmd.envs[i].end());
+        this->strings.push_back('\0');
+
+        if (const auto slot = vars.environment_slot(name)) {
+            this->overlay[*slot] = str;
+            this->patched.push_back(*slot);
+        } else {
+            this->overlay.push_back(str);
+        }
     }
 
-    // +1 for NULL terminator
-    this->envp_size = this->envp_owner.size() + 1;
-
-    this->envp_array = std::make_unique<char_array_t>(this->envp_size);
+    this->overlay.push_back(nullptr);
+    this->envp_array = this->overlay.data();
+}
 
-    for (size_t i = 0; i < this->envp_owner.size(); i++) {
-        this->envp_array[i] = this->envp_owner[i].c_str();
+void Exec::build(const SimpleCommand &cmd, const Shell &shell) {
+    // The size of the strings is known before they are copied: the buffer
+    // is never reallocated and the pointers can be taken while copying.
+    size_t size = cmd.program.size() + 1;
+
+    for (const auto arg : cmd.arguments)
+        size += arg.size() + 1;
+    for (const auto env : cmd.envs)
+        size += env.size() + 1;
+
+    this->strings.clear();
+    this->strings.reserve(size);
+    this->args.clear();
+    this->args.reserve(cmd.arguments.size() + 2);
+
+    const auto push = [&](std::string_view str) {
+        this->args.push_back(this->strings.data() + this->strings.size());
+        this->strings.insert(this->strings.end(), str.begin(), str.end());
+        this->strings.push_back('\0');
+    };
+
+    push(cmd.program);
+    for (const auto arg : cmd.arguments)
+        push(arg);
+    this->args.push_back(nullptr);
+
+    if (cmd.envs.empty()) {
+        this->envp_array = shell.vars.environment();
+        return;
     }
 
-    this->envp_array[this->envp_size - 1] = nullptr;
+    this->apply_overlay(cmd, shell.vars);
 }
 
-Exec::Exec(const SimpleCommand &cmd, const Shell &shell)
-    : args_owner(), args_array(), args_size(), envp_owner(), envp_array(),
-      envp_size() {
-    init_args(cmd);
-    init_envp(cmd, shell);
+Exec::Exec(const SimpleCommand &cmd, const Shell &shell) {
+    this->build(cmd, shell);
 }
 
 int Exec::exec() const {
-    char *const *envp = (char *const *)this->envp_array.get();
-    char *const *argv = (char *const *)this->args_array.get();
+    char *const *envp = this->envp();
+    char *const *argv = this->argv();
 
     assert(argv != nullptr);
     assert(argv[0] != nullptr);
     assert(envp != nullptr);
 
-    return execvpe(argv[0], argv, envp);
+    // The exec keeps the blocked signals
+    block_sigchld(false);
+
+    const int retval = execvpe(argv[0], argv, envp);
+
+    // The exec failed, the shell goes on
+    block_sigchld(true);
+
+    return retval;
 }
@@ -3,29 +3,54 @@
 
 #include "shell.h"
 #include "syntax.h"
-#include <memory>
-#include <string>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
 #include <vector>
 
+/**
+ * Image of a program to exec: its argv and envp, laid out by the parent
+ * before the child is created, so that the child only has to make
+ * syscalls.
+ *
+ * The strings of the arguments and of the prefix assignments are stored
+ * back to back in a single buffer. The environment is the one kept built
+ * by ShellVars: a command without assignments uses it as it is, the
+ * assignments of the others are applied to a copy of it, which is reused
+ * by the next commands as long as the environment does not change.
+ */
 class Exec {
-    typedef const char *char_array_t[];
+    std::vector<char> strings;
+    // argv, nullptr
+    std::vector<char *> args;
+    char *const *envp_array = nullptr;
 
-    std::vector<std::string> args_owner;
-    std::unique_ptr<char_array_t> args_array;
-    std::size_t args_size;
+    // Environment of the shell with the assignments of the last command
+    std::vector<char *> overlay;
+    // Generation of the environment copied in `overlay`
+    std::optional<uint64_t> overlay_generation;
+    // Slots of `overlay` replaced by the assignments of the last command
+    std::vector<size_t> patched;
 
-    std::vector<std::string> envp_owner;
-    std::unique_ptr<char_array_t> envp_array;
-    std::size_t envp_size;
-
-    void init_args(const SimpleCommand &cmd);
-
-    void init_envp(const SimpleCommand &cmd, const Shell &shell);
+    void apply_overlay(const SimpleCommand &cmd, const ShellVars &vars);
 
   public:
+    Exec() = default;
+
     explicit Exec(const SimpleCommand &cmd, const Shell &shell);
 
+    /**
+     * Lays out the image of `cmd`, the storage of the previous image is
+     * reused. The environment refers to the one of `shell`, which must not
+     * change until the program is spawned.
+     */
+    void build(const SimpleCommand &cmd, const Shell &shell);
+
     int exec() const;
+
+    char *const *argv() const { return this->args.data(); }
+
+    char *const *envp() const { return this->envp_array; }
 };
 
 #endif // TESTSH_EXEC_PROG_H
@@ -1,24 +1,39 @@
 #include "executor.h"
 #include "builtin.h"
+#include "bytecode.h"
 #include "exec_prog.h"
 #include "job.h"
+#include "parallel_lexer.h"
+#include "parser.h"
+#include "reactor.h"
+#include "spawn.h"
+#include "stats.h"
 #include "syntax.h"
 #include "util.h"
 #include <algorithm>
 #include <cerrno>
+#include <charconv>
 #include <cpptrace/cpptrace.hpp>
 #include <csignal>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <fcntl.h>
+#include <fstream>
 #include <functional>
 #include <iostream>
+#include <limits>
 #include <memory>
+#include <optional>
+#include <poll.h>
 #include <print>
 #include <ranges>
-#include <stdexcept>
+#include <span>
+#include <stdio_ext.h>
 #include <string>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
 #include <unistd.h>
 #include <utility>
@@ -27,6 +42,58 @@
 
 namespace vw = std::ranges::views;
 
+// Bytes of a script lexed and parsed at a time, some for every lexer thread
+static size_t script_chunk_size() { return lex_threads() * (size_t{1} << 20); }
+
+/**
+ * Reads TESTSH_DEBUG: when set, the syntax tree and the bytecode of every
+ * command are printed on stderr before it runs.
+ */
+static bool debug_dumps() {
+    static const bool enabled = std::getenv("TESTSH_DEBUG") != nullptr;
+    return enabled;
+}
+
+bool virtual_subshells_from_env() {
+    static const bool enabled = [] {
+        const char *env = std::getenv("TESTSH_SUBSHELL");
+        if (env == nullptr)
+            return true;
+
+        const std::string_view mode{env};
+        if (mode == "virtual")
+            return true;
+        if (mode == "fork")
+            return false;
+
+        std::println(stderr,
+                     "testsh: unknown TESTSH_SUBSHELL={}, using virtual", mode);
+        return true;
+    }();
+
+    return enabled;
+}
+
+bool splice_relay_from_env() {
+    static const bool enabled = [] {
+        const char *env = std::getenv("TESTSH_RELAY");
+        if (env == nullptr)
+            return false;
+
+        const std::string_view mode{env};
+        if (mode == "splice")
+            return true;
+        if (mode == "exec")
+            return false;
+
+        std::println(stderr, "testsh: unknown TESTSH_RELAY={}, using exec",
+                     mode);
+        return false;
+    }();
+
+    return enabled;
+}
+
 static bool fd_is_valid(int fd) {
     return fcntl(fd, F_GETFD) != -1 || errno != EBADF;
 }
@@ -37,16 +104,21 @@ static bool fd_is_valid(int fd) {
  *
  */
 class RedirectController {
-    // tuple<to_replace, replacer>
-    std::vector<std::tuple<int, int>> file_redirects;
-    // tuple<to_replace, replacer>
-    std::vector<std::tuple<int, int>> duplications;
+    // tuple<to_replace, replacer> in the order of the command line, a
+    // replacer of -1 closes the fd
+    std::vector<std::tuple<int, int>> redirects;
+    // The ends of the pipes and the files opened for the child
+    std::vector<int> opened;
+    // The other ends of the pipes, closed by a child running code of the
+    // shell. The exec of a program closes them, they are O_CLOEXEC
     std::vector<int> fd_to_close;
 
   public:
     RedirectController(const CommandState &state)
-        : file_redirects(state.redirects), duplications(),
-          fd_to_close(state.fd_to_close) {}
+        : redirects(state.redirects), opened(), fd_to_close(state.fd_to_close) {
+        for (const auto [_, replacer] : state.redirects)
+            this->opened.push_back(replacer);
+    }
 
     RedirectController(const RedirectController &f) = delete;
     RedirectController(RedirectController &&f) = delete;
@@ -54,16 +126,16 @@ class RedirectController {
     RedirectController &operator=(RedirectController &&f) = delete;
 
     ~RedirectController() {
-        // When the object is destructed only close the fds that are originated
-        // from a file. The duplications<> must not be touched by the parent,
+        // When the object is destructed only close the fds that were opened
+        // for the child. The duplications must not be touched by the parent,
         // redirections are only need for the child. For this reason
         // the duplicatoion fds on the parent must remain intact.
-        for (const auto [_, replacer] : this->file_redirects) {
-            close(replacer);
+        for (const auto fd : this->opened) {
+            close(fd);
         }
     }
 
-    bool add_redirects(const std::vector<Redirect> &redirections) {
+    bool add_redirects(std::span<const Redirect> redirections) {
         for (const auto &redirect : redirections) {
             bool success = std::visit(
                 overloads{
@@ -91,7 +163,8 @@ class RedirectController {
                         std::string tmp_filename{file_r.filename};
                         mode_t mode =
                             S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH;
-                        int open_fd = open(tmp_filename.c_str(), flags, mode);
+                        int open_fd = open(tmp_filename.c_str(),
+                                           flags | O_CLOEXEC, mode);
 
                         if (open_fd == -1) {
                             std::println(stderr, "open: {}",
@@ -99,8 +172,9 @@ class RedirectController {
                             return false;
                         }
 
-                        this->file_redirects.emplace_back(file_r.redirect_fd,
-                                                          open_fd);
+                        this->redirects.emplace_back(file_r.redirect_fd,
+                                                     open_fd);
+                        this->opened.push_back(open_fd);
                         return true;
                     },
                     [&](const FdRedirect &dup_fd) {
@@ -113,12 +187,12 @@ class RedirectController {
                             return false;
                         }
 
-                        this->duplications.emplace_back(dup_fd.fd_to_replace,
-                                                        dup_fd.fd_replacer);
+                        this->redirects.emplace_back(dup_fd.fd_to_replace,
+                                                     dup_fd.fd_replacer);
                         return true;
                     },
                     [&](const CloseFd &close_fd) {
-                        this->fd_to_close.emplace_back(close_fd.fd);
+                        this->redirects.emplace_back(close_fd.fd, -1);
                         return true;
                     },
                 },
@@ -131,58 +205,162 @@ class RedirectController {
         return true;
     }
 
+    // The syscalls a child makes for its fds
+    RedirectPlan plan() const { return plan_redirections(this->redirects); }
+
+    /**
+     * Applies the redirections in a child that runs code of the shell. The
+     * fds opened for it are closed once duplicated: a copy of the end of a
+     * pipe left open would delay the end of file of the reader.
+     */
     bool apply_redirections() const {
-        // close fds: leftover from the pipe() calls
+        // close fds: the other ends of the pipes
         for (const auto to_close : this->fd_to_close) {
             close(to_close);
         }
 
-        // Duplicate fds from files
-        for (const auto [to_replace, replacer] : this->file_redirects) {
-            const int retval = dup2(replacer, to_replace);
-            if (retval == -1) {
-                std::println(stderr, "dup2: {}", std::strerror(errno));
-                return false;
-            }
+        const RedirectPlan plan = this->plan();
+        if (!apply_plan(plan.dups, plan.closes)) {
+            std::println(stderr, "dup2: {}", std::strerror(errno));
+            return false;
+        }
+
+        for (const auto fd : this->opened) {
+            const bool replaced = std::ranges::any_of(
+                this->redirects,
+                [&](const auto &r) { return std::get<0>(r) == fd; });
 
-            // close(replacer);
+            if (!replaced)
+                close(fd);
         }
 
-        // Duplicate fds from duplication syntax
-        for (const auto [to_replace, replacer] : this->duplications) {
-            const int retval = dup2(replacer, to_replace);
-            if (retval == -1) {
+        return true;
+    }
+
+    // tuple<to_replace, replacer> in order, a replacer of -1 closes the fd
+    std::span<const std::tuple<int, int>> in_order() const {
+        return this->redirects;
+    }
+
+    /**
+     * The command of `state` runs in the shell instead of a child: the end
+     * of the pipe it would write to is replaced by `output`, and the shell
+     * keeps open the end of the pipe read by the next command. The caller
+     * still owns the end of the pipe, which is the last redirect of a
+     * command inside a pipeline.
+     */
+    void capture_pipe(const CommandState &state, int output) {
+        const int writer = std::get<1>(state.redirects.back());
+
+        std::ranges::replace(this->opened, writer, output);
+
+        for (auto &[_, replacer] : this->redirects) {
+            if (replacer == writer)
+                replacer = output;
+        }
+
+        this->fd_to_close.clear();
+    }
+};
+
+/**
+ * Applies the redirections of a builtin run by the shell itself. The fds
+ * they replace are saved first and put back when the object is destructed.
+ */
+class ScopedRedirections {
+    // tuple<fd, saved copy>, the copy is -1 if the fd was not open
+    std::vector<std::tuple<int, int>> saved;
+    bool applied = true;
+
+    void save(int fd) {
+        for (const auto [saved_fd, _] : this->saved) {
+            if (saved_fd == fd)
+                return;
+        }
+
+        this->saved.emplace_back(fd, fcntl(fd, F_DUPFD_CLOEXEC, 10));
+    }
+
+  public:
+    explicit ScopedRedirections(const RedirectController &redirect) {
+        // What the shell has buffered goes to the old fds
+        std::fflush(stdout);
+
+        for (const auto [to_replace, replacer] : redirect.in_order()) {
+            this->save(to_replace);
+
+            if (replacer == -1) {
+                close(to_replace);
+                continue;
+            }
+
+            if (dup2(replacer, to_replace) == -1) {
                 std::println(stderr, "dup2: {}", std::strerror(errno));
-                return false;
+                this->applied = false;
+                return;
             }
         }
+    }
 
-        return true;
+    ScopedRedirections(const ScopedRedirections &) = delete;
+    ScopedRedirections &operator=(const ScopedRedirections &) = delete;
+
+    ~ScopedRedirections() {
+        std::fflush(stdout);
+
+        for (const auto [fd, copy] : this->saved | vw::reverse) {
+            if (copy == -1) {
+                close(fd);
+                continue;
+            }
+
+            dup2(copy, fd);
+            close(copy);
+        }
     }
+
+    bool ok() const { return this->applied; }
 };
 
-// ------------------------------------
-// Waiter
-// ------------------------------------
+/**
+ * Saves the state of the shell that a subshell run by the shell itself can
+ * change: the variables and the working directory. They are put back when
+ * the object is destructed. The fds are restored by the
+ * ScopedRedirections of the subshell and of its commands.
+ */
+class ShellSnapshot {
+    ShellVars &vars;
+    size_t checkpoint;
+    int cwd;
+
+  public:
+    explicit ShellSnapshot(ShellVars &vars)
+        : vars(vars), checkpoint(vars.checkpoint()),
+          cwd(open(".", O_PATH | O_DIRECTORY | O_CLOEXEC)) {}
 
-void Waiter::process_wstatus(Job &job, pid_t pid, int wstatus) {
-    assertm(pid != 0,
-            "A pid=0 likely means a return from waitpid(...,WNOHANG) no "
-            "signal was received from any child");
+    ShellSnapshot(const ShellSnapshot &) = delete;
+    ShellSnapshot &operator=(const ShellSnapshot &) = delete;
 
-    pid_t pgid = job.pgid;
+    ~ShellSnapshot() {
+        if (this->cwd != -1) {
+            if (fchdir(this->cwd) == -1)
+                std::println(stderr, "fchdir: {}", std::strerror(errno));
 
-    if (pid == -1) {
-        throw std::runtime_error(std::format("wait_job: waitpid({}): {}", -pgid,
-                                             std::strerror(errno)));
-    }
+            close(this->cwd);
+        }
 
-    if (!job.jobs.contains(pid)) {
-        throw std::runtime_error(
-            std::format("pid={} is not part of pgid={}", pid, pgid));
+        this->vars.rollback(this->checkpoint);
     }
 
-    auto &stats = job.jobs.at(pid);
+    bool ok() const { return this->cwd != -1; }
+};
+
+// ------------------------------------
+// Waiter
+// ------------------------------------
+
+void Waiter::process_wstatus(ExecStats &stats, int wstatus) {
+    const pid_t pid = stats.child_pid;
 
     if (WIFSTOPPED(wstatus)) {
         stats.stopped = true;
@@ -205,47 +383,51 @@ void Waiter::process_wstatus(Job &job, pid_t pid, int wstatus) {
 }
 
 Job Waiter::wait_job(Job &&job) {
-    // TODO: this pgid, when executing in non-interctive shell, should be
-    // equal for all the jobs
-    pid_t pgid = job.pgid;
-
-    assertm((pgid != 0) || (pgid == 0 && job.completed()),
+    assertm((job.pgid != 0) || (job.pgid == 0 && job.completed()),
             "A job with a pgid unitialized must be completed.");
 
-    while (!job.completed() && !job.stopped()) {
-        int wstatus;
-        const pid_t pid = waitpid(-pgid, &wstatus, WUNTRACED);
+    for (;;) {
+        update_status(job);
+
+        if (job.completed() || job.stopped())
+            break;
 
-        process_wstatus(job, pid, wstatus);
+        reactor().poll(-1);
     }
 
     return job;
 }
 
 void Waiter::update_status(Job &job) {
-    // TODO: this pgid, when executing in non-interctive shell, should
-    // be equal for all the jobs
-    pid_t pgid = job.pgid;
+    // The statuses were collected by the reactor, maybe while another job
+    // was waited
+    for (auto &stats : job.processes) {
+        if (stats.completed)
+            continue;
 
-    assertm((pgid != 0) || (pgid == 0 && job.completed()),
-            "A job with a pgid unitialized must be completed.");
+        while (const auto wstatus = reactor().take(stats.child_pid))
+            process_wstatus(stats, *wstatus);
+    }
+}
 
-    for (;;) {
-        int wstatus;
-        const pid_t pid = waitpid(-pgid, &wstatus, WUNTRACED | WNOHANG);
+std::vector<JobId> Waiter::update_status(JobTable &jobs) {
+    std::vector<JobId> changed{};
 
-        if (pid == 0) {
-            /* No processes ready to report.  */
-            break;
-        }
+    for (const pid_t pid : reactor().pending()) {
+        // The processes of the job in foreground are taken by its wait
+        const auto process = jobs.process(pid);
+        if (!process.has_value())
+            continue;
 
-        if (pid == -1 && errno == ECHILD) {
-            /* No processes ready to report.  */
-            break;
-        }
+        ExecStats &stats = jobs.find(process->job)->processes[process->index];
+        while (const auto wstatus = reactor().take(pid))
+            process_wstatus(stats, *wstatus);
 
-        process_wstatus(job, pid, wstatus);
+        jobs.update(process->job);
+        changed.push_back(process->job);
     }
+
+    return changed;
 }
 
 void Waiter::wait(Job &job) const {
@@ -272,18 +454,20 @@ void Waiter::wait(Job &job) const {
     job = retval;
 }
 
-void Waiter::wait_inside_async(Job &job) const {
-    pid_t pgid = job.pgid;
-
+void Waiter::wait_inside_async(JobTable &jobs) const {
     /* Don't check for stopped jobs. An asyn list will terminate only when all
      * the childred are completed. Some of them might get stopped by the tty. We
      * don't want to loose them before exiting the async list.
      */
-    while (!job.completed()) {
-        int wstatus;
-        const pid_t pid = waitpid(-pgid, &wstatus, WUNTRACED);
+    while (!jobs.empty()) {
+        for (const JobId id : update_status(jobs)) {
+            const Job *job = jobs.find(id);
+            if (job != nullptr && job->completed())
+                jobs.remove(id);
+        }
 
-        process_wstatus(job, pid, wstatus);
+        if (!jobs.empty())
+            reactor().poll(-1);
     }
 }
 
@@ -375,6 +559,13 @@ struct Spawner {
             // Child
             // -----------
 
+            /* The input of the shell read ahead by the parent must be
+             * dropped: exit() would otherwise move the offset of the fd,
+             * shared with the parent, back to the first unread byte and
+             * the parent would read it twice.
+             */
+            __fpurge(stdin);
+
             if (shell.is_interactive) {
                 /* Put the process into the process group and give the
                  * process group the terminal, if appropriate. This has to
@@ -418,13 +609,67 @@ struct Spawner {
         // Parent
         // -----------
 
+        ++stats().forks;
+
+        return this->parent(pid, pgid, true);
+    }
+
+    /**
+     * Starts `program` with the image of `exec` and the redirections of
+     * `redirect` without running any code of the shell in the child,
+     * through spawn_program().
+     */
+    ExecStats spawn_exec(const Exec &exec, const Program &program,
+                         const RedirectController &redirect) const {
+        const SpawnEngine engine = spawn_engine();
+        const pid_t pgid = this->state.pipeline_pgid;
+        const RedirectPlan plan = redirect.plan();
+
+        ProcessSetup setup{
+            .dups = plan.dups,
+            .closes = plan.closes,
+        };
+
+        if (shell.is_interactive) {
+            setup.pgid = (pgid != -1) ? pgid : 0;
+            setup.terminal = state.is_foreground ? shell.terminal : -1;
+            setup.default_signals = true;
+        }
+
+        const pid_t pid =
+            spawn_program(engine, program, exec.argv(), exec.envp(), setup);
+        if (pid == -1) {
+            const int error = errno;
+            std::println(stderr, "testsh: {}: {}", exec.argv()[0],
+                         std::strerror(error));
+
+            return ExecStats{
+                .exit_code = (error == ENOENT) ? 127 : 126,
+                .child_pid = -1,
+                .pipeline_pgid = -1,
+                .completed = true,
+            };
+        }
+
+        ++(engine == SpawnEngine::spawn ? stats().spawns : stats().forks);
+        stats().fd_syscalls += plan.syscalls();
+
+        // posix_spawn() returns after the child has joined its group, it
+        // might have already run the exec: setpgid() would fail with EACCES
+        return this->parent(pid, pgid, engine == SpawnEngine::fork);
+    }
+
+  private:
+    ExecStats parent(pid_t pid, pid_t pgid, bool set_pgid) const {
+        reactor().watch(pid);
+
         // Process Group ID must be set from the parent as well to avoid
         // race conditions
         if (shell.is_interactive) {
             int retval{};
             pgid = (pgid != -1) ? pgid : pid;
 
-            retval = setpgid(pid, pgid);
+            retval = set_pgid ? setpgid(pid, pgid) : 0;
             if (retval == -1) {
                 std::println(stderr, "{}: setpgid({}, {}): {}", __FUNCTION__,
                              pid, pgid, std::strerror(errno));
@@ -455,49 +700,201 @@ struct Spawner {
 };
 
 /**
- * @brief Create a pipe object
+ * Largest capacity of a pipe that a process without privileges can ask
+ * for, read from /proc/sys/fs/pipe-max-size.
+ */
+static int pipe_max_size() {
+    static const int size = [] {
+        std::ifstream proc{"/proc/sys/fs/pipe-max-size"};
+        int size = 0;
+
+        // The default of Linux
+        if (!(proc >> size) || size <= 0)
+            return 1 << 20;
+
+        return size;
+    }();
+
+    return size;
+}
+
+/**
+ * @brief Create a pipe object, with a capacity of `capacity` bytes, or the
+ * default of the kernel if it is 0
  *
  * @return std::optional<std::tuple<int, int>> tuple{reader_fd, writer_fd};
  */
-static std::tuple<int, int> create_pipe() {
+static std::tuple<int, int> create_pipe(int capacity = 0) {
     int pipefd[2] = {-1, -1};
-    const int retval = pipe(pipefd);
+    // The children get the ends they use through their redirections
+    const int retval = pipe2(pipefd, O_CLOEXEC);
 
     if (retval == -1) {
         std::perror("pipe");
         exit(1);
     }
 
+    // The kernel rounds the capacity up to a power of two pages. It fails
+    // with EPERM when the user already has too many pages in pipes: the
+    // pipe keeps the default capacity, which is reported once.
+    if (capacity > 0 && fcntl(pipefd[1], F_SETPIPE_SZ, capacity) == -1) {
+        static bool reported = false;
+
+        if (!reported) {
+            std::println(stderr,
+                         "testsh: cannot set the capacity of a pipe to {}: "
+                         "{}, using the default",
+                         capacity, std::strerror(errno));
+            reported = true;
+        }
+    }
+
     return std::tuple{pipefd[0], pipefd[1]};
 }
 
-static bool is_builtin(const SimpleCommand &cmd) {
-    const auto &prog = cmd.program;
+/**
+ * Copies `output`, from `offset` to its end, into the pipe `writer`.
+ * Returns false if the pipe became full: `offset` is where the copy
+ * stopped.
+ */
+static bool copy_output(int output, int writer, off_t &offset) {
+    struct stat st;
+    if (fstat(output, &st) == -1)
+        return true;
+
+    while (offset < st.st_size) {
+        const ssize_t sent =
+            sendfile(writer, output, &offset, st.st_size - offset);
+        if (sent == -1 && errno == EINTR)
+            continue;
+        if (sent == -1 && errno == EAGAIN)
+            return false;
+        if (sent <= 0)
+            break;
+    }
+
+    return true;
+}
+
+/**
+ * Writes the output of a builtin run by the shell into its pipe, without
+ * blocking the shell. The pipe is grown to fit the output, up to
+ * pipe_max_size(); what does not fit is written by a child, so that the
+ * next commands of the pipeline can be started and read it. Returns false
+ * if the child is needed.
+ */
+static bool flush_output(int output, int writer, off_t &offset) {
+    struct stat st;
+    if (fstat(output, &st) == -1)
+        return true;
+
+    const int capacity = fcntl(writer, F_GETPIPE_SZ);
+    if (capacity != -1 && st.st_size > capacity)
+        fcntl(writer, F_SETPIPE_SZ,
+              std::min<off_t>(st.st_size, pipe_max_size()));
 
-    return prog == "bg" || prog == "cd" || prog == "exec" || prog == "exit" ||
-           prog == "fg" || prog == "jobs";
+    fcntl(writer, F_SETFL, O_NONBLOCK);
+    return copy_output(output, writer, offset);
 }
 
-std::optional<ExecStats> Executor::builtin(const SimpleCommand &cmd) {
-    const auto &prog = cmd.program;
-    int exit_code{};
-
-    if (prog == "bg") {
-        exit_code = builtin_bg(cmd, this->bg_jobs, Waiter(shell));
-    } else if (prog == "cd") {
-        exit_code = builtin_cd(cmd);
-    } else if (prog == "exec") {
-        exit_code = builtin_exec(cmd, this->shell);
-    } else if (prog == "exit") {
-        exit_code = builtin_exit(cmd);
-    } else if (prog == "fg") {
-        exit_code = builtin_fg(cmd, this->bg_jobs, Waiter(shell));
-    } else if (prog == "jobs") {
-        exit_code = builtin_jobs(cmd, this->bg_jobs);
-    } else {
-        return std::nullopt;
+/**
+ * Copies `input` into `output` up to its end. When one of them is a pipe
+ * the data is moved by splice(), inside the kernel, without passing through
+ * a buffer of the process; read() and write() are used for the others.
+ * Returns false with errno set on an error.
+ */
+static bool relay_fd(int input, int output) {
+    for (;;) {
+        const ssize_t moved =
+            splice(input, nullptr, output, nullptr,
+                   static_cast<size_t>(pipe_max_size()), SPLICE_F_MOVE);
+        if (moved > 0)
+            continue;
+        if (moved == 0)
+            return true;
+        if (errno == EINTR)
+            continue;
+        // Neither is a pipe, or the file does not support splice()
+        if (errno == EINVAL)
+            break;
+
+        return false;
+    }
+
+    char buffer[size_t{64} << 10];
+
+    for (;;) {
+        const ssize_t n = read(input, buffer, sizeof(buffer));
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return n == 0;
+
+        for (ssize_t written = 0; written < n;) {
+            const ssize_t w = write(output, buffer + written, n - written);
+            if (w == -1 && errno == EINTR)
+                continue;
+            if (w == -1)
+                return false;
+
+            written += w;
+        }
+    }
+}
+
+/**
+ * Checks if `cmd` is a `cat` that only copies files, or its stdin, to its
+ * stdout: it can run as a relay, see relay().
+ */
+static bool is_relay(const SimpleCommand &cmd) {
+    return cmd.program == "cat" && cmd.envs.empty() &&
+           std::ranges::all_of(cmd.arguments, [](std::string_view arg) {
+               return arg == "-" || !arg.starts_with('-');
+           });
+}
+
+/**
+ * Runs a `cat` command of a pipeline in a child of the shell, which moves
+ * the data of the files with relay_fd() instead of executing the program.
+ * Returns the exit status of the command.
+ */
+static int relay(const SimpleCommand &cat) {
+    int status = 0;
+
+    const auto copy = [&](int fd, std::string_view name) {
+        if (!relay_fd(fd, STDOUT_FILENO)) {
+            std::println(stderr, "cat: {}: {}", name, std::strerror(errno));
+            status = 1;
+        }
+    };
+
+    if (cat.arguments.empty())
+        copy(STDIN_FILENO, "-");
+
+    for (const auto file : cat.arguments) {
+        if (file == "-") {
+            copy(STDIN_FILENO, file);
+            continue;
+        }
+
+        const int fd = open(std::string{file}.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            std::println(stderr, "cat: {}: {}", file, std::strerror(errno));
+            status = 1;
+            continue;
+        }
+
+        copy(fd, file);
+        close(fd);
     }
 
+    return status;
+}
+
+ExecStats Executor::builtin(const Builtin &builtin,
+                            const SimpleCommand &cmd) {
+    const int exit_code = builtin.run(*this, cmd);
+
     return ExecStats{
         .exit_code = exit_code,
         .child_pid = getpid(),
@@ -524,32 +921,218 @@ ExecStats Executor::simple_command(const SimpleCommand &cmd,
 
     // Check if a builtin can be run first before, before running
     // the program through exec().
-    if (is_builtin(cmd)) {
-        if (state.inside_pipeline) {
-            return spawner.spawn_async(&Executor::builtin, this, cmd);
+    if (const Builtin *builtin = find_builtin(cmd.program)) {
+        const auto run_in_shell = [&]() {
+            const ScopedRedirections scoped{redirect};
+            if (!scoped.ok())
+                return ExecStats::ERROR;
+
+            return this->builtin(*builtin, cmd);
+        };
+
+        if (!state.inside_pipeline)
+            return run_in_shell();
+
+        // A builtin that changes the shell only changes a child, as the
+        // other commands of a pipeline
+        if (!builtin->traits.pipeline_no_fork) {
+            auto child = [&]() {
+                if (!redirect.apply_redirections())
+                    exit(1);
+
+                exit(this->builtin(*builtin, cmd).exit_code);
+            };
+
+            return spawner.spawn_async(child);
+        }
+
+        /* The output is collected in a memory file and then written into
+         * the pipe: writing it straight into the pipe would block the
+         * shell as soon as the pipe is full, before the command reading
+         * it is even started.
+         */
+        const int output = memfd_create("testsh-pipe", MFD_CLOEXEC);
+        if (output == -1) {
+            std::println(stderr, "memfd_create: {}", std::strerror(errno));
+            return ExecStats::ERROR;
+        }
+
+        const int writer = std::get<1>(state.redirects.back());
+        redirect.capture_pipe(state, output);
+
+        ExecStats status = run_in_shell();
+        status.pipeline_pgid = state.pipeline_pgid;
+
+        off_t offset = 0;
+        if (flush_output(output, writer, offset)) {
+            ++stats().pipeline_builtins;
         } else {
-            return this->builtin(cmd).value();
+            auto child = [&]() {
+                // The end read by the next command, or the copy would never
+                // see it closed
+                for (const int fd : state.fd_to_close)
+                    close(fd);
+
+                fcntl(writer, F_SETFL, 0);
+                copy_output(output, writer, offset);
+                exit(status.exit_code);
+            };
+
+            status = spawner.spawn_async(child);
         }
+
+        close(writer);
+        return status;
     }
 
-    auto child = [&]() {
-        if (!redirect.apply_redirections())
-            exit(1);
+    // A `cat` between a file and a pipe of a pipeline is run by a child of
+    // the shell that moves the data with splice()
+    if (this->splice_relay && state.initialized() && is_relay(cmd)) {
+        auto child = [&]() {
+            if (!redirect.apply_redirections())
+                exit(1);
 
-        Exec exec_prog{cmd, this->shell};
-        exec_prog.exec();
+            exit(relay(cmd));
+        };
 
-        exit(1);
-    };
+        ++stats().relays;
+        return spawner.spawn_async(child);
+    }
 
-    ExecStats retval = spawner.spawn_async(child);
+    this->exec_image.build(cmd, this->shell);
+    const auto program =
+        this->command_hash.find(cmd.program, this->shell.vars);
 
-    return retval;
+    if (state.exec_in_place) {
+        const RedirectPlan plan = redirect.plan();
+        const ProcessSetup setup{
+            .default_signals = this->shell.is_interactive,
+            .dups = plan.dups,
+            .closes = plan.closes,
+        };
+
+        Stats::count_elided_fork();
+
+        // exec() drops what is still buffered
+        std::fflush(stdout);
+        exec_program(program.value_or(Program{}), this->exec_image.argv(),
+                     this->exec_image.envp(), setup);
+    }
+
+    return spawner.spawn_exec(this->exec_image, program.value_or(Program{}),
+                              redirect);
+}
+
+// Size of the first read of a command substitution
+static constexpr size_t capture_chunk = size_t{64} << 10;
+
+/**
+ * Largest output of a command substitution, set by the TESTSH_CMDSUB_MAX
+ * environment variable in bytes. Unlimited by default.
+ */
+static size_t cmdsub_limit() {
+    static const size_t limit = [] {
+        constexpr size_t unlimited = std::numeric_limits<size_t>::max();
+
+        const char *env = std::getenv("TESTSH_CMDSUB_MAX");
+        if (env == nullptr)
+            return unlimited;
+
+        const std::string_view value{env};
+        size_t limit = 0;
+
+        const auto [ptr, ec] =
+            std::from_chars(value.data(), value.data() + value.size(), limit);
+        if (ec != std::errc{} || ptr != value.data() + value.size()) {
+            std::println(stderr,
+                         "testsh: invalid TESTSH_CMDSUB_MAX={}, using no limit",
+                         value);
+            return unlimited;
+        }
+
+        return limit;
+    }();
+
+    return limit;
+}
+
+/**
+ * Reads `fd` up to its end into `output`. Every read fills the free space
+ * of the string, whose size doubles when it is full. Returns false if the
+ * output is longer than `limit`: only the first `limit` bytes are kept.
+ */
+static bool read_output(int fd, std::string &output, size_t limit) {
+    for (;;) {
+        const size_t size = output.size();
+        const size_t capacity =
+            std::min(std::max({capture_chunk, output.capacity(), size * 2}) - 1,
+                     limit) +
+            1;
+
+        ssize_t n = 0;
+        output.resize_and_overwrite(capacity, [&](char *data, size_t space) {
+            n = read(fd, data + size, space - size);
+            return size + static_cast<size_t>(std::max<ssize_t>(n, 0));
+        });
+
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return true;
+
+        if (output.size() > limit) {
+            output.resize(limit);
+            return false;
+        }
+    }
+}
+
+/**
+ * Reads the output of a command substitution from `fd` and removes the
+ * newlines at its end, in place.
+ */
+static void capture_output(int fd, std::string &output) {
+    if (!read_output(fd, output, cmdsub_limit())) {
+        std::println(stderr,
+                     "testsh: command substitution: output truncated to {} "
+                     "bytes",
+                     cmdsub_limit());
+    }
+
+    while (!output.empty() && output.back() == '\n')
+        output.pop_back();
 }
 
 // For substitution details take a look at the standard.
 // https://pubs.opengroup.org/onlinepubs/9699919799/utilities/V3_chap02.html#tag_18_06_03
-std::string Executor::cmdsub(const CmdSub &sub, const CommandState &state) {
+std::string Executor::cmdsub(const Bytecode &bytecode, size_t body,
+                             size_t end, const CommandState &state) {
+    std::string substitution{};
+
+    // A body that only runs builtins writes its output in a memory file,
+    // no child and no pipe are needed
+    const int output = this->runs_virtual(bytecode, body, end)
+                           ? memfd_create("testsh-cmdsub", MFD_CLOEXEC)
+                           : -1;
+
+    if (output != -1) {
+        const RedirectController redirect{CommandState{
+            .redirects = {{STDOUT_FILENO, output}},
+        }};
+
+        {
+            const ScopedRedirections scoped{redirect};
+            if (scoped.ok())
+                this->virtual_subshell(bytecode, body, end, state);
+        }
+
+        if (lseek(output, 0, SEEK_SET) == 0)
+            capture_output(output, substitution);
+
+        ++stats().inline_cmdsubs;
+        return substitution;
+    }
+
     Job job{};
 
     Spawner spawner{
@@ -559,7 +1142,7 @@ std::string Executor::cmdsub(const CmdSub &sub, const CommandState &state) {
     };
 
     // Setup piping for stdout redirections
-    const auto [reader_fd, writer_fd] = create_pipe();
+    const auto [reader_fd, writer_fd] = create_pipe(this->pipe_size());
 
     auto child = [&]() {
         // -----------
@@ -570,9 +1153,7 @@ std::string Executor::cmdsub(const CmdSub &sub, const CommandState &state) {
         dup2(writer_fd, STDOUT_FILENO);
         close(writer_fd);
 
-        const auto stats = this->list(*sub.seq_list, state);
-
-        exit(stats.last_stats.exit_code);
+        this->run(bytecode, body, state);
     };
 
     // -----------
@@ -586,18 +1167,10 @@ std::string Executor::cmdsub(const CmdSub &sub, const CommandState &state) {
     // Start reading
     close(writer_fd);
 
-    fd_streambuf buf{reader_fd};
-    std::istream is(&buf);
-
-    std::string substitution(std::istreambuf_iterator<char>(is), {});
-
+    // The child gets a SIGPIPE if it writes more than the limit
+    capture_output(reader_fd, substitution);
     close(reader_fd);
 
-    // Remove last newline if present
-    if (!substitution.empty() && substitution.back() == '\n') {
-        substitution = substitution.substr(0, substitution.size() - 1);
-    }
-
     // The child should be already terminated, collect the signal
     // to avoid leaving zombie processes hanging around.
     Waiter{this->shell}.wait(job);
@@ -605,188 +1178,86 @@ std::string Executor::cmdsub(const CmdSub &sub, const CommandState &state) {
     return substitution;
 }
 
-std::string Executor::varsub(const VarSub &sub, const CommandState &state) {
-    assertm(sub.token.value.starts_with("$"),
-            "The first character must always be a dollar.");
-
-    // TODO: handle special cases
-
-    auto value = shell.vars.get(sub.token.value.substr(1));
-    return std::string(value.value_or(""));
-}
-
-std::string Executor::substitution(const Substitution &sub,
-                                   const CommandState &state) {
-
-    auto sub_str = std::visit(
-        overloads{
-            [&](const CmdSub &sub) { return this->cmdsub(sub, state); },
-            [&](const VarSub &sub) { return this->varsub(sub, state); },
-        },
-        sub);
+/**
+ * Capacity of the pipes given by a value of TESTSH_PIPE_SIZE, see
+ * Executor::pipe_size().
+ */
+static int parse_pipe_size(std::string_view value) {
+    if (value.empty())
+        return 0;
+
+    size_t size = 0;
+    const auto [ptr, ec] =
+        std::from_chars(value.data(), value.data() + value.size(), size);
+    if (ec != std::errc{} || ptr != value.data() + value.size()) {
+        std::println(stderr,
+                     "testsh: invalid TESTSH_PIPE_SIZE={}, using the default",
+                     value);
+        return 0;
+    }
 
-    return sub_str;
+    return static_cast<int>(
+        std::min(size, static_cast<size_t>(pipe_max_size())));
 }
 
-ExecStats Executor::unsub_command(const UnsubCommand &cmd,
-                                  const CommandState &state) {
-
-    std::string program{};
-    std::vector<std::string> arguments{};
+int Executor::pipe_size() {
+    // An invalid value is reported once, the first time it is read
+    const auto value = this->shell.vars.get("TESTSH_PIPE_SIZE").value_or("");
 
-    if (std::holds_alternative<Substitution>(*cmd.program)) {
-        program =
-            this->substitution(std::get<Substitution>(*cmd.program), state);
-    } else {
-        program = std::get<Token>(*cmd.program).text();
+    if (value != this->pipe_size_value) {
+        this->pipe_size_value = value;
+        this->pipe_capacity = parse_pipe_size(value);
     }
 
-    for (const auto &arg : cmd.arguments) {
-        std::string arg_str;
+    return this->pipe_capacity;
+}
 
-        if (std::holds_alternative<Substitution>(arg)) {
-            arg_str = this->substitution(std::get<Substitution>(arg), state);
-        } else {
-            arg_str = std::get<Token>(arg).text();
-        }
+std::string_view Executor::varsub(const Token &token) {
+    const std::string_view name = token.view(this->lexer.input());
 
-        arguments.emplace_back(std::move(arg_str));
-    }
+    assertm(name.starts_with("$"),
+            "The first character must always be a dollar.");
 
-    SimpleCommand expanded{
-        .program = std::move(program),
-        .arguments = std::move(arguments),
-        .redirections = cmd.redirections,
-        .envs = cmd.envs,
-    };
+    // TODO: handle special cases
 
-    return this->simple_command(expanded, state);
+    auto value = shell.vars.get(name.substr(1));
+    return this->scratch.store(value.value_or(""));
 }
 
-static void add_shell_vars(Shell &shell, const SimpleAssignment &assign) {
-    for (const auto &env : assign.envs) {
-        shell.vars.upsert(env.whole.text(), std::nullopt);
+static void add_shell_vars(Shell &shell,
+                           std::span<const AssignmentWord> envs,
+                           std::string_view source, ScratchArena &scratch) {
+    for (const auto &env : envs) {
+        shell.vars.upsert(std::string(env.whole.text(source, scratch)),
+                          std::nullopt);
     }
 }
 
-ExecStats Executor::simple_assignment(const SimpleAssignment &assign,
+ExecStats Executor::simple_assignment(std::span<const AssignmentWord> envs,
+                                      std::span<const Redirect> redirections,
                                       const CommandState &state) {
     // Close the redirections used by the child, the parent no longer needs
     // them. The unneeded files will be automatically closed when the
     // destructor will be called.
     RedirectController redirect{state};
-    Spawner spawner{state, this->shell};
 
-    if (!redirect.add_redirects(assign.redirections)) {
+    if (!redirect.add_redirects(redirections)) {
         return ExecStats::ERROR;
     }
 
+    // Inside a pipeline the assignments would only change a child, the
+    // files of the redirections were already created
     if (state.inside_pipeline) {
-        return spawner.spawn_async(add_shell_vars, this->shell, assign);
+        ExecStats status = ExecStats::shallow(getpid());
+        status.pipeline_pgid = state.pipeline_pgid;
+        return status;
     }
 
-    add_shell_vars(this->shell, assign);
+    add_shell_vars(this->shell, envs, this->lexer.input(), this->scratch);
     return ExecStats::shallow(getpid());
 }
 
-ExecStats Executor::and_list(const AndList &and_list,
-                             const CommandState &state) {
-    const auto lhs = this->op_list(*and_list.left, state);
-
-    // JOB CONTROL:
-    // Don't execute tht rhs if the lhs terminated with a SIGNINT signal
-    auto sigint =
-        lhs.signaled.transform([](int signal) { return signal == SIGINT; });
-    if (sigint == true) {
-        return lhs;
-    }
-
-    // TODO: hanldle if a process got stopped
-
-    // Don't execute the rhs if the lhs terminated with an error
-    if (lhs.exit_code != 0) {
-        return lhs;
-    }
-
-    const auto rhs = this->op_list(*and_list.right, state);
-
-    return rhs;
-}
-
-ExecStats Executor::or_list(const OrList &or_list, const CommandState &state) {
-    const auto lhs = this->op_list(*or_list.left, state);
-
-    // JOB CONTROL:
-    // Don't execute tht rhs if the lhs terminated with a SIGNINT signal
-    auto sigint =
-        lhs.signaled.transform([](int signal) { return signal == SIGINT; });
-    if (sigint == true) {
-        return lhs;
-    }
-
-    // Don't execute the rhs if the lhs terminated with a success
-    if (lhs.exit_code == 0) {
-        return lhs;
-    }
-
-    const auto rhs = this->op_list(*or_list.right, state);
-
-    return rhs;
-}
-
-Job Executor::pipeline(const Pipeline &pipeline, const CommandState &state) {
-    assertm(!pipeline.cmds.empty(), "A pipeline must always contain something");
-
-    Job job{};
-    pid_t pipeline_pgid = state.pipeline_pgid;
-    bool is_foreground = state.is_foreground;
-    int prev_reader_fd = 0;
-
-    auto no_cmds = std::max(pipeline.cmds.size() - 1, (size_t)0);
-    for (const auto &cmd : pipeline.cmds | vw::take(no_cmds)) {
-        auto pipefd = create_pipe();
-        const auto [reader_fd, writer_fd] = pipefd;
-
-        std::vector<std::tuple<int, int>> redirects{};
-        if (prev_reader_fd != 0)
-            redirects.emplace_back(STDIN_FILENO, prev_reader_fd);
-
-        redirects.emplace_back(STDOUT_FILENO, writer_fd);
-        prev_reader_fd = reader_fd;
-
-        auto stats = this->command(cmd, {
-                                            .redirects = std::move(redirects),
-                                            .fd_to_close = {reader_fd},
-                                            .is_foreground = is_foreground,
-                                            .inside_pipeline = true,
-                                            .pipeline_pgid = pipeline_pgid,
-                                        });
-
-        pipeline_pgid = stats.pipeline_pgid;
-        job.add(std::move(stats));
-    }
-
-    std::vector<std::tuple<int, int>> redirects{};
-    if (prev_reader_fd != 0)
-        redirects.emplace_back(STDIN_FILENO, prev_reader_fd);
-
-    auto stats = this->command(pipeline.cmds.back(),
-                               {
-                                   .redirects = std::move(redirects),
-                                   .fd_to_close = {},
-                                   .is_foreground = is_foreground,
-                                   .inside_pipeline = false,
-                                   .pipeline_pgid = pipeline_pgid,
-                               });
-
-    job.add(std::move(stats));
-
-    return job;
-}
-
-ExecStats Executor::wait_pipeline(const Pipeline &pipeline,
-                                  const CommandState &state) {
-    auto job = this->pipeline(pipeline, state);
+ExecStats Executor::wait_pipeline(Job &job, bool negated) {
     Waiter{this->shell}.wait(job);
 
     auto stopped = job.stopped() && !job.completed();
@@ -796,89 +1267,37 @@ ExecStats Executor::wait_pipeline(const Pipeline &pipeline,
         /* If a job was stpeed while waiting for it put it in the
          * background jobs
          */
-        this->bg_jobs.emplace_back(std::move(job));
+        const JobId id = this->jobs.add(std::move(job));
+        std::println(stderr, "[{}] Stopped", id);
     }
 
-    if (pipeline.negated /* && !stopped */) {
+    if (negated /* && !stopped */) {
         stats.exit_code = (stats.exit_code != 0) ? 0 : 1;
     }
 
     return stats;
 }
 
-ExecStats Executor::op_list(const OpList &list, const CommandState &state) {
-    const auto stats =
-        std::visit(overloads{
-                       [&](const AndList &and_list) {
-                           return this->and_list(and_list, state);
-                       },
-                       [&](const OrList &or_list) {
-                           return this->or_list(or_list, state);
-                       },
-                       [&](const Pipeline &pipeline) {
-                           return this->wait_pipeline(pipeline, state);
-                       },
-                   },
-                   list);
-
-    return stats;
-}
-
-ListStats Executor::sequential_list(const SequentialList &sequential_list,
-                                    const CommandState &state) {
-
-    ListStats stats{};
-
-    if (sequential_list.left.has_value()) {
-        stats = this->list(**sequential_list.left, state);
-    }
-
-    stats.last_stats = this->op_list(*sequential_list.right, state);
-
-    return stats;
-}
-
-ListStats Executor::async_list(const AsyncList &async_list,
-                               const CommandState &state) {
-    ListStats stats{};
-
-    if (async_list.left.has_value()) {
-        stats = this->list(**async_list.left, state);
-    }
-
+Job Executor::async_list(const Bytecode &bytecode, size_t body,
+                         const CommandState &state) {
     Spawner spawner{.state = state,
                     .shell = this->shell,
                     .spawn_type = SpawnType::async_list};
 
     const auto async_fn = [&]() {
-        Waiter waiter{shell};
         CommandState async_state{state};
         async_state.pipeline_pgid = getpgrp();
         async_state.is_foreground = false;
 
-        /* Clear any bg_jobs from the parent. It's ok to do this in this context
+        /* Clear any jobs from the parent. It's ok to do this in this context
          * because the child will have its own memory space (due to the COW
          * mechanism). Use the background jobs to wait on any child if it get
          * stopped. e.g. `cat &` should be stopped by a SIGTTIN when trying to
          * read the stdin from background.
          */
-        this->bg_jobs.clear();
+        this->jobs.clear();
 
-        const auto stats = this->op_list(*async_list.right, async_state);
-
-        /* Wait for any background job before terminating
-         */
-        while (!this->bg_jobs.empty()) {
-            for (auto &job : this->bg_jobs)
-                waiter.wait_inside_async(job);
-
-            this->bg_jobs =
-                this->bg_jobs |
-                vw::filter([](const auto &j) { return !j.completed(); }) |
-                std::ranges::to<std::vector>();
-        }
-
-        exit(stats.exit_code);
+        this->run(bytecode, body, async_state);
     };
 
     /* A job must be created from a async list. This will represent
@@ -893,45 +1312,153 @@ ListStats Executor::async_list(const AsyncList &async_list,
 
     job.add(std::move(async_stats));
 
-    stats.last_stats = job.exec_stats();
-    stats.bg_jobs.emplace_back(std::move(job));
-
-    return stats;
+    return job;
 }
 
-ListStats Executor::list(const List &list, const CommandState &state) {
-    auto stats = std::visit(overloads{
-                                [&](const SequentialList &seq) {
-                                    return this->sequential_list(seq, state);
-                                },
-                                [&](const AsyncList &async) {
-                                    return this->async_list(async, state);
-                                },
-                            },
-                            list);
+/**
+ * Words of the task of `item` run by `parallel`: `{}` in the words of
+ * `command` is replaced by the item, which is appended when there is no
+ * `{}`.
+ */
+static std::vector<std::string> task_words(const SimpleCommand &command,
+                                           std::string_view item) {
+    std::vector<std::string> words{};
+    words.reserve(command.arguments.size() + 2);
+    bool replaced = false;
+
+    const auto add = [&](std::string_view word) {
+        std::string &task_word = words.emplace_back();
+
+        for (size_t pos = 0;;) {
+            const size_t found = word.find("{}", pos);
+            task_word.append(word.substr(pos, found - pos));
+            if (found == std::string_view::npos)
+                break;
+
+            task_word.append(item);
+            replaced = true;
+            pos = found + 2;
+        }
+    };
+
+    add(command.program);
+    for (const auto argument : command.arguments)
+        add(argument);
 
-    return stats;
+    if (!replaced)
+        words.emplace_back(item);
+
+    return words;
 }
 
-ExecStats Executor::command(const Command &command, const CommandState &state) {
-    const auto stats =
-        std::visit(overloads{
-                       [&](const UnsubCommand &cmd) {
-                           return this->unsub_command(cmd, state);
-                       },
-                       [&](const SimpleAssignment &assign) {
-                           return this->simple_assignment(assign, state);
-                       },
-                       [&](const Subshell &subshell) {
-                           return this->subshell(subshell, state);
-                       },
-                   },
-                   command);
+int Executor::parallel(const SimpleCommand &command,
+                       std::span<const std::string_view> items,
+                       size_t limit) {
+    /* Run by the shell itself, the tasks share a process group that owns
+     * the terminal, as the commands of a pipeline in foreground: ^C and ^Z
+     * reach all of them. Run by a child of the shell, in a pipeline or in
+     * an async list, they join the group of the child.
+     */
+    const bool owns_terminal =
+        this->shell.is_interactive && getpgrp() == this->shell.pgid;
 
-    return stats;
+    CommandState state{.is_foreground = owns_terminal};
+    if (!owns_terminal)
+        state.pipeline_pgid = getpgrp();
+
+    std::vector<ExecStats> running{};
+    size_t next = 0;
+    size_t failed = 0;
+    bool stopped = false;
+
+    while (!stopped && (next < items.size() || !running.empty())) {
+        while (next < items.size() && running.size() < limit) {
+            const auto words = task_words(command, items[next++]);
+
+            SimpleCommand task{.program = words[0], .envs = command.envs};
+            for (const auto &word : words | vw::drop(1))
+                task.arguments.push_back(word);
+
+            // A builtin runs in the shell and has already completed
+            const ExecStats status = this->simple_command(task, state);
+            ++stats().parallel_tasks;
+
+            if (status.completed) {
+                failed += status.exit_code != 0;
+                continue;
+            }
+
+            // The next tasks join the group of the first one
+            if (owns_terminal)
+                state.pipeline_pgid = status.pipeline_pgid;
+
+            running.push_back(status);
+        }
+
+        // The tasks that terminated leave their place to the next ones
+        const size_t before = running.size();
+        for (size_t i = 0; i < running.size();) {
+            ExecStats &task = running[i];
+
+            while (const auto wstatus = reactor().take(task.child_pid))
+                Waiter::process_wstatus(task, *wstatus);
+
+            if (!task.completed) {
+                stopped |= task.stopped;
+                ++i;
+                continue;
+            }
+
+            failed += task.exit_code != 0;
+
+            task = running.back();
+            running.pop_back();
+        }
+
+        // The group is gone with its last task, the next task starts another
+        if (owns_terminal && running.empty())
+            state.pipeline_pgid = -1;
+
+        if (!stopped && !running.empty() && running.size() == before)
+            reactor().poll(-1);
+    }
+
+    Job job{};
+    for (auto &task : running)
+        job.add(std::move(task));
+
+    if (owns_terminal) {
+        /* Put the shell back in the foreground, as Waiter::wait().  */
+        if (tcsetpgrp(this->shell.terminal, this->shell.pgid) == -1) {
+            std::println(stderr, "tcsetpgrp({}, {}): {}", this->shell.terminal,
+                         this->shell.pgid, std::strerror(errno));
+        }
+
+        job.set_modes(this->shell);
+        tcsetattr(this->shell.terminal, TCSADRAIN, &this->shell.tmodes);
+    }
+
+    // A stopped task stops the whole `parallel`: the tasks running become a
+    // job and the items left are not run
+    if (stopped) {
+        const JobId id = this->jobs.add(std::move(job));
+        std::println(stderr, "[{}] Stopped", id);
+
+        if (next < items.size()) {
+            std::println(stderr, "parallel: {} items not run",
+                         items.size() - next);
+        }
+
+        return 128 + SIGTSTP;
+    }
+
+    // As GNU parallel
+    return static_cast<int>(std::min<size_t>(failed, 101));
 }
 
-ExecStats Executor::subshell(const Subshell &subshell,
+ExecStats Executor::subshell(const Bytecode &bytecode, size_t body,
+                             size_t end,
+                             std::span<const Redirect> redirections,
                              const CommandState &state) {
     // Close the redirections used by the child, the parent no longer needs
     // them. The unneeded files will be automatically closed when the
@@ -939,18 +1466,26 @@ ExecStats Executor::subshell(const Subshell &subshell,
     RedirectController redirect{state};
     Spawner spawner{state, this->shell, SpawnType::subshell};
 
-    if (!redirect.add_redirects(subshell.redirections)) {
+    if (!redirect.add_redirects(redirections)) {
         return ExecStats::ERROR;
     }
 
+    // Inside a pipeline the subshell writes to a pipe that the next command
+    // reads, it needs its own process
+    if (!state.inside_pipeline && this->runs_virtual(bytecode, body, end)) {
+        const ScopedRedirections scoped{redirect};
+        if (!scoped.ok())
+            return ExecStats::ERROR;
+
+        return this->virtual_subshell(bytecode, body, end,
+                                      {.pipeline_pgid = state.pipeline_pgid});
+    }
+
     auto subshell_call = [&]() {
         if (!redirect.apply_redirections())
             exit(1);
 
-        const auto child_status = this->list(
-            *subshell.seq_list, {.pipeline_pgid = state.pipeline_pgid});
-
-        exit(child_status.last_stats.exit_code);
+        this->run(bytecode, body, {.pipeline_pgid = state.pipeline_pgid});
     };
 
     ExecStats retval = spawner.spawn_async(subshell_call);
@@ -958,48 +1493,326 @@ ExecStats Executor::subshell(const Subshell &subshell,
     return retval;
 }
 
-ExecStats Executor::program(const ThisProgram &program) {
-    if (program.child.empty())
-        return {};
+bool Executor::runs_virtual(const Bytecode &bytecode, size_t body,
+                            size_t end) {
+    if (!this->virtual_subshells)
+        return false;
 
-    ExecStats retval{};
-    for (const auto &complete_command : program.child) {
-        auto list_stats = this->list(complete_command, {});
+    const auto &code = bytecode.code;
+    const std::string_view input = this->lexer.input();
+    // The next word is the program of a command
+    bool program = true;
 
-        this->bg_jobs.append_range(list_stats.bg_jobs);
+    for (size_t pc = body; pc + 1 < end; ++pc) {
+        const Instr instr = code[pc];
 
-        /* The returned stats are always the one of the last list runned.
-         */
-        retval = list_stats.last_stats;
+        switch (instr.op) {
+        case OpCode::token:
+            if (program) {
+                const Builtin *builtin = find_builtin(
+                    bytecode.tokens[instr.a].text(input, this->scratch));
+
+                if (builtin == nullptr || builtin->traits.job_table ||
+                    builtin->traits.forks_subshell)
+                    return false;
+            }
+
+            program = false;
+            break;
+
+        // The program is not known until the word is expanded
+        case OpCode::varsub:
+            if (program)
+                return false;
+            break;
+
+        // A nested substitution or subshell chooses for itself how to run
+        case OpCode::cmdsub:
+            if (program)
+                return false;
+            pc = instr.a - 1;
+            break;
+
+        case OpCode::subshell:
+            pc = instr.a - 1;
+            program = true;
+            break;
+
+        case OpCode::pipeline:
+        case OpCode::command:
+        case OpCode::assignment:
+            program = true;
+            break;
+
+        case OpCode::async:
+        case OpCode::exit:
+            return false;
+
+        default:
+            break;
+        }
     }
 
-    return retval;
+    return true;
 }
 
-bool Executor::line_has_continuation() const {
-    assert(!this->input_buffer.empty());
+ExecStats Executor::virtual_subshell(const Bytecode &bytecode, size_t body,
+                                     size_t end, const CommandState &state) {
+    const ShellSnapshot snapshot{this->shell.vars};
+    if (!snapshot.ok()) {
+        std::println(stderr, "testsh: subshell: {}", std::strerror(errno));
+        return ExecStats::ERROR;
+    }
 
-    UnbufferedTokenizer tokenizer{this->input_buffer.back()};
+    ++stats().virtual_subshells;
 
-    TokenType prev = TokenType::eof;
-    TokenType next =
-        tokenizer.next_token()
-            .transform([](const Token &&token) { return token.type; })
-            .value_or(TokenType::eof);
+    const ExecStats status = this->run(bytecode, body, state, end - 1);
+
+    return ExecStats{
+        .exit_code = status.exit_code,
+        .child_pid = getpid(),
+        .completed = true,
+        .signaled = status.signaled,
+    };
+}
 
-    while (next != TokenType::eof && next != TokenType::new_line) {
-        prev = next;
+ExecStats Executor::run(const Bytecode &bytecode, size_t pc,
+                        const CommandState &state, size_t end) {
+    const auto &code = bytecode.code;
+    end = std::min(end, code.size());
+    const std::string_view input = this->lexer.input();
 
-        next = tokenizer.next_token()
-                   .transform([](const Token &token) { return token.type; })
-                   .value_or(TokenType::eof);
+    // Status of the last pipeline
+    ExecStats status{};
+
+    // Command being built
+    SimpleCommand cmd{};
+    bool has_program = false;
+    std::span<const AssignmentWord> envs{};
+
+    // Pipeline being spawned
+    Job job{};
+    pid_t pipeline_pgid = state.pipeline_pgid;
+    bool negated = false;
+    int prev_reader_fd = 0;
+    std::optional<std::tuple<int, int>> pipefd{};
+
+    const auto add_word = [&](std::string_view word) {
+        if (!has_program) {
+            cmd.program = word;
+            has_program = true;
+        } else {
+            cmd.arguments.push_back(word);
+        }
+    };
+
+    // State of the command about to be spawned, connected to the previous
+    // command and to the next one of the pipeline
+    const auto command_state = [&]() {
+        CommandState cmd_state{
+            .is_foreground = state.is_foreground,
+            .inside_pipeline = pipefd.has_value(),
+            .pipeline_pgid = pipeline_pgid,
+        };
+
+        if (prev_reader_fd != 0)
+            cmd_state.redirects.emplace_back(STDIN_FILENO, prev_reader_fd);
+
+        if (pipefd.has_value()) {
+            const auto [reader_fd, writer_fd] = *pipefd;
+            cmd_state.redirects.emplace_back(STDOUT_FILENO, writer_fd);
+            cmd_state.fd_to_close.push_back(reader_fd);
+        }
+
+        return cmd_state;
+    };
+
+    /* A command alone in its pipeline, followed only by the `exit` of a
+     * child shell, is the last thing the child does: it can become the
+     * command. The status of a negated pipeline has to be inverted, and
+     * the exit of an async list waits for its background jobs first.
+     */
+    const auto last_command = [&]() {
+        return pc + 1 < end && code[pc].op == OpCode::wait &&
+               code[pc + 1].op == OpCode::exit && !negated &&
+               job.processes.empty() && !pipefd.has_value() &&
+               prev_reader_fd == 0 &&
+               (code[pc + 1].a == 0 || this->jobs.empty());
+    };
+
+    const auto spawned = [&](ExecStats &&stats) {
+        if (pipefd.has_value()) {
+            pipeline_pgid = stats.pipeline_pgid;
+            prev_reader_fd = std::get<0>(*pipefd);
+            pipefd.reset();
+        }
+
+        job.add(std::move(stats));
+
+        cmd.program = {};
+        cmd.arguments.clear();
+        cmd.redirections = {};
+        cmd.envs.clear();
+        has_program = false;
+        envs = {};
+    };
+
+    while (pc < end) {
+        const Instr instr = code[pc++];
+
+        switch (instr.op) {
+        case OpCode::pipeline:
+            job = Job{};
+            pipeline_pgid = state.pipeline_pgid;
+            negated = instr.a != 0;
+            prev_reader_fd = 0;
+            break;
+
+        case OpCode::pipe:
+            pipefd = create_pipe(this->pipe_size());
+            break;
+
+        case OpCode::token:
+            add_word(bytecode.tokens[instr.a].text(input, this->scratch));
+            break;
+
+        case OpCode::varsub:
+            add_word(this->varsub(bytecode.tokens[instr.a]));
+            break;
+
+        case OpCode::cmdsub: {
+            // The output goes to the caller, not to the pipe of the command
+            const CommandState sub_state{
+                .is_foreground = state.is_foreground,
+                .pipeline_pgid = pipeline_pgid,
+            };
+
+            const auto output =
+                this->cmdsub(bytecode, pc, instr.a, sub_state);
+            add_word(this->scratch.store(output));
+            pc = instr.a;
+            break;
+        }
+
+        case OpCode::assign:
+            envs = std::span{bytecode.assignments}.subspan(instr.a, instr.b);
+            break;
+
+        case OpCode::redirect:
+            cmd.redirections =
+                std::span{bytecode.redirects}.subspan(instr.a, instr.b);
+            break;
+
+        case OpCode::command: {
+            cmd.envs.reserve(envs.size());
+            for (const auto &env : envs)
+                cmd.envs.push_back(env.whole.text(input, this->scratch));
+
+            CommandState cmd_state = command_state();
+            cmd_state.exec_in_place = last_command();
+
+            spawned(this->simple_command(cmd, cmd_state));
+            break;
+        }
+
+        case OpCode::assignment:
+            spawned(this->simple_assignment(envs, cmd.redirections,
+                                            command_state()));
+            break;
+
+        case OpCode::subshell:
+            spawned(this->subshell(bytecode, pc, instr.a, cmd.redirections,
+                                   command_state()));
+            pc = instr.a;
+            break;
+
+        case OpCode::async: {
+            Job async_job = this->async_list(bytecode, pc, state);
+
+            status = async_job.exec_stats();
+            if (!async_job.completed()) {
+                const JobId id = this->jobs.add(std::move(async_job));
+                std::println(stderr, "[{}] {}", id, status.child_pid);
+            }
+            pc = instr.a;
+            break;
+        }
+
+        case OpCode::exit:
+            /* An async list waits for any background job before terminating
+             */
+            if (instr.a != 0)
+                Waiter{this->shell}.wait_inside_async(this->jobs);
+
+            exit(status.exit_code);
+
+        case OpCode::wait:
+            status = this->wait_pipeline(job, negated);
+            break;
+
+        case OpCode::jump_if_failure:
+            if (status.exit_code != 0)
+                pc = instr.a;
+            break;
+
+        case OpCode::jump_if_success:
+            if (status.exit_code == 0)
+                pc = instr.a;
+            break;
+
+        case OpCode::jump_if_interrupted:
+            if (status.signaled == SIGINT)
+                pc = instr.a;
+            break;
+        }
     }
 
-    return prev == TokenType::line_continuation || prev == TokenType::and_and ||
-           prev == TokenType::or_or || prev == TokenType::pipe;
+    return status;
+}
+
+void Executor::report_jobs() {
+    for (const JobId id : Waiter::update_status(this->jobs)) {
+        const Job *job = this->jobs.find(id);
+        if (job == nullptr || !job->completed())
+            continue;
+
+        std::println(stderr, "[{}] {}: Completed stats={:?}", id,
+                     job->job_master, job->exec_stats());
+        this->jobs.remove(id);
+    }
+}
+
+void Executor::wait_input() {
+    pollfd fds[] = {
+        {.fd = STDIN_FILENO, .events = POLLIN, .revents = 0},
+        {.fd = reactor().fd(), .events = POLLIN, .revents = 0},
+    };
+
+    for (;;) {
+        if (poll(fds, std::size(fds), -1) == -1) {
+            if (errno == EINTR)
+                continue;
+
+            // getline() blocks and reports the error
+            return;
+        }
+
+        if (fds[1].revents & POLLIN) {
+            reactor().poll(0);
+            this->report_jobs();
+        }
+
+        // Input, or the end of it
+        if (fds[0].revents != 0)
+            return;
+    }
 }
 
 bool Executor::read_stdin() {
+    // The terminal returns a line at a time, nothing is left buffered
+    if (this->shell.is_interactive)
+        this->wait_input();
+
     std::string new_line;
     std::getline(std::cin, new_line);
 
@@ -1011,58 +1824,188 @@ bool Executor::read_stdin() {
     }
 
     new_line += "\n";
-    this->input_buffer.emplace_back(std::move(new_line));
+    this->lexer.feed(new_line);
 
     return true;
 }
 
-std::vector<std::string> Executor::process_input() {
-    // Create a support buffer where the line_continuations are cut
-    // and the subsequent lines are pasted togheter
-    std::vector<std::string> support;
+ExecStats Executor::run_commands(CommandStream &commands, ExecStats status) {
+    for (;;) {
+        const size_t allocations = this->ast.allocations();
+        const auto program = commands.next();
+
+        stats().ast_nodes += this->ast.size();
+        stats().ast_allocations += this->ast.allocations() - allocations;
 
-    // TODO: move in its own logic
-    for (const auto &line : this->input_buffer) {
-        if (support.empty()) {
-            support.emplace_back(line);
-            continue;
+        // Like the other shells, exit with 2 on a syntax error
+        if (!program.has_value()) {
+            status = ExecStats{.exit_code = 2, .completed = true};
+            break;
+        }
+
+        if (program->child.empty())
+            break;
+
+        if (debug_dumps()) {
+            std::println(stderr, "=== SYNTAX TREE ===");
+            std::println(stderr, "{:#?}", InAst{this->ast, *program});
+        }
+
+        lower(*program, this->ast, this->bytecode);
+        stats().instructions += this->bytecode.size();
+
+        // The code does not refer to the nodes, drop them before running it
+        this->ast.clear();
+
+        if (debug_dumps()) {
+            std::println(stderr, "=== BYTECODE ===");
+            for (size_t pc = 0; pc < this->bytecode.size(); ++pc)
+                std::println(stderr, "{}: {:?}", pc, this->bytecode.code[pc]);
+
+            std::println(stderr, "=== COMMAND BEGIN ===");
         }
 
-        std::string &last = support.back();
-        std::string end = last.substr(std::max<size_t>(0, last.size() - 2));
+        status = this->run(this->bytecode, 0, {});
 
-        if (end == "\\\n")
-            last = last.substr(0, last.size() - 2) + line;
-        else
-            support.emplace_back(line);
+        this->bytecode.clear();
+        this->scratch.clear();
     }
 
-    return support;
+    // Nodes of a command that could not be parsed
+    this->ast.clear();
+    this->scratch.clear();
+
+    return status;
 }
 
-ExecStats Executor::execute() {
-    auto support = this->process_input();
+ExecStats Executor::run_until_lex_error(std::span<const Token> tokens,
+                                        ExecStats status) {
+    size_t lines = tokens.size();
+    while (lines > 0 && tokens[lines - 1].type != TokenType::new_line)
+        --lines;
+
+    std::vector<Token> head{tokens.begin(), tokens.begin() + lines};
+    head.push_back(Token{
+        .type = TokenType::eof,
+        .offset = lines > 0 ? static_cast<uint32_t>(tokens[lines - 1].end())
+                            : 0,
+    });
+
+    // A command that goes on in the line that could not be lexed is cut,
+    // the error is the one of the lexer
+    CommandStream commands{head, this->lexer.input(), this->ast, true};
+    status = this->run_commands(commands, status);
+    if (commands.failed())
+        return status;
+
+    // The parser reports where the lexing stopped
+    Parser parser{tokens, this->lexer.input(), this->ast};
+    parser.next_command();
+    std::println(stderr, "testsh: {}", parser.error_message());
+
+    this->ast.clear();
+    return ExecStats{.exit_code = 2, .completed = true};
+}
 
-    Tokenizer tokenizer{support};
-    SyntaxTree<Tokenizer> tree;
+ExecStats Executor::execute() {
+    // The input was already lexed line by line while it was read
+    const auto tokens = this->lexer.finish();
+    stats().input_bytes += this->lexer.input().size();
 
     // TODO: modify this
-    if (tokenizer.next_is_eof())
+    if (!tokens.empty() && tokens.front().type == TokenType::eof)
         return {};
 
-    const auto program = tree.program(tokenizer);
+    CommandStream commands{tokens, this->lexer.input(), this->ast};
 
-    if (!program.has_value())
-        throw std::runtime_error("Parsing failed!");
+    return this->run_commands(commands);
+}
 
-    std::println(stderr, "=== SYNTAX TREE ===");
-    std::println(stderr, "{:#?}", *program);
+/**
+ * Returns the end of the last line of `text` that the lexer can split at, or
+ * 0 if there is none. See next_safe_line().
+ */
+static size_t last_safe_line(std::string_view text) {
+    size_t newline = text.rfind('\n');
 
-    std::println(stderr, "=== COMMAND BEGIN ===");
+    while (newline != std::string_view::npos && newline > 0 &&
+           text[newline - 1] == '\\') {
+        newline = text.rfind('\n', newline - 1);
+    }
+
+    return newline == std::string_view::npos ? 0 : newline + 1;
+}
 
-    const auto retval = this->program(*program);
+ExecStats Executor::script(std::istream &input) {
+    ExecStats status{};
+    // Lines read but not run yet: the ones of the command cut by the end of
+    // the last chunk, followed by the ones that were not lexed
+    std::string lines{};
+    size_t cut_size = 0;
 
-    return retval;
+    for (;;) {
+        // A cut command is lexed again with at least as many new lines, so
+        // that a command spanning many chunks is lexed O(1) times
+        size_t target = std::max(script_chunk_size(), 2 * cut_size);
+        size_t end = 0;
+
+        for (;;) {
+            if (lines.size() < target) {
+                const size_t size = lines.size();
+                lines.resize(target);
+                input.read(lines.data() + size, target - size);
+                lines.resize(size + input.gcount());
+                stats().input_bytes += input.gcount();
+            }
+
+            end = input ? last_safe_line(lines) : lines.size();
+
+            // Lex at least one line after the cut command
+            if (end > cut_size || !input)
+                break;
+
+            target = 2 * std::max(target, lines.size());
+        }
+
+        const bool last = !input;
+
+        lex_script(std::string_view{lines}.substr(0, end), this->lexer,
+                   lex_threads());
+
+        const auto tokens = this->lexer.finish();
+
+        // Nothing after a line that cannot be lexed runs, the lines before
+        // it do, whatever the chunk it is in
+        if (this->lexer.has_failed()) {
+            status = this->run_until_lex_error(tokens, status);
+            this->lexer.reset();
+            break;
+        }
+
+        CommandStream commands{tokens, this->lexer.input(), this->ast, !last};
+
+        status = this->run_commands(commands, status);
+
+        if (commands.failed() || last) {
+            this->lexer.reset();
+            break;
+        }
+
+        std::string rest = commands.cut()
+                               .transform([&](uint32_t begin) {
+                                   return std::string{
+                                       this->lexer.input().substr(begin)};
+                               })
+                               .value_or("");
+
+        cut_size = rest.size();
+        rest.append(lines, end);
+        lines = std::move(rest);
+
+        this->lexer.reset();
+    }
+
+    return status;
 }
 
 TerminalState Executor::update() {
@@ -1073,12 +2016,12 @@ TerminalState Executor::update() {
         };
     }
 
-    if (this->line_has_continuation()) {
+    if (this->lexer.needs_more()) {
         return {.needs_more = true};
     }
 
     const auto exec_stats = this->execute();
-    this->input_buffer.clear();
+    this->lexer.reset();
 
     return {
         .exit_code = exec_stats.exit_code,
@@ -1100,21 +2043,9 @@ void Executor::loop() {
             if (state.needs_more) {
                 std::print("> ");
             } else {
-                // TODO: move from here
-                for (auto &job : this->bg_jobs) {
-                    Waiter::update_status(job);
-
-                    if (job.completed()) {
-                        std::println(stderr, "{}: Completed stats={:?}",
-                                     job.job_master, job.exec_stats());
-                    }
-                }
-
-                /* Remove completed jobs */
-                this->bg_jobs = this->bg_jobs | vw::filter([](const auto &job) {
-                                    return !job.completed();
-                                }) |
-                                std::ranges::to<std::vector>();
+                // Collect what changed while the last command ran
+                reactor().poll(0);
+                this->report_jobs();
 
                 std::print("$ ");
             }
@@ -1,11 +1,21 @@
 #ifndef TESTSH_EXECUTOR_H
 #define TESTSH_EXECUTOR_H
 
+#include "arena.h"
+#include "bytecode.h"
+#include "command_hash.h"
+#include "exec_prog.h"
 #include "job.h"
+#include "parser.h"
 #include "shell.h"
 #include "syntax.h"
 #include "util.h"
+#include <cstddef>
 #include <format>
+#include <istream>
+#include <limits>
+#include <span>
+#include <string>
 #include <string_view>
 #include <tuple>
 #include <vector>
@@ -30,51 +40,160 @@ struct CommandState {
     bool inside_pipeline = false;
     // TODO: modify to optional?
     int pipeline_pgid = -1;
+    // The command is the last thing a child shell runs: an external
+    // program is executed in place of the child shell, without a fork
+    bool exec_in_place = false;
 
     bool initialized() const { return !redirects.empty(); }
 };
 
-struct ListStats {
-    ExecStats last_stats;
-    std::vector<Job> bg_jobs;
-};
+struct Builtin;
+
+/**
+ * Reads TESTSH_SUBSHELL: `virtual` (the default) runs the subshells whose
+ * commands do not need a child in the shell itself, `fork` always forks
+ * them.
+ */
+bool virtual_subshells_from_env();
+
+/**
+ * Reads TESTSH_RELAY: `splice` runs the `cat` commands of the pipelines as
+ * relays of the shell that move the data with splice(), `exec` (the
+ * default) executes them as any other program.
+ */
+bool splice_relay_from_env();
 
 struct Executor {
-    std::vector<std::string> input_buffer{};
+    IncrementalLexer lexer{};
+    // Text of the expanded words of the command being executed
+    ScratchArena scratch{};
+    // Nodes of the command being executed
+    Ast ast{};
+    // Code of the command being executed, lowered from the ast
+    Bytecode bytecode{};
+    // argv and envp of the program being spawned
+    Exec exec_image{};
+    // Programs found in the PATH
+    CommandHash command_hash{};
     Shell shell{};
-    std::vector<Job> bg_jobs{};
+    // Jobs in background or stopped, addressed as `%n` by the builtins
+    JobTable jobs{};
+    // Subshells and command substitutions can run in the shell itself
+    bool virtual_subshells = virtual_subshells_from_env();
+    // The `cat` commands of the pipelines run as splice() relays
+    bool splice_relay = splice_relay_from_env();
+    // TESTSH_PIPE_SIZE last read by pipe_size() and the capacity it gives
+    std::string pipe_size_value{};
+    int pipe_capacity = 0;
     // TerminalState terminal_state;
 
-    std::optional<ExecStats> builtin(const SimpleCommand &cmd);
+    ExecStats builtin(const Builtin &builtin, const SimpleCommand &cmd);
     ExecStats simple_command(const SimpleCommand &cmd,
                              const CommandState &state);
-    std::string cmdsub(const CmdSub &sub, const CommandState &state);
-    std::string varsub(const VarSub &sub, const CommandState &state);
-    std::string substitution(const Substitution &sub,
-                             const CommandState &state);
-    ExecStats unsub_command(const UnsubCommand &cmd, const CommandState &state);
-    ExecStats simple_assignment(const SimpleAssignment &assign,
+
+    /**
+     * Runs `command` once for every item of `items`, with at most `limit`
+     * of them at the same time: the next one starts as soon as one
+     * terminates. `{}` in the words of `command` is replaced by the item,
+     * which is the last argument when there is no `{}`. The prefix
+     * assignments of `command` are given to every one of them. Returns the
+     * number of commands that failed, up to 101.
+     *
+     * The commands are one job: when one of them is stopped, the ones
+     * running are added to the jobs as stopped, the items left are not run
+     * and 128 + SIGTSTP is returned.
+     */
+    int parallel(const SimpleCommand &command,
+                 std::span<const std::string_view> items, size_t limit);
+
+    /**
+     * Runs the code of a command substitution, from `body` up to `end`, and
+     * returns its output without the newlines at the end.
+     */
+    std::string cmdsub(const Bytecode &bytecode, size_t body, size_t end,
+                       const CommandState &state);
+
+    /**
+     * Capacity of the pipes created now, in bytes, from the TESTSH_PIPE_SIZE
+     * variable of the shell: set in the environment it applies to the whole
+     * shell, assigned before a pipeline it applies to the pipelines that
+     * follow. A prefix assignment (`TESTSH_PIPE_SIZE=n cmd | ...`) is not
+     * supported: it only goes to the environment of its command, the pipes
+     * are created before. Capped to /proc/sys/fs/pipe-max-size, 0 keeps the
+     * default of the kernel. The value is parsed again only when it changes.
+     */
+    int pipe_size();
+
+    std::string_view varsub(const Token &token);
+    ExecStats simple_assignment(std::span<const AssignmentWord> envs,
+                                std::span<const Redirect> redirections,
                                 const CommandState &state);
-    ExecStats and_list(const AndList &and_list, const CommandState &state);
-    ExecStats or_list(const OrList &or_list, const CommandState &state);
-    Job pipeline(const Pipeline &pipeline, const CommandState &state);
-    ExecStats wait_pipeline(const Pipeline &pipeline,
-                            const CommandState &state);
-    ExecStats op_list(const OpList &list, const CommandState &state);
-    ListStats sequential_list(const SequentialList &sequential_list,
-                              const CommandState &state);
-    ListStats async_list(const AsyncList &async_list,
-                         const CommandState &state);
-    ListStats list(const List &list, const CommandState &state);
-    ExecStats command(const Command &command, const CommandState &state);
-    ExecStats subshell(const Subshell &subshell, const CommandState &state);
-    ExecStats program(const ThisProgram &program);
-
-    bool line_has_continuation() const;
+    ExecStats wait_pipeline(Job &job, bool negated);
+    Job async_list(const Bytecode &bytecode, size_t body,
+                   const CommandState &state);
+    ExecStats subshell(const Bytecode &bytecode, size_t body, size_t end,
+                       std::span<const Redirect> redirections,
+                       const CommandState &state);
+
+    /**
+     * Checks if the code of a subshell, from `body` up to its `exit` at
+     * `end - 1`, can run in the shell itself: it only runs builtins that
+     * leave the process and the jobs alone.
+     */
+    bool runs_virtual(const Bytecode &bytecode, size_t body, size_t end);
+
+    /**
+     * Runs the code of a subshell in the shell itself, see runs_virtual().
+     * The variables and the working directory are restored afterwards.
+     */
+    ExecStats virtual_subshell(const Bytecode &bytecode, size_t body,
+                               size_t end, const CommandState &state);
+
+    /**
+     * Dispatch loop of the bytecode. Runs the code from `pc` to the end, or
+     * up to the `exit` that terminates the child running it, or up to `end`
+     * when the code of a child is run by the shell itself.
+     */
+    ExecStats run(const Bytecode &bytecode, size_t pc,
+                  const CommandState &state,
+                  size_t end = std::numeric_limits<size_t>::max());
+
+    /**
+     * Runs the commands of the stream one at a time, each one is parsed
+     * after the previous one has run. Returns the stats of the last command,
+     * or `status` if there is none.
+     */
+    ExecStats run_commands(CommandStream &commands, ExecStats status = {});
+
+    /**
+     * Runs the commands of the lines before the one that could not be
+     * lexed, then reports the error of the lexer as a syntax error.
+     * `tokens` are the ones of a lexer that failed.
+     */
+    ExecStats run_until_lex_error(std::span<const Token> tokens,
+                                  ExecStats status);
+
+    /**
+     * Reports the background jobs that completed, from the statuses already
+     * collected by the reactor, and removes them from the table.
+     */
+    void report_jobs();
+
+    /**
+     * Waits until the terminal has some input, reporting the background
+     * jobs as soon as they complete meanwhile.
+     */
+    void wait_input();
+
     bool read_stdin();
-    std::vector<std::string> process_input();
     ExecStats execute();
 
+    /**
+     * Runs a script, reading and lexing it a chunk at a time: the first
+     * commands run before the rest of the script is read.
+     */
+    ExecStats script(std::istream &input);
+
     TerminalState update();
     void loop();
 };
@@ -82,12 +201,20 @@ struct Executor {
 struct Waiter {
     const Shell &shell;
 
-    static void process_wstatus(Job &job, pid_t pid, int wstatus);
+    static void process_wstatus(ExecStats &stats, int wstatus);
     static Job wait_job(Job &&job);
     static void update_status(Job &job);
 
+    /**
+     * Gives the statuses collected by the reactor to the processes of the
+     * table and returns the ids of the jobs that changed, maybe more than
+     * once. Only the processes that changed are looked at.
+     */
+    static std::vector<JobId> update_status(JobTable &jobs);
+
     void wait(Job &job) const;
-    void wait_inside_async(Job &job) const;
+    // Waits until all the jobs complete, removing them from the table
+    void wait_inside_async(JobTable &jobs) const;
     void bg(Job &job) const;
     void fg(Job &job) const;
 };
@@ -122,6 +249,7 @@ struct std::formatter<CommandState, CharT> : debug_spec {
         this->field("is_foreground", c.is_foreground, ctx);
         this->field("inside_pipeline", c.inside_pipeline, ctx);
         this->field("pipeline_pgid", c.pipeline_pgid, ctx);
+        this->field("exec_in_place", c.exec_in_place, ctx);
         return this->finish(ctx);
     }
 };
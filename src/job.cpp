@@ -1,5 +1,7 @@
 #include "job.h"
 #include "shell.h"
+#include <algorithm>
+#include <functional>
 #include <optional>
 
 ExecStats ExecStats::ERROR = {
@@ -28,9 +30,50 @@ ExecStats ExecStats::shallow(pid_t pid) {
     return data;
 }
 
+// ------------------------------------
+// Processes
+// ------------------------------------
+
+void Processes::push_back(ExecStats &&stats) {
+    if (this->heap.empty() && this->size_ < inline_capacity) {
+        this->inline_[this->size_++] = std::move(stats);
+        return;
+    }
+
+    if (this->heap.empty()) {
+        this->heap.reserve(inline_capacity * 2);
+        this->heap.assign(this->inline_.begin(), this->inline_.end());
+    }
+
+    this->heap.push_back(std::move(stats));
+    ++this->size_;
+}
+
+ExecStats *Processes::find(pid_t pid) {
+    for (auto &process : *this) {
+        if (process.child_pid == pid)
+            return &process;
+    }
+
+    return nullptr;
+}
+
+const ExecStats *Processes::find(pid_t pid) const {
+    for (const auto &process : *this) {
+        if (process.child_pid == pid)
+            return &process;
+    }
+
+    return nullptr;
+}
+
+// ------------------------------------
+// Job
+// ------------------------------------
+
 bool Job::completed() const {
-    for (const auto &entry : this->jobs) {
-        if (!entry.second.completed)
+    for (const auto &process : this->processes) {
+        if (!process.completed)
             return false;
     }
 
@@ -38,8 +81,8 @@ bool Job::completed() const {
 }
 
 bool Job::stopped() const {
-    for (const auto &entry : this->jobs) {
-        if (!entry.second.completed && !entry.second.stopped)
+    for (const auto &process : this->processes) {
+        if (!process.completed && !process.stopped)
             return false;
     }
 
@@ -47,8 +90,8 @@ bool Job::stopped() const {
 }
 
 void Job::mark_running() {
-    for (auto &[_, prog] : this->jobs) {
-        prog.stopped = false;
+    for (auto &process : this->processes) {
+        process.stopped = false;
     }
 }
 
@@ -63,11 +106,17 @@ void Job::add(ExecStats &&stats) {
     if (this->pgid == 0 && stats.pipeline_pgid != -1)
         this->pgid = stats.pipeline_pgid;
 
-    this->jobs[stats.child_pid] = std::move(stats);
+    // The builtins run by the shell all have the pid of the shell
     this->job_master = stats.child_pid;
+    if (auto *process = this->processes.find(stats.child_pid))
+        *process = std::move(stats);
+    else
+        this->processes.push_back(std::move(stats));
 }
 
-ExecStats Job::exec_stats() const { return this->jobs.at(this->job_master); }
+ExecStats Job::exec_stats() const {
+    return *this->processes.find(this->job_master);
+}
 
 void Job::set_modes(const Shell &shell) {
     tcgetattr(shell.terminal, &tmodes);
@@ -88,3 +137,112 @@ void Job::restore_modes(const Shell &shell) {
         tmodes_init = true;
     }
 }
+
+// ------------------------------------
+// JobTable
+// ------------------------------------
+
+JobId JobTable::add(Job &&job) {
+    JobId id;
+
+    if (!this->free.empty()) {
+        std::ranges::pop_heap(this->free, std::greater{});
+        id = this->free.back();
+        this->free.pop_back();
+    } else {
+        this->slots.emplace_back();
+        id = static_cast<JobId>(this->slots.size());
+    }
+
+    Slot &slot = this->slot(id);
+    slot.job = std::move(job);
+    slot.prev = this->last;
+    slot.next = 0;
+
+    if (this->last != 0)
+        this->slot(this->last).next = id;
+    else
+        this->first = id;
+
+    this->last = id;
+    ++this->size_;
+
+    this->update(id);
+    return id;
+}
+
+void JobTable::remove(JobId id) {
+    Slot &slot = this->slot(id);
+
+    for (const auto &process : slot.job->processes) {
+        const auto it = this->pids.find(process.child_pid);
+        if (it != this->pids.end() && it->second.job == id)
+            this->pids.erase(it);
+    }
+
+    if (slot.prev != 0)
+        this->slot(slot.prev).next = slot.next;
+    else
+        this->first = slot.next;
+
+    if (slot.next != 0)
+        this->slot(slot.next).prev = slot.prev;
+    else
+        this->last = slot.prev;
+
+    slot.job.reset();
+    slot.prev = 0;
+    slot.next = 0;
+    --this->size_;
+
+    this->free.push_back(id);
+    std::ranges::push_heap(this->free, std::greater{});
+}
+
+void JobTable::clear() {
+    this->slots.clear();
+    this->free.clear();
+    this->pids.clear();
+    this->first = 0;
+    this->last = 0;
+    this->size_ = 0;
+}
+
+Job *JobTable::find(JobId id) {
+    if (id == 0 || id > this->slots.size() || !this->slot(id).job)
+        return nullptr;
+
+    return &*this->slot(id).job;
+}
+
+const Job *JobTable::find(JobId id) const {
+    if (id == 0 || id > this->slots.size() || !this->slot(id).job)
+        return nullptr;
+
+    return &*this->slot(id).job;
+}
+
+std::optional<JobTable::ProcessRef> JobTable::process(pid_t pid) const {
+    const auto it = this->pids.find(pid);
+    if (it == this->pids.end())
+        return std::nullopt;
+
+    return it->second;
+}
+
+void JobTable::update(JobId id) {
+    const Processes &processes = this->slot(id).job->processes;
+
+    for (uint32_t index = 0; index < processes.size(); ++index) {
+        const ExecStats &process = processes[index];
+
+        if (!process.completed) {
+            this->pids[process.child_pid] = {.job = id, .index = index};
+            continue;
+        }
+
+        const auto it = this->pids.find(process.child_pid);
+        if (it != this->pids.end() && it->second.job == id)
+            this->pids.erase(it);
+    }
+}
@@ -3,11 +3,15 @@
 
 #include "shell.h"
 #include "util.h"
+#include <array>
+#include <cstddef>
+#include <cstdint>
 #include <format>
 #include <optional>
 #include <sys/types.h>
 #include <termios.h>
 #include <unordered_map>
+#include <vector>
 
 // TODO: rename as command (?)
 struct ExecStats {
@@ -25,6 +29,44 @@ struct ExecStats {
     static ExecStats shallow(pid_t pid);
 };
 
+/**
+ * The processes of a job, in the order they were added. A pipeline has a
+ * few of them: they are stored inside the Job, the heap is only used by
+ * pipelines longer than `inline_capacity`.
+ */
+class Processes {
+    static constexpr size_t inline_capacity = 4;
+
+    std::array<ExecStats, inline_capacity> inline_{};
+    // All the processes, once there are more than inline_capacity
+    std::vector<ExecStats> heap{};
+    size_t size_ = 0;
+
+  public:
+    ExecStats *begin() {
+        return this->heap.empty() ? this->inline_.data() : this->heap.data();
+    }
+    ExecStats *end() { return this->begin() + this->size_; }
+    const ExecStats *begin() const {
+        return this->heap.empty() ? this->inline_.data() : this->heap.data();
+    }
+    const ExecStats *end() const { return this->begin() + this->size_; }
+
+    ExecStats &operator[](size_t index) { return this->begin()[index]; }
+    const ExecStats &operator[](size_t index) const {
+        return this->begin()[index];
+    }
+
+    size_t size() const { return this->size_; }
+    bool empty() const { return this->size_ == 0; }
+
+    void push_back(ExecStats &&stats);
+
+    // Returns the process `pid`, or nullptr
+    ExecStats *find(pid_t pid);
+    const ExecStats *find(pid_t pid) const;
+};
+
 /**
  * This struct represent an instance of a job, composed of many processes.
  *
@@ -34,7 +76,7 @@ struct ExecStats {
  */
 struct Job {
     pid_t pgid;
-    std::unordered_map<pid_t, ExecStats> jobs;
+    Processes processes;
     pid_t job_master;
     termios tmodes;
     bool tmodes_init = false;
@@ -61,6 +103,80 @@ struct Job {
     void restore_modes(const Shell &shell);
 };
 
+// Number of a job in the JobTable, the `n` of `%n`. 0 is no job.
+using JobId = uint32_t;
+
+/**
+ * The jobs of the shell that are not waited in foreground: the async lists
+ * and the stopped pipelines.
+ *
+ * A slot map: a job keeps its id, and its slot, until it is removed, then
+ * the smallest free id is given to the next job. The jobs are linked in the
+ * order they were added, the last one is the current job. The processes
+ * not completed are indexed by pid, so a status reaches its process without
+ * looking at the other jobs.
+ */
+class JobTable {
+  public:
+    // Where a process is: its job and its index in the Processes of the job
+    struct ProcessRef {
+        JobId job;
+        uint32_t index;
+    };
+
+  private:
+    struct Slot {
+        std::optional<Job> job{};
+        // Previous and next job in the order they were added, 0 if none
+        JobId prev = 0;
+        JobId next = 0;
+    };
+
+    std::vector<Slot> slots{};
+    // Ids of the empty slots, as a min heap
+    std::vector<JobId> free{};
+    std::unordered_map<pid_t, ProcessRef> pids{};
+    JobId first = 0;
+    JobId last = 0;
+    size_t size_ = 0;
+
+    Slot &slot(JobId id) { return this->slots[id - 1]; }
+    const Slot &slot(JobId id) const { return this->slots[id - 1]; }
+
+  public:
+    // Adds a job and returns its id
+    JobId add(Job &&job);
+
+    void remove(JobId id);
+
+    void clear();
+
+    // Returns the job `id`, or nullptr
+    Job *find(JobId id);
+    const Job *find(JobId id) const;
+
+    // Returns where the process `pid` is, if it is not completed
+    std::optional<ProcessRef> process(pid_t pid) const;
+
+    /**
+     * Indexes the processes of the job `id` again, after they changed: the
+     * completed ones are no longer found by pid.
+     */
+    void update(JobId id);
+
+    // The last job added, 0 if there are none
+    JobId current() const { return this->last; }
+
+    size_t size() const { return this->size_; }
+    bool empty() const { return this->size_ == 0; }
+
+    // Calls `fn(id, job)` for every job, in the order they were added
+    template <typename Fn> void for_each(Fn &&fn) const {
+        for (JobId id = this->first; id != 0; id = this->slot(id).next)
+            fn(id, *this->slot(id).job);
+    }
+};
+
 // -------------------------------------
 // Format
 // -------------------------------------
@@ -81,8 +197,8 @@ template <> struct std::formatter<ExecStats> : debug_spec {
 template <> struct std::formatter<Job> : debug_spec {
     auto format(const Job &j, auto &ctx) const {
         std::vector<ExecStats> jobs;
-        for (const auto &[key, value] : j.jobs) {
-            jobs.emplace_back(value);
+        for (const auto &process : j.processes) {
+            jobs.emplace_back(process);
         }
 
         this->start<Job>(ctx);
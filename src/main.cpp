@@ -1,4 +1,8 @@
 #include "executor.h"
+#include "stats.h"
+#include <cerrno>
+#include <cstring>
+#include <fstream>
 #include <print>
 #include <sys/wait.h>
 #include <unistd.h>
@@ -12,7 +16,24 @@ static void loop(void) {
     executor.loop();
 }
 
-int main() {
+static int run_script(const char *path) {
+    std::ifstream file{path, std::ios::binary};
+    if (!file) {
+        std::println(stderr, "testsh: {}: {}", path, std::strerror(errno));
+        return 127;
+    }
+
+    Executor executor{};
+
+    return executor.script(file).exit_code;
+}
+
+int main(int argc, char *argv[]) {
+    Stats::init();
+
+    if (argc > 1)
+        return run_script(argv[1]);
+
     loop();
 
     return 0;
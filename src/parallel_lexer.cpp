@@ -0,0 +1,194 @@
+#include "parallel_lexer.h"
+#include "stats.h"
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <cstdlib>
+#include <exception>
+#include <memory>
+#include <print>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// Below this size a chunk is not worth a thread
+static constexpr size_t min_chunk_size = size_t{256} << 10;
+
+// More chunks than threads, so that a slow chunk does not stall the others
+static constexpr size_t chunks_per_thread = 4;
+
+size_t lex_threads() {
+    static const size_t threads = [] {
+        const long online = sysconf(_SC_NPROCESSORS_ONLN);
+        const size_t fallback = online > 0 ? static_cast<size_t>(online) : 1;
+
+        const char *env = std::getenv("TESTSH_LEX_THREADS");
+        if (env == nullptr)
+            return fallback;
+
+        const std::string_view value{env};
+        size_t threads = 0;
+
+        const auto [ptr, ec] =
+            std::from_chars(value.data(), value.data() + value.size(), threads);
+        if (ec != std::errc{} || ptr != value.data() + value.size() ||
+            threads == 0) {
+            std::println(stderr,
+                         "testsh: invalid TESTSH_LEX_THREADS={}, using {}",
+                         value, fallback);
+            return fallback;
+        }
+
+        return threads;
+    }();
+
+    return threads;
+}
+
+/**
+ * Feeds the lines of `text` in groups: feed() accepts many lines at once, as
+ * long as only the last one ends with a line continuation.
+ */
+static void feed_lines(std::string_view text, IncrementalLexer &lexer) {
+    while (!text.empty()) {
+        const auto continuation = text.find("\\\n");
+        const size_t end = continuation == std::string_view::npos
+                               ? text.size()
+                               : continuation + 2;
+
+        lexer.feed(text.substr(0, end));
+        text.remove_prefix(end);
+    }
+}
+
+size_t next_safe_line(std::string_view script, size_t from) {
+    for (;;) {
+        const size_t newline = script.find('\n', from);
+        if (newline == std::string_view::npos)
+            return script.size();
+
+        if (newline == 0 || script[newline - 1] != '\\')
+            return newline + 1;
+
+        from = newline + 1;
+    }
+}
+
+static void lex_parallel(std::string_view script, IncrementalLexer &lexer,
+                         size_t threads, size_t chunk_count) {
+    ScopedTimer timer{stats().lex_time};
+
+    std::vector<std::string_view> chunks{};
+    chunks.reserve(chunk_count);
+
+    size_t begin = 0;
+    for (size_t i = 1; i < chunk_count; ++i) {
+        const size_t target = i * (script.size() / chunk_count);
+        const size_t end = next_safe_line(script, std::max(begin, target));
+
+        chunks.push_back(script.substr(begin, end - begin));
+        begin = end;
+    }
+    chunks.push_back(script.substr(begin));
+
+    // Lexed by `lexer`, between two of its marks
+    struct LexedChunk {
+        size_t lexer = 0;
+        LexerMark begin{};
+        LexerMark end{};
+        bool lexed = false;
+    };
+
+    // One lexer per thread, each one is fed all the chunks of its thread:
+    // a chunk begins at a safe line, the ones before it do not change its
+    // tokens
+    std::vector<std::unique_ptr<IncrementalLexer>> lexers(threads);
+    std::vector<LexedChunk> lexed(chunks.size());
+    std::vector<Stats> thread_stats(threads);
+    std::vector<std::exception_ptr> errors(threads);
+    std::atomic<size_t> next_chunk = 0;
+
+    const auto worker = [&](size_t id) {
+        try {
+            lexers[id] = std::make_unique<IncrementalLexer>();
+            IncrementalLexer &thread_lexer = *lexers[id];
+
+            // The chunks of a thread come in order: past a failure they
+            // are fed by the sequential lexer
+            for (size_t i = next_chunk++;
+                 i < chunks.size() && !thread_lexer.has_failed();
+                 i = next_chunk++) {
+                const LexerMark begin = thread_lexer.mark();
+                feed_lines(chunks[i], thread_lexer);
+
+                lexed[i] = LexedChunk{
+                    .lexer = id,
+                    .begin = begin,
+                    .end = thread_lexer.mark(),
+                    .lexed = true,
+                };
+            }
+        } catch (...) {
+            errors[id] = std::current_exception();
+        }
+
+        // The counters of the lexer are local to each thread
+        thread_stats[id] = stats();
+    };
+
+    {
+        std::vector<std::jthread> pool{};
+        pool.reserve(threads);
+
+        for (size_t id = 0; id < threads; ++id)
+            pool.emplace_back(worker, id);
+    }
+
+    for (const auto &counters : thread_stats)
+        stats().add_counters(counters);
+
+    for (const auto &error : errors) {
+        if (error)
+            std::rethrow_exception(error);
+    }
+
+    stats().lex_chunks += chunks.size();
+
+    // Stitch the chunks back together
+    for (size_t i = 0; i < chunks.size(); ++i) {
+        const LexedChunk &chunk = lexed[i];
+
+        // Past a failure the sequential lexer only appends the input
+        if (lexer.has_failed()) {
+            lexer.feed(chunks[i]);
+            continue;
+        }
+
+        assertm(chunk.lexed, "Only the chunks after a failure are skipped");
+        lexer.append(*lexers[chunk.lexer], chunk.begin, chunk.end);
+    }
+}
+
+void lex_script(std::string_view script, IncrementalLexer &lexer,
+                size_t threads) {
+    // Every line is fed with its newline, the last one might miss it
+    // (npos + 1 wraps to 0 when there is no newline at all)
+    const size_t body_size = script.rfind('\n') + 1;
+    const std::string_view body = script.substr(0, body_size);
+    const std::string_view last_line = script.substr(body_size);
+
+    const size_t chunk_count =
+        std::min(threads * chunks_per_thread, body.size() / min_chunk_size);
+
+    if (threads > 1 && chunk_count > 1)
+        lex_parallel(body, lexer, threads, chunk_count);
+    else
+        feed_lines(body, lexer);
+
+    if (!last_line.empty()) {
+        std::string line{last_line};
+        line += "\n";
+        lexer.feed(line);
+    }
+}
@@ -0,0 +1,37 @@
+#ifndef TESTSH_PARALLEL_LEXER_H
+#define TESTSH_PARALLEL_LEXER_H
+
+#include "tokenizer.h"
+#include <cstddef>
+#include <string_view>
+
+/**
+ * Number of threads used to lex a script, read from the TESTSH_LEX_THREADS
+ * environment variable. Defaults to the number of online CPUs.
+ */
+size_t lex_threads();
+
+/**
+ * Returns the offset of the first line beginning at or after `from` that
+ * can be lexed without knowing the lines before it, or the size of the
+ * script if there is none.
+ *
+ * A line is not safe if the previous one ends with a backslash, which
+ * might be a line continuation. Quotes do not need to be tracked: a quoted
+ * word never spans lines, the lexer fails on an unterminated quote before
+ * reaching the next line.
+ */
+size_t next_safe_line(std::string_view script, size_t from);
+
+/**
+ * Lexes a whole script into `lexer`, which must be empty.
+ *
+ * Large scripts are split in chunks at safe newlines, the chunks are lexed
+ * by `threads` threads and stitched back together. The input and the tokens
+ * are byte-for-byte the ones produced by feeding the lines of the script
+ * one by one.
+ */
+void lex_script(std::string_view script, IncrementalLexer &lexer,
+                size_t threads);
+
+#endif // TESTSH_PARALLEL_LEXER_H
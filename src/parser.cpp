@@ -0,0 +1,990 @@
+#include "parser.h"
+#include "stats.h"
+#include "util.h"
+#include <algorithm>
+#include <cstdlib>
+#include <format>
+#include <print>
+#include <unistd.h>
+
+// ------------------------------------
+// First sets
+// ------------------------------------
+
+static bool starts_word(const TokenType type) {
+    return type == TokenType::word || type == TokenType::quoted_word ||
+           type == TokenType::doll_word || type == TokenType::andopen;
+}
+
+static bool is_redirect_op(const TokenType type) {
+    return type == TokenType::less || type == TokenType::great ||
+           type == TokenType::dgreat || type == TokenType::lessgreat ||
+           type == TokenType::lessand || type == TokenType::greatand;
+}
+
+static bool starts_redirect(const TokenType type) {
+    return type == TokenType::io_number || is_redirect_op(type);
+}
+
+static bool starts_command(const TokenType type) {
+    return starts_word(type) || starts_redirect(type) ||
+           type == TokenType::open_round;
+}
+
+static bool starts_and_or(const TokenType type) {
+    return type == TokenType::bang || starts_command(type);
+}
+
+static bool is_separator_op(const TokenType type) {
+    return type == TokenType::andper || type == TokenType::semicolon;
+}
+
+// ------------------------------------
+// Parser
+// ------------------------------------
+
+Parser::Parser(std::span<const Token> tokens, std::string_view input,
+               Ast &ast)
+    : tokens(tokens), input(input), ast(ast) {}
+
+bool Parser::lexed() {
+    if (!this->tokens.empty() && this->tokens.back().type == TokenType::eof)
+        return true;
+
+    // The lexing failed: point the error right after the last valid token
+    const uint32_t end = this->tokens.empty()
+                             ? 0
+                             : static_cast<uint32_t>(this->tokens.back().end());
+    const size_t length = this->input.substr(end).find_first_of(" \n");
+
+    this->unexpected = Token{
+        .type = TokenType::word,
+        .offset = end,
+        .length =
+            static_cast<uint32_t>(std::min(length, this->input.size() - end)),
+    };
+
+    return false;
+}
+
+TokenType Parser::peek() const { return this->tokens[this->pos].type; }
+
+Token Parser::advance() {
+    const Token token = this->tokens[this->pos];
+
+    // Keep returning eof once the input is over
+    if (token.type != TokenType::eof)
+        ++this->pos;
+
+    return token;
+}
+
+bool Parser::accept(const TokenType type) {
+    if (this->peek() != type)
+        return false;
+
+    this->advance();
+    return true;
+}
+
+bool Parser::expect(const TokenType type) {
+    if (this->accept(type))
+        return true;
+
+    this->fail();
+    return false;
+}
+
+std::nullopt_t Parser::fail() {
+    // Report the first token that could not be parsed
+    if (!this->unexpected)
+        this->unexpected = this->tokens[this->pos];
+
+    return std::nullopt;
+}
+
+std::optional<Token> Parser::error() const { return this->unexpected; }
+
+uint32_t Parser::offset() const {
+    if (this->pos < this->tokens.size())
+        return this->tokens[this->pos].offset;
+
+    return static_cast<uint32_t>(this->input.size());
+}
+
+std::string Parser::error_message() const {
+    if (!this->unexpected)
+        return "no error";
+
+    switch (this->unexpected->type) {
+    case TokenType::eof:
+        return "syntax error: unexpected end of file";
+    case TokenType::new_line:
+        return "syntax error near unexpected token `newline'";
+    default:
+        return std::format("syntax error near unexpected token `{}'",
+                           this->unexpected->view(this->input));
+    }
+}
+
+/**
+ * BNF:
+ *
+ * ```
+ * program ::= linebreak
+ *           | linebreak complete_commands linebreak
+ *           ;
+ * ```
+ */
+std::optional<ThisProgram> Parser::program() {
+    if (!this->lexed())
+        return std::nullopt;
+
+    this->linebreak();
+
+    if (this->peek() == TokenType::eof)
+        return ThisProgram{};
+
+    auto complete_commands = this->complete_commands();
+    if (!complete_commands)
+        return std::nullopt;
+
+    this->linebreak();
+
+    if (!this->expect(TokenType::eof))
+        return std::nullopt;
+
+    return ThisProgram{
+        .child = std::move(*complete_commands),
+    };
+}
+
+std::optional<ThisProgram> Parser::next_command() {
+    if (!this->lexed())
+        return std::nullopt;
+
+    this->linebreak();
+
+    if (this->peek() == TokenType::eof)
+        return ThisProgram{};
+
+    auto complete_command = this->complete_command();
+    if (!complete_command)
+        return std::nullopt;
+
+    // The complete_commands are separated by newlines
+    if (!this->newline_list() && !this->expect(TokenType::eof))
+        return std::nullopt;
+
+    const std::span<const List> commands{&*complete_command, 1};
+
+    return ThisProgram{.child = this->ast.add_range(commands)};
+}
+
+/**
+ * BNF:
+ *
+ * ```
+ * complete_commands ::= complete_command
+ *                     | complete_commands newline_list complete_command
+ *                     ;
+ * ```
+ */
+std::optional<CompleteCommands> Parser::complete_commands() {
+    const size_t begin = this->ast.staged<List>();
+
+    for (;;) {
+        auto complete_command = this->complete_command();
+        if (!complete_command)
+            return std::nullopt;
+
+        this->ast.stage(std::move(*complete_command));
+
+        // The newlines might be the trailing linebreak of the program
+        if (!this->newline_list() || !starts_and_or(this->peek()))
+            break;
+    }
+
+    return this->ast.commit<List>(begin);
+}
+
+/**
+ * BNF:
+ *
+ * ```
+ * complete_command ::= list
+ *                    | list separator_op
+ *                    ;
+ * ```
+ *
+ * The trailing separator_op is consumed by list.
+ */
+std::optional<List> Parser::complete_command() { return this->list(); }
+
+/**
+ * BNF (left-factored, the separator that ends the list is consumed):
+ *
+ * ```
+ * list ::= and_or
+ *        | and_or separator_op
+ *        | and_or separator_op list
+ *        ;
+ * ```
+ */
+std::optional<List> Parser::list() {
+    const size_t begin = this->ast.staged<ListItem>();
+
+    for (;;) {
+        auto op_list = this->and_or();
+        if (!op_list)
+            return std::nullopt;
+
+        const TokenType sep = this->peek();
+        const bool has_sep = is_separator_op(sep);
+
+        // The separator tells how the and_or is executed
+        this->ast.stage(ListItem{
+            .op_list = *op_list,
+            .op = sep == TokenType::andper ? ListOp::async
+                                           : ListOp::sequential,
+        });
+
+        if (!has_sep)
+            break;
+
+        this->advance();
+
+        if (!starts_and_or(this->peek()))
+            break;
+    }
+
+    return List{.items = this->ast.commit<ListItem>(begin)};
+}
+
+/**
+ * BNF:
+ *
+ * ```
+ * and_or ::=                         pipeline
+ *          | and_or AND_IF linebreak pipeline
+ *          | and_or OR_IF  linebreak pipeline
+ *          ;
+ * ```
+ */
+std::optional<OpList> Parser::and_or() {
+    const size_t begin = this->ast.staged<AndOrItem>();
+    AndOrOp op = AndOrOp::first;
+
+    for (;;) {
+        auto pipeline = this->pipeline();
+        if (!pipeline)
+            return std::nullopt;
+
+        this->ast.stage(AndOrItem{.op = op, .pipeline = *pipeline});
+
+        const TokenType next = this->peek();
+        if (next == TokenType::and_and)
+            op = AndOrOp::and_if;
+        else if (next == TokenType::or_or)
+            op = AndOrOp::or_if;
+        else
+            break;
+
+        this->advance();
+        this->linebreak();
+    }
+
+    return OpList{.items = this->ast.commit<AndOrItem>(begin)};
+}
+
+/**
+ * BNF:
+ *
+ * ```
+ * pipeline ::=      pipe_sequence
+ *            | Bang pipe_sequence
+ *            ;
+ * ```
+ */
+std::optional<Pipeline> Parser::pipeline() {
+    const bool has_bang = this->accept(TokenType::bang);
+
+    auto pipe_sequence = this->pipe_sequence();
+    if (pipe_sequence)
+        pipe_sequence->negated = has_bang;
+
+    return pipe_sequence;
+}
+
+/**
+ * BNF:
+ *
+ * ```
+ * pipe_sequence ::=                             command
+ *                 | pipe_sequence '|' linebreak command
+ *                 ;
+ * ```
+ */
+std::optional<Pipeline> Parser::pipe_sequence() {
+    const size_t begin = this->ast.staged<Command>();
+
+    for (;;) {
+        auto command = this->command();
+        if (!command)
+            return std::nullopt;
+
+        this->ast.stage(std::move(*command));
+
+        if (!this->accept(TokenType::pipe))
+            break;
+
+        this->linebreak();
+    }
+
+    return Pipeline{.cmds = this->ast.commit<Command>(begin)};
+}
+
+/**
+ * BNF:
+ *
+ * ```
+ * command ::= simple_command
+ *           | compound_command
+ *           | compound_command redirect_list
+ *           ;
+ *
+ * redirect_list ::=               io_redirect
+ *                 | redirect_list io_redirect
+ *                 ;
+ * ```
+ *
+ * The only compound_command is the subshell.
+ */
+std::optional<Command> Parser::command() {
+    if (this->peek() != TokenType::open_round)
+        return this->simple_command();
+
+    auto subshell = this->subshell();
+    if (!subshell)
+        return std::nullopt;
+
+    const size_t begin = this->ast.staged<Redirect>();
+
+    while (starts_redirect(this->peek())) {
+        auto redirect = this->io_redirect();
+        if (!redirect)
+            return std::nullopt;
+
+        this->ast.stage(std::move(*redirect));
+    }
+
+    subshell->redirections = this->ast.commit<Redirect>(begin);
+
+    return *subshell;
+}
+
+/**
+ * BNF:
+ *
+ * ```
+ * subshell ::= '(' compound_list ')'
+ *            ;
+ * ```
+ */
+std::optional<Subshell> Parser::subshell() {
+    if (!this->expect(TokenType::open_round))
+        return std::nullopt;
+
+    auto compound_list = this->compound_list();
+    if (!compound_list)
+        return std::nullopt;
+
+    if (!this->expect(TokenType::close_round))
+        return std::nullopt;
+
+    return Subshell{
+        .seq_list = *compound_list,
+    };
+}
+
+/**
+ * BNF:
+ *
+ * ```
+ * cmd_substitution ::= ANDOPEN compound_list CLOSE_ROUND
+ *                    ;
+ * ```
+ */
+std::optional<CmdSub> Parser::cmdsub() {
+    if (!this->expect(TokenType::andopen))
+        return std::nullopt;
+
+    auto compound_list = this->compound_list();
+    if (!compound_list)
+        return std::nullopt;
+
+    if (!this->expect(TokenType::close_round))
+        return std::nullopt;
+
+    return CmdSub{
+        .seq_list = *compound_list,
+    };
+}
+
+/**
+ * BNF:
+ *
+ * ```
+ * compound_list ::= linebreak term
+ *                 | linebreak term separator
+ *                 ;
+ * ```
+ *
+ * The trailing separator is consumed by term.
+ */
+std::optional<List> Parser::compound_list() {
+    this->linebreak();
+
+    return this->term();
+}
+
+/**
+ * BNF (left-factored, the separator that ends the term is consumed):
+ *
+ * ```
+ * term ::= and_or
+ *        | and_or separator
+ *        | and_or separator term
+ *        ;
+ *
+ * separator ::= separator_op linebreak
+ *             | newline_list
+ *             ;
+ * ```
+ */
+std::optional<List> Parser::term() {
+    const size_t begin = this->ast.staged<ListItem>();
+
+    for (;;) {
+        auto op_list = this->and_or();
+        if (!op_list)
+            return std::nullopt;
+
+        const TokenType sep = this->peek();
+
+        // The separator tells how the and_or is executed
+        this->ast.stage(ListItem{
+            .op_list = *op_list,
+            .op = sep == TokenType::andper ? ListOp::async
+                                           : ListOp::sequential,
+        });
+
+        if (is_separator_op(sep)) {
+            this->advance();
+            this->linebreak();
+        } else if (!this->newline_list()) {
+            break;
+        }
+
+        if (!starts_and_or(this->peek()))
+            break;
+    }
+
+    return List{.items = this->ast.commit<ListItem>(begin)};
+}
+
+/**
+ * BNF:
+ *
+ * ```
+ * simple_command ::= cmd_prefix cmd_word cmd_suffix
+ *                  | cmd_prefix cmd_word
+ *                  | cmd_prefix
+ *                  | cmd_name cmd_suffix
+ *                  | cmd_name
+ *                  ;
+ *
+ * cmd_prefix     ::=            io_redirect
+ *                  | cmd_prefix io_redirect
+ *                  |            ASSIGNMENT_WORD
+ *                  | cmd_prefix ASSIGNMENT_WORD
+ *                  ;
+ *
+ * cmd_suffix     ::=            io_redirect
+ *                  | cmd_suffix io_redirect
+ *                  |            WORD
+ *                  | cmd_suffix WORD
+ *                  ;
+ * ```
+ *
+ * A WORD of the prefix with a `=` that is not its first character is an
+ * ASSIGNMENT_WORD.
+ */
+std::optional<Command> Parser::simple_command() {
+    const size_t redirects = this->ast.staged<Redirect>();
+    const size_t assignments = this->ast.staged<AssignmentWord>();
+
+    // cmd_prefix
+    for (;;) {
+        const TokenType next = this->peek();
+
+        if (next == TokenType::word) {
+            const Token word = this->tokens[this->pos];
+            const std::string_view text = word.view(this->input);
+            const auto eq_pos = text.find('=');
+
+            if (eq_pos == 0 || eq_pos == std::string_view::npos)
+                break;
+
+            this->advance();
+
+            this->ast.stage(AssignmentWord{
+                .whole = word,
+                .key = text.substr(0, eq_pos),
+                .value = text.substr(eq_pos + 1),
+            });
+        } else if (starts_redirect(next)) {
+            auto redirect = this->io_redirect();
+            if (!redirect)
+                return std::nullopt;
+
+            this->ast.stage(std::move(*redirect));
+        } else {
+            break;
+        }
+    }
+
+    // cmd_word or cmd_name
+    if (!starts_word(this->peek())) {
+        const bool has_prefix =
+            this->ast.staged<Redirect>() != redirects ||
+            this->ast.staged<AssignmentWord>() != assignments;
+        if (!has_prefix)
+            return this->fail();
+
+        return SimpleAssignment{
+            .redirections = this->ast.commit<Redirect>(redirects),
+            .envs = this->ast.commit<AssignmentWord>(assignments),
+        };
+    }
+
+    auto program = this->word();
+    if (!program)
+        return std::nullopt;
+
+    const size_t args = this->ast.staged<Word>();
+
+    // cmd_suffix
+    for (;;) {
+        const TokenType next = this->peek();
+
+        if (starts_word(next)) {
+            auto word = this->word();
+            if (!word)
+                return std::nullopt;
+
+            this->ast.stage(std::move(*word));
+        } else if (starts_redirect(next)) {
+            auto redirect = this->io_redirect();
+            if (!redirect)
+                return std::nullopt;
+
+            this->ast.stage(std::move(*redirect));
+        } else {
+            break;
+        }
+    }
+
+    return UnsubCommand{
+        .program = *program,
+        .arguments = this->ast.commit<Word>(args),
+        .redirections = this->ast.commit<Redirect>(redirects),
+        .envs = this->ast.commit<AssignmentWord>(assignments),
+    };
+}
+
+/**
+ * BNF:
+ *
+ * ```
+ * io_redirect ::=           io_file
+ *               | IO_NUMBER io_file
+ *               ;
+ *
+ * io_file     ::= '<'       filename
+ *               | LESSAND   filename
+ *               | '>'       filename
+ *               | GREATAND  filename
+ *               | DGREAT    filename
+ *               | LESSGREAT filename
+ *               ;
+ *
+ * filename    ::= WORD
+ *               ;
+ * ```
+ */
+std::optional<Redirect> Parser::io_redirect() {
+    std::optional<int> new_redirect_fd;
+
+    if (this->peek() == TokenType::io_number) {
+        const auto tmp_num = std::string(this->advance().view(this->input));
+        new_redirect_fd = std::atoi(tmp_num.c_str());
+    }
+
+    const TokenType op = this->peek();
+    if (!is_redirect_op(op))
+        return this->fail();
+
+    this->advance();
+
+    if (this->peek() != TokenType::word)
+        return this->fail();
+
+    const std::string_view filename = this->advance().view(this->input);
+
+    Redirect redirect;
+
+    switch (op) {
+    case TokenType::less:
+        redirect = FileRedirect{.redirect_fd = STDIN_FILENO,
+                                .file_kind = OpenKind::read,
+                                .filename = filename};
+        break;
+
+    case TokenType::great:
+        redirect = FileRedirect{.redirect_fd = STDOUT_FILENO,
+                                .file_kind = OpenKind::replace,
+                                .filename = filename};
+        break;
+
+    case TokenType::dgreat:
+        redirect = FileRedirect{.redirect_fd = STDOUT_FILENO,
+                                .file_kind = OpenKind::append,
+                                .filename = filename};
+        break;
+
+    case TokenType::lessgreat:
+        redirect = FileRedirect{.redirect_fd = STDIN_FILENO,
+                                .file_kind = OpenKind::rw,
+                                .filename = filename};
+        break;
+
+    case TokenType::lessand:
+        redirect = convert_and_redirect(STDIN_FILENO, filename);
+        break;
+
+    case TokenType::greatand:
+        redirect = convert_and_redirect(STDOUT_FILENO, filename);
+        break;
+
+    default:
+        std::unreachable();
+    }
+
+    // Replace fd if io_number is present
+    if (new_redirect_fd) {
+        std::visit(
+            overloads{
+                [&](FileRedirect &file) {
+                    file.redirect_fd = *new_redirect_fd;
+                },
+                [&](FdRedirect &fd) { fd.fd_to_replace = *new_redirect_fd; },
+                [&](CloseFd &close) { close.fd = *new_redirect_fd; },
+            },
+            redirect);
+    }
+
+    return redirect;
+}
+
+/**
+ * BNF:
+ *
+ * ```
+ * word ::= WORD
+ *        | QUOTED_WORD
+ *        | DOLL_WORD
+ *        | cmd_substitution
+ *        ;
+ * ```
+ */
+std::optional<Word> Parser::word() {
+    switch (this->peek()) {
+    case TokenType::word:
+    case TokenType::quoted_word:
+        return this->advance();
+
+    case TokenType::doll_word:
+        return VarSub{this->advance()};
+
+    case TokenType::andopen: {
+        auto cmdsub = this->cmdsub();
+        if (!cmdsub)
+            return std::nullopt;
+
+        return std::move(*cmdsub);
+    }
+
+    default:
+        return this->fail();
+    }
+}
+
+/**
+ * BNF:
+ *
+ * ```
+ * newline_list ::=              NEWLINE
+ *                | newline_list NEWLINE
+ *                ;
+ * ```
+ */
+bool Parser::newline_list() {
+    if (!this->accept(TokenType::new_line))
+        return false;
+
+    while (this->accept(TokenType::new_line)) {
+    }
+
+    return true;
+}
+
+/**
+ * BNF:
+ *
+ * ```
+ * linebreak ::= newline_list
+ *             | EMPTY
+ *             ;
+ * ```
+ */
+void Parser::linebreak() { this->newline_list(); }
+
+// ------------------------------------
+// Engines
+// ------------------------------------
+
+static ParserEngine engine_from_env() {
+    const char *name = std::getenv("TESTSH_PARSER");
+    if (name == nullptr)
+        return ParserEngine::predictive;
+
+    const std::string_view engine{name};
+
+    if (engine == "predictive")
+        return ParserEngine::predictive;
+    if (engine == "tree")
+        return ParserEngine::tree;
+    if (engine == "check")
+        return ParserEngine::check;
+
+    std::println(stderr, "testsh: unknown TESTSH_PARSER={}, using predictive",
+                 engine);
+    return ParserEngine::predictive;
+}
+
+static ParserEngine parser_engine() {
+    static const ParserEngine engine = engine_from_env();
+    return engine;
+}
+
+static std::optional<ThisProgram> parse_predictive(std::span<const Token> tokens,
+                                                   std::string_view input,
+                                                   Ast &ast) {
+    Parser parser{tokens, input, ast};
+
+    auto program = parser.program();
+    if (!program)
+        std::println(stderr, "testsh: {}", parser.error_message());
+
+    return program;
+}
+
+/**
+ * Parses with SyntaxTree. The second value is true if the whole input was
+ * parsed.
+ */
+static std::pair<std::optional<ThisProgram>, bool>
+parse_tree(std::span<const Token> tokens, std::string_view input, Ast &ast) {
+    TokenIter tokenizer{tokens, input};
+    SyntaxTree<TokenIter> tree{ast};
+
+    auto program = tree.program(tokenizer);
+    const bool complete = program && tokenizer.next_is_eof();
+
+    return {std::move(program), complete};
+}
+
+std::optional<ThisProgram> parse(std::span<const Token> tokens,
+                                 std::string_view input, Ast &ast) {
+    ScopedTimer timer{stats().parse_time};
+
+    switch (parser_engine()) {
+    case ParserEngine::predictive:
+        return parse_predictive(tokens, input, ast);
+
+    case ParserEngine::tree: {
+        auto [program, complete] = parse_tree(tokens, input, ast);
+        if (!program)
+            std::println(stderr, "testsh: syntax error");
+
+        return std::move(program);
+    }
+
+    case ParserEngine::check: {
+        Parser parser{tokens, input, ast};
+        auto predictive = parser.program();
+        auto [reference, complete] = parse_tree(tokens, input, ast);
+
+        const auto tree = [&](const ThisProgram &program) {
+            return std::format("{:?}", InAst{ast, program});
+        };
+
+        // SyntaxTree ignores what follows the longest prefix it can parse,
+        // the predictive parser must reject those inputs
+        const bool agree =
+            complete ? predictive && tree(*predictive) == tree(*reference)
+                     : !predictive;
+
+        if (!agree) {
+            std::println(stderr,
+                         "testsh: parser mismatch on \"{}\": predictive={} "
+                         "tree={}",
+                         input.substr(0, 64),
+                         predictive ? "parsed" : parser.error_message(),
+                         complete ? "parsed" : "rejected");
+            std::abort();
+        }
+
+        if (!predictive)
+            std::println(stderr, "testsh: {}", parser.error_message());
+
+        return predictive;
+    }
+    }
+
+    std::unreachable();
+}
+
+// ------------------------------------
+// CommandStream
+// ------------------------------------
+
+CommandStream::CommandStream(std::span<const Token> tokens,
+                             std::string_view input, Ast &ast, bool partial)
+    : input(input), ast(ast), partial(partial), parser(tokens, input, ast),
+      tokenizer(tokens, input) {}
+
+/**
+ * Parses the next complete_command with SyntaxTree. The second value is
+ * true if the command is followed by a newline or by the end of the input,
+ * like the ones of a whole program.
+ */
+std::pair<std::optional<ThisProgram>, bool> CommandStream::next_tree() {
+    const SyntaxTree<TokenIter> tree{this->ast};
+
+    if (this->tree_done)
+        return {ThisProgram{}, true};
+
+    tree.linebreak(this->tokenizer);
+
+    if (this->tokenizer.next_is_eof())
+        return {ThisProgram{}, true};
+
+    auto complete_command = tree.complete_command(this->tokenizer);
+    if (!complete_command)
+        return {std::nullopt, false};
+
+    const bool complete =
+        tree.newline_list(this->tokenizer) || this->tokenizer.next_is_eof();
+    this->tree_done = !complete;
+
+    const std::span<const List> commands{&*complete_command, 1};
+
+    return {ThisProgram{.child = this->ast.add_range(commands)}, complete};
+}
+
+std::optional<ThisProgram> CommandStream::end_at(const uint32_t offset) {
+    this->cut_offset = offset;
+    return ThisProgram{};
+}
+
+std::optional<ThisProgram> CommandStream::next() {
+    ScopedTimer timer{stats().parse_time};
+
+    const uint32_t offset = this->parser.offset();
+
+    // Only the predictive parser knows if the input ended too early
+    const auto cut_by_eof = [&] {
+        const auto error = this->parser.error();
+        return this->partial && error && error->type == TokenType::eof;
+    };
+
+    switch (parser_engine()) {
+    case ParserEngine::predictive: {
+        auto program = this->parser.next_command();
+        if (!program && cut_by_eof())
+            return this->end_at(offset);
+
+        if (!program) {
+            std::println(stderr, "testsh: {}", this->parser.error_message());
+            this->is_failed = true;
+        }
+
+        return program;
+    }
+
+    case ParserEngine::tree: {
+        const auto tree_offset =
+            this->tokenizer.peek()
+                .transform([](const Token &token) { return token.offset; })
+                .value_or(static_cast<uint32_t>(this->input.size()));
+
+        auto [program, complete] = this->next_tree();
+        if (this->partial && (!program || !complete))
+            return this->end_at(tree_offset);
+
+        if (!program) {
+            std::println(stderr, "testsh: syntax error");
+            this->is_failed = true;
+        }
+
+        return std::move(program);
+    }
+
+    case ParserEngine::check: {
+        auto predictive = this->parser.next_command();
+        auto [reference, complete] = this->next_tree();
+
+        if (!predictive && cut_by_eof())
+            return this->end_at(offset);
+
+        const auto tree = [&](const ThisProgram &program) {
+            return std::format("{:?}", InAst{this->ast, program});
+        };
+
+        const bool agree =
+            complete ? predictive && tree(*predictive) == tree(*reference)
+                     : !predictive;
+
+        if (!agree) {
+            std::println(stderr,
+                         "testsh: parser mismatch on \"{}\": predictive={} "
+                         "tree={}",
+                         this->input.substr(offset, 64),
+                         predictive ? "parsed" : this->parser.error_message(),
+                         complete ? "parsed" : "rejected");
+            std::abort();
+        }
+
+        if (!predictive) {
+            std::println(stderr, "testsh: {}", this->parser.error_message());
+            this->is_failed = true;
+        }
+
+        return predictive;
+    }
+    }
+
+    std::unreachable();
+}
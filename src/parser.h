@@ -0,0 +1,155 @@
+#ifndef TESTSH_PARSER_H
+#define TESTSH_PARSER_H
+
+#include "syntax.h"
+#include "tokenizer.h"
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+
+/**
+ * Predictive parser of the grammar implemented by SyntaxTree.
+ *
+ * Each production is selected by looking at the next token only: the
+ * grammar is left-factored so that a separator that ends a list is consumed
+ * with the list instead of being given back to the tokenizer. The tokens are
+ * read exactly once, nothing is copied and nothing is backtracked.
+ *
+ * The children of a node are staged in the Ast while they are parsed and
+ * committed together once the node is complete.
+ *
+ * When the next token cannot continue the input the parsing fails, and the
+ * token is available from error(). SyntaxTree instead stops at the longest
+ * prefix it can parse, so the two only agree on inputs that SyntaxTree
+ * parses up to the eof token.
+ */
+class Parser {
+    std::span<const Token> tokens;
+    std::string_view input;
+    // Storage of the parsed nodes
+    Ast &ast;
+    size_t pos = 0;
+    std::optional<Token> unexpected = std::nullopt;
+
+    bool lexed();
+    TokenType peek() const;
+    Token advance();
+    bool accept(TokenType type);
+    bool expect(TokenType type);
+    std::nullopt_t fail();
+
+  public:
+    Parser(std::span<const Token> tokens, std::string_view input, Ast &ast);
+
+    std::optional<ThisProgram> program();
+
+    /**
+     * Parses the next complete_command of the program, and the newlines
+     * around it, in a program of its own. The program is empty at the end
+     * of the input.
+     */
+    std::optional<ThisProgram> next_command();
+
+    /**
+     * Offset in the input of the next token.
+     */
+    uint32_t offset() const;
+
+    /**
+     * Token on which the parsing failed.
+     */
+    std::optional<Token> error() const;
+
+    /**
+     * Description of the syntax error, for the user.
+     */
+    std::string error_message() const;
+
+  private:
+    std::optional<CmdSub> cmdsub();
+    std::optional<CompleteCommands> complete_commands();
+    std::optional<List> complete_command();
+    std::optional<List> list();
+    std::optional<OpList> and_or();
+    std::optional<Pipeline> pipeline();
+    std::optional<Pipeline> pipe_sequence();
+    std::optional<Command> command();
+    std::optional<Subshell> subshell();
+    std::optional<List> compound_list();
+    std::optional<List> term();
+    std::optional<Command> simple_command();
+    std::optional<Redirect> io_redirect();
+    std::optional<Word> word();
+    bool newline_list();
+    void linebreak();
+};
+
+/**
+ * Parser used by the shell:
+ * - predictive: Parser (default)
+ * - tree: SyntaxTree, kept as the reference implementation
+ * - check: runs both parsers and fails if they ever disagree
+ *
+ * The parser is selected with the TESTSH_PARSER environment variable.
+ */
+enum class ParserEngine {
+    predictive,
+    tree,
+    check,
+};
+
+/**
+ * Parses a whole input with the selected engine, the nodes are stored in
+ * `ast`. On a syntax error the error is printed on stderr and std::nullopt
+ * is returned.
+ */
+std::optional<ThisProgram> parse(std::span<const Token> tokens,
+                                 std::string_view input, Ast &ast);
+
+/**
+ * Parses an input one complete_command at a time with the selected engine,
+ * so that the shell can run a command, and drop its nodes from the Ast,
+ * before the next one is parsed.
+ *
+ * A `partial` input is followed by more lines that are not lexed yet: a
+ * command cut by its end is not a syntax error, the stream ends before it
+ * and cut() tells where it begins.
+ */
+class CommandStream {
+    std::string_view input;
+    Ast &ast;
+    bool partial;
+    Parser parser;
+    TokenIter tokenizer;
+    std::optional<uint32_t> cut_offset = std::nullopt;
+    bool is_failed = false;
+    // SyntaxTree stops at the longest prefix it can parse
+    bool tree_done = false;
+
+    std::pair<std::optional<ThisProgram>, bool> next_tree();
+    std::optional<ThisProgram> end_at(uint32_t offset);
+
+  public:
+    CommandStream(std::span<const Token> tokens, std::string_view input,
+                  Ast &ast, bool partial = false);
+
+    /**
+     * Returns the next complete_command in a program of its own, or an
+     * empty program once the input is over. On a syntax error the error is
+     * printed on stderr and std::nullopt is returned.
+     */
+    std::optional<ThisProgram> next();
+
+    /**
+     * Offset in the input of the command cut by the end of a partial input.
+     */
+    std::optional<uint32_t> cut() const { return this->cut_offset; }
+
+    bool failed() const { return this->is_failed; }
+};
+
+#endif // TESTSH_PARSER_H
@@ -0,0 +1,213 @@
+#include "reactor.h"
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Tag of the signalfd in the epoll, the pidfds are tagged with their pid
+static constexpr uint64_t signal_tag = 0;
+
+// Set in the child of a fork(): the fds of the reactor belong to the parent
+static bool forked = false;
+
+static sigset_t sigchld_set() {
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGCHLD);
+    return set;
+}
+
+void block_sigchld(bool blocked) {
+    const sigset_t set = sigchld_set();
+    sigprocmask(blocked ? SIG_BLOCK : SIG_UNBLOCK, &set, nullptr);
+}
+
+Reactor::~Reactor() { this->release(); }
+
+void Reactor::init() {
+    if (forked) {
+        forked = false;
+        this->release();
+    }
+
+    if (this->epoll_fd != -1)
+        return;
+
+    static const bool atfork = [] {
+        pthread_atfork(nullptr, nullptr, [] { forked = true; });
+        return true;
+    }();
+    (void)atfork;
+
+    block_sigchld(true);
+
+    const sigset_t set = sigchld_set();
+    this->signal_fd = signalfd(-1, &set, SFD_NONBLOCK | SFD_CLOEXEC);
+    this->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+
+    if (this->signal_fd == -1 || this->epoll_fd == -1) {
+        std::perror("reactor");
+        exit(1);
+    }
+
+    epoll_event event{.events = EPOLLIN, .data = {.u64 = signal_tag}};
+    if (epoll_ctl(this->epoll_fd, EPOLL_CTL_ADD, this->signal_fd, &event) ==
+        -1) {
+        std::perror("epoll_ctl");
+        exit(1);
+    }
+}
+
+void Reactor::release() {
+    for (const auto &[_, pidfd] : this->children) {
+        if (pidfd != -1)
+            close(pidfd);
+    }
+
+    if (this->signal_fd != -1)
+        close(this->signal_fd);
+    if (this->epoll_fd != -1)
+        close(this->epoll_fd);
+
+    this->epoll_fd = -1;
+    this->signal_fd = -1;
+    this->children.clear();
+    this->statuses.clear();
+    this->unwatched = 0;
+}
+
+void Reactor::watch(pid_t pid) {
+    int pidfd = static_cast<int>(syscall(SYS_pidfd_open, pid, 0));
+
+    if (pidfd != -1) {
+        epoll_event event{
+            .events = EPOLLIN,
+            .data = {.u64 = static_cast<uint64_t>(pid)},
+        };
+
+        // The pidfd is readable once the child exits, even if it already
+        // did
+        if (epoll_ctl(this->epoll_fd, EPOLL_CTL_ADD, pidfd, &event) == -1) {
+            close(pidfd);
+            pidfd = -1;
+        }
+    }
+
+    // Kernels older than 5.3, or too many fds: the exit is found by the
+    // SIGCHLD
+    if (pidfd == -1)
+        ++this->unwatched;
+
+    this->children[pid] = pidfd;
+}
+
+void Reactor::dispatch(pid_t pid, int wstatus) {
+    this->statuses[pid].push_back(wstatus);
+    ++this->changes_;
+
+    if (WIFSTOPPED(wstatus))
+        return;
+
+    const auto child = this->children.find(pid);
+    if (child == this->children.end())
+        return;
+
+    // Closing the pidfd removes it from the epoll
+    if (child->second != -1)
+        close(child->second);
+    else
+        --this->unwatched;
+
+    this->children.erase(child);
+}
+
+void Reactor::reap(pid_t pid) {
+    int wstatus;
+    pid_t reaped;
+
+    do {
+        reaped = waitpid(pid, &wstatus, WNOHANG | WUNTRACED);
+    } while (reaped == -1 && errno == EINTR);
+
+    if (reaped > 0)
+        this->dispatch(reaped, wstatus);
+}
+
+void Reactor::reap_signaled() {
+    // Many SIGCHLD are merged in one, they only say that something changed
+    signalfd_siginfo info;
+    while (read(this->signal_fd, &info, sizeof(info)) > 0)
+        ;
+
+    // The children without a pidfd can only be found by reaping any child
+    if (this->unwatched != 0) {
+        for (;;) {
+            int wstatus;
+            const pid_t pid = waitpid(-1, &wstatus, WNOHANG | WUNTRACED);
+            if (pid <= 0)
+                return;
+
+            this->dispatch(pid, wstatus);
+        }
+    }
+
+    // Only the stops, the exits are reported by the pidfds
+    for (;;) {
+        siginfo_t child{};
+        if (waitid(P_ALL, 0, &child, WSTOPPED | WNOHANG) == -1 ||
+            child.si_pid == 0)
+            return;
+
+        this->dispatch(child.si_pid, W_STOPCODE(child.si_status));
+    }
+}
+
+void Reactor::poll(int timeout) {
+    epoll_event events[64];
+
+    const int ready = epoll_wait(this->epoll_fd, events, 64, timeout);
+
+    for (int i = 0; i < ready; ++i) {
+        const uint64_t tag = events[i].data.u64;
+
+        if (tag == signal_tag)
+            this->reap_signaled();
+        else
+            this->reap(static_cast<pid_t>(tag));
+    }
+}
+
+std::optional<int> Reactor::take(pid_t pid) {
+    const auto it = this->statuses.find(pid);
+    if (it == this->statuses.end())
+        return std::nullopt;
+
+    const int wstatus = it->second.front();
+    it->second.erase(it->second.begin());
+
+    if (it->second.empty())
+        this->statuses.erase(it);
+
+    return wstatus;
+}
+
+std::vector<pid_t> Reactor::pending() const {
+    std::vector<pid_t> pids{};
+
+    for (const auto &[pid, _] : this->statuses)
+        pids.push_back(pid);
+
+    return pids;
+}
+
+Reactor &reactor() {
+    static Reactor instance{};
+    instance.init();
+    return instance;
+}
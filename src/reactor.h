@@ -0,0 +1,89 @@
+#ifndef TESTSH_REACTOR_H
+#define TESTSH_REACTOR_H
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <sys/types.h>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Collects the status changes of the children of the shell.
+ *
+ * The exit of every child is watched through a pidfd, its stops through a
+ * signalfd of SIGCHLD, both in a single epoll: waiting for any number of
+ * children is a single epoll_wait(), woken only when one of them changes.
+ * A status is reaped as soon as it is seen and kept by pid until the job of
+ * the child takes it, whatever job is being waited for. While the shell
+ * waits for a line of input it also waits on fd(), so that the background
+ * jobs are reported as soon as they complete.
+ *
+ * SIGCHLD is blocked in the shell to be read from the signalfd: the
+ * programs it runs get it back unblocked, see block_sigchld(). A forked
+ * child of the shell gets a new reactor the first time it uses one, the
+ * reactor of the parent watches the children of the parent.
+ */
+class Reactor {
+    int epoll_fd = -1;
+    int signal_fd = -1;
+    // pid -> pidfd, -1 if the child is watched through SIGCHLD only
+    std::unordered_map<pid_t, int> children{};
+    // Children without a pidfd, reaped when a SIGCHLD arrives
+    size_t unwatched = 0;
+    // pid -> statuses not taken yet, in the order they happened
+    std::unordered_map<pid_t, std::vector<int>> statuses{};
+    uint64_t changes_ = 0;
+
+    void init();
+    void release();
+    void dispatch(pid_t pid, int wstatus);
+    void reap(pid_t pid);
+    void reap_signaled();
+
+    friend Reactor &reactor();
+
+  public:
+    Reactor() = default;
+    Reactor(const Reactor &) = delete;
+    Reactor &operator=(const Reactor &) = delete;
+    ~Reactor();
+
+    // Watches a new child of the shell
+    void watch(pid_t pid);
+
+    /**
+     * Waits up to `timeout` milliseconds for status changes and collects
+     * them: -1 waits until one arrives, 0 only collects the ready ones.
+     */
+    void poll(int timeout);
+
+    // Takes the oldest status of `pid` not taken yet, in the waitpid() format
+    std::optional<int> take(pid_t pid);
+
+    // Children with statuses not taken yet
+    std::vector<pid_t> pending() const;
+
+    // Number of status changes collected since the reactor was created
+    uint64_t changes() const { return this->changes_; }
+
+    /**
+     * Readable when there are status changes to collect: poll() it along
+     * with other fds, such as the terminal, and call poll(0) when it is.
+     */
+    int fd() const { return this->epoll_fd; }
+};
+
+/**
+ * Reactor of the calling process. The first call blocks SIGCHLD: it must
+ * happen before the first child is created.
+ */
+Reactor &reactor();
+
+/**
+ * Blocks or unblocks SIGCHLD. The Reactor of the shell blocks it, a child
+ * about to exec a program unblocks it. Only makes a syscall.
+ */
+void block_sigchld(bool blocked);
+
+#endif // TESTSH_REACTOR_H
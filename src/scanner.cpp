@@ -0,0 +1,384 @@
+#include "scanner.h"
+#include "re2/re2.h"
+#include "stats.h"
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// ------------------------------------
+// Tables
+// ------------------------------------
+
+/**
+ * Action taken depending on the first byte of the token.
+ */
+enum class Start : uint8_t {
+    none,
+    space,
+    backslash,
+    open_round,
+    close_round,
+    dollar,
+    semicolon,
+    ampersand,
+    new_line,
+    digit,
+    word,
+    quote,
+    bang,
+    pipe,
+    less,
+    great,
+    non_ascii,
+};
+
+// ASCII characters of the `[\p{L}\p{Nd}\p{So}=\-\/.:_%+,\[\]]` class. The
+// ASCII range does not contain any character of the `So` category.
+static constexpr bool is_ascii_word(const unsigned char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+           (c >= '0' && c <= '9') || c == '=' || c == '-' || c == '/' ||
+           c == '.' || c == ':' || c == '_' || c == '%' || c == '+' ||
+           c == ',' || c == '[' || c == ']';
+}
+
+// ASCII characters of the `[\w\-\/.=]` class used by `$name`.
+static constexpr bool is_doll_word(const unsigned char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+           (c >= '0' && c <= '9') || c == '_' || c == '-' || c == '/' ||
+           c == '.' || c == '=';
+}
+
+static constexpr std::array<Start, 256> start_table = [] {
+    std::array<Start, 256> table{};
+
+    for (size_t c = 0; c < table.size(); ++c) {
+        if (c >= 0x80)
+            table[c] = Start::non_ascii;
+        else if (c >= '0' && c <= '9')
+            table[c] = Start::digit;
+        else if (is_ascii_word(c))
+            table[c] = Start::word;
+    }
+
+    table[' '] = Start::space;
+    table['\\'] = Start::backslash;
+    table['('] = Start::open_round;
+    table[')'] = Start::close_round;
+    table['$'] = Start::dollar;
+    table[';'] = Start::semicolon;
+    table['&'] = Start::ampersand;
+    table['\n'] = Start::new_line;
+    table['\''] = Start::quote;
+    table['!'] = Start::bang;
+    table['|'] = Start::pipe;
+    table['<'] = Start::less;
+    table['>'] = Start::great;
+
+    return table;
+}();
+
+static constexpr std::array<bool, 256> word_table = [] {
+    std::array<bool, 256> table{};
+    for (size_t c = 0; c < 0x80; ++c)
+        table[c] = is_ascii_word(c);
+    return table;
+}();
+
+static constexpr std::array<bool, 256> doll_table = [] {
+    std::array<bool, 256> table{};
+    for (size_t c = 0; c < 0x80; ++c)
+        table[c] = is_doll_word(c);
+    return table;
+}();
+
+// ------------------------------------
+// Helpers
+// ------------------------------------
+
+static inline unsigned char at(std::string_view input, size_t i) {
+    return static_cast<unsigned char>(input[i]);
+}
+
+static inline bool next_is(std::string_view input, size_t i, char c) {
+    return i < input.size() && input[i] == c;
+}
+
+template <size_t N>
+static inline size_t run_length(std::string_view input, size_t i,
+                                const std::array<bool, N> &table) {
+    while (i < input.size() && table[at(input, i)])
+        ++i;
+
+    return i;
+}
+
+/**
+ * Skips the ASCII word bytes starting at `i` and returns the offset of the
+ * first byte that is not part of the class. Sixteen bytes are classified at a
+ * time when SSE2 is available.
+ */
+static size_t ascii_word_run(std::string_view input, size_t i) {
+#if defined(__SSE2__)
+    const __m128i case_bit = _mm_set1_epi8(0x20);
+    const __m128i before_a = _mm_set1_epi8('a' - 1);
+    const __m128i after_z = _mm_set1_epi8('z' + 1);
+    // '+', ',', '-', '.', '/', the digits and ':' are contiguous:
+    // [0x2b, 0x3a]
+    const __m128i before_plus = _mm_set1_epi8('+' - 1);
+    const __m128i after_colon = _mm_set1_epi8(':' + 1);
+    const __m128i equal = _mm_set1_epi8('=');
+    const __m128i percent = _mm_set1_epi8('%');
+    const __m128i open_square = _mm_set1_epi8('[');
+    const __m128i close_square = _mm_set1_epi8(']');
+    const __m128i underscore = _mm_set1_epi8('_');
+
+    while (i + 16 <= input.size()) {
+        const __m128i bytes = _mm_loadu_si128(
+            reinterpret_cast<const __m128i *>(input.data() + i));
+
+        // Non ASCII bytes are negative in the signed comparisons below,
+        // so they never fall inside one of the ranges.
+        const __m128i lower = _mm_or_si128(bytes, case_bit);
+        const __m128i letter = _mm_and_si128(_mm_cmpgt_epi8(lower, before_a),
+                                             _mm_cmplt_epi8(lower, after_z));
+        const __m128i punct_digit =
+            _mm_and_si128(_mm_cmpgt_epi8(bytes, before_plus),
+                          _mm_cmplt_epi8(bytes, after_colon));
+        const __m128i single = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(bytes, equal),
+                         _mm_cmpeq_epi8(bytes, percent)),
+            _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(bytes, open_square),
+                                      _mm_cmpeq_epi8(bytes, close_square)),
+                         _mm_cmpeq_epi8(bytes, underscore)));
+
+        const unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(
+            _mm_or_si128(_mm_or_si128(letter, punct_digit), single)));
+
+        if (mask != 0xffff)
+            return i + __builtin_ctz(~mask);
+
+        i += 16;
+    }
+#endif
+
+    return run_length(input, i, word_table);
+}
+
+/**
+ * Non ASCII code points are rare in a script, leave their classification to
+ * RE2 so that the unicode categories stay exactly the same as the reference
+ * engine.
+ */
+static size_t unicode_word_length(std::string_view input) {
+    static const re2::RE2 word_char{R"(^([\p{L}\p{Nd}\p{So}]))"};
+
+    ++stats().regex_evals;
+
+    std::string_view match{};
+    if (!RE2::PartialMatch(input, word_char, &match))
+        return 0;
+
+    return match.length();
+}
+
+// Length of the character escaped by a backslash (`\\.` in RE2).
+static size_t escaped_length(std::string_view input) {
+    static const re2::RE2 any_char{R"(^(.))"};
+
+    if (input.empty() || input[0] == '\n')
+        return 0;
+
+    if (at(input, 0) < 0x80)
+        return 1;
+
+    ++stats().regex_evals;
+
+    std::string_view match{};
+    if (!RE2::PartialMatch(input, any_char, &match))
+        return 0;
+
+    return match.length();
+}
+
+// `[^']` only matches valid UTF-8 code points, invalid bytes end the match.
+static bool valid_quoted(std::string_view quoted) {
+    static const re2::RE2 quoted_word{R"(^('[^']*'))"};
+
+    const bool ascii = std::ranges::all_of(quoted, [](const char c) {
+        return static_cast<unsigned char>(c) < 0x80;
+    });
+    if (ascii)
+        return true;
+
+    ++stats().regex_evals;
+
+    std::string_view match{};
+    return RE2::PartialMatch(quoted, quoted_word, &match) &&
+           match.length() == quoted.length();
+}
+
+/**
+ * Matches `((?:[\p{L}\p{Nd}\p{So}=\-\/.:_%+,\[\]]|\\.)+)` starting at `i`.
+ */
+static size_t word_length(std::string_view input, size_t i) {
+    const size_t start = i;
+
+    for (;;) {
+        i = ascii_word_run(input, i);
+        if (i == input.size())
+            break;
+
+        if (input[i] == '\\') {
+            const size_t escaped = escaped_length(input.substr(i + 1));
+            if (escaped == 0)
+                break;
+
+            i += 1 + escaped;
+            continue;
+        }
+
+        if (at(input, i) >= 0x80) {
+            const size_t code_point = unicode_word_length(input.substr(i));
+            if (code_point == 0)
+                break;
+
+            i += code_point;
+            continue;
+        }
+
+        break;
+    }
+
+    return i - start;
+}
+
+static std::optional<ScanMatch> word(std::string_view input) {
+    const size_t length = word_length(input, 0);
+    if (length == 0)
+        return std::nullopt;
+
+    return ScanMatch{TokenType::word, length};
+}
+
+// ------------------------------------
+// Scanner
+// ------------------------------------
+
+std::optional<ScanMatch> scan_table(std::string_view input) {
+    if (input.empty())
+        return ScanMatch{TokenType::eof, 0};
+
+    switch (start_table[at(input, 0)]) {
+    case Start::space: {
+        size_t i = 1;
+        while (next_is(input, i, ' '))
+            ++i;
+
+        return ScanMatch{TokenType::separator, i};
+    }
+
+    case Start::backslash:
+        // The continuation must be the last thing of the input
+        if (input == "\\\n")
+            return ScanMatch{TokenType::line_continuation, 1};
+
+        return word(input);
+
+    case Start::open_round:
+        return ScanMatch{TokenType::open_round, 1};
+
+    case Start::close_round:
+        return ScanMatch{TokenType::close_round, 1};
+
+    case Start::dollar: {
+        if (next_is(input, 1, '('))
+            return ScanMatch{TokenType::andopen, 2};
+
+        const size_t end = run_length(input, 1, doll_table);
+        if (end > 1)
+            return ScanMatch{TokenType::doll_word, end};
+
+        if (next_is(input, 1, '$') || next_is(input, 1, '!') ||
+            next_is(input, 1, '?'))
+            return ScanMatch{TokenType::doll_word, 2};
+
+        return std::nullopt;
+    }
+
+    case Start::semicolon:
+        return ScanMatch{TokenType::semicolon, 1};
+
+    case Start::ampersand:
+        if (next_is(input, 1, '&'))
+            return ScanMatch{TokenType::and_and, 2};
+
+        return ScanMatch{TokenType::andper, 1};
+
+    case Start::new_line:
+        return ScanMatch{TokenType::new_line, 1};
+
+    case Start::digit: {
+        size_t digits = 1;
+        while (digits < input.size() && input[digits] >= '0' &&
+               input[digits] <= '9')
+            ++digits;
+
+        // IO Number: the digits must be attached to a redirection
+        if (next_is(input, digits, '<') || next_is(input, digits, '>'))
+            return ScanMatch{TokenType::io_number, digits};
+
+        return word(input);
+    }
+
+    case Start::word:
+    case Start::non_ascii:
+        return word(input);
+
+    case Start::quote: {
+        const auto close = input.find('\'', 1);
+        if (close == std::string_view::npos ||
+            !valid_quoted(input.substr(0, close + 1)))
+            return std::nullopt;
+
+        return ScanMatch{TokenType::quoted_word, close + 1};
+    }
+
+    case Start::bang:
+        return ScanMatch{TokenType::bang, 1};
+
+    case Start::pipe:
+        if (next_is(input, 1, '|'))
+            return ScanMatch{TokenType::or_or, 2};
+
+        return ScanMatch{TokenType::pipe, 1};
+
+    case Start::less:
+        if (next_is(input, 1, '>'))
+            return ScanMatch{TokenType::lessgreat, 2};
+        if (next_is(input, 1, '&'))
+            return ScanMatch{TokenType::lessand, 2};
+        if (next_is(input, 1, '<'))
+            return ScanMatch{TokenType::dless, 2};
+
+        return ScanMatch{TokenType::less, 1};
+
+    case Start::great:
+        if (next_is(input, 1, '&'))
+            return ScanMatch{TokenType::greatand, 2};
+        if (next_is(input, 1, '>'))
+            return ScanMatch{TokenType::dgreat, 2};
+
+        return ScanMatch{TokenType::great, 1};
+
+    case Start::none:
+        break;
+    }
+
+    return std::nullopt;
+}
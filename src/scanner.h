@@ -0,0 +1,18 @@
+#ifndef TESTSH_SCANNER_H
+#define TESTSH_SCANNER_H
+
+#include "tokenizer.h"
+#include <optional>
+#include <string_view>
+
+/**
+ * Hand written, table-driven scanner. It recognizes in a single pass the same
+ * language described by the RE2 specification table in tokenizer.cpp, which is
+ * kept as the reference engine (see LexerEngine).
+ *
+ * Returns the type and the length of the token at the beginning of `input`,
+ * or std::nullopt when no token matches.
+ */
+std::optional<ScanMatch> scan_table(std::string_view input);
+
+#endif // TESTSH_SCANNER_H
@@ -1,4 +1,5 @@
 #include "shell.h"
+#include "reactor.h"
 #include <csignal>
 #include <cstdio>
 #include <optional>
@@ -26,6 +27,93 @@ std::string_view Var::value() const {
 // ShellVars
 // ------------------------------------
 
+// Generations are never reused, not even by different ShellVars
+static uint64_t next_generation() {
+    static uint64_t generation = 0;
+    return ++generation;
+}
+
+ShellVars::ShellVars(const ShellVars &other) { *this = other; }
+
+ShellVars &ShellVars::operator=(const ShellVars &other) {
+    if (this == &other)
+        return *this;
+
+    // The environment points to the strings of the copied variables
+    this->vars = other.vars;
+    this->exported.assign(other.exported.size(), nullptr);
+
+    for (const auto &var : this->vars) {
+        if (var.slot)
+            this->exported[*var.slot] = const_cast<char *>(var.str.c_str());
+    }
+
+    this->generation_ = next_generation();
+    this->path_generation_ = other.path_generation_;
+    return *this;
+}
+
+void ShellVars::update_environment(const Var &var,
+                                   std::optional<size_t> slot) {
+    if (!var.attr.external && !slot)
+        return;
+
+    if (var.attr.external) {
+        char *str = const_cast<char *>(var.str.c_str());
+
+        if (slot) {
+            this->exported[*slot] = str;
+        } else {
+            slot = this->environment_size();
+            this->exported.back() = str;
+            this->exported.push_back(nullptr);
+        }
+
+        var.slot = slot;
+    } else {
+        this->remove_from_environment(*slot);
+    }
+
+    this->generation_ = next_generation();
+}
+
+void ShellVars::remove_from_environment(size_t slot) {
+    // The variable is no longer exported, the last one takes its place
+    const size_t last = this->environment_size() - 1;
+
+    if (slot != last) {
+        const std::string_view moved{this->exported[last]};
+
+        this->exported[slot] = this->exported[last];
+        this->vars.find(moved.substr(0, moved.find('=')))->slot = slot;
+    }
+
+    this->exported.pop_back();
+    this->exported.back() = nullptr;
+}
+
+void ShellVars::restore(const std::string &name, std::optional<Var> previous) {
+    auto it = this->vars.find(std::string_view{name});
+    if (it != this->vars.end()) {
+        if (it->slot)
+            this->remove_from_environment(*it->slot);
+
+        this->vars.erase(it);
+    }
+
+    if (previous) {
+        previous->slot.reset();
+
+        const auto [inserted, _] = this->vars.insert(std::move(*previous));
+        this->update_environment(*inserted, std::nullopt);
+    }
+
+    if (name == "PATH")
+        this->path_generation_ = next_generation();
+
+    this->generation_ = next_generation();
+}
+
 void ShellVars::upsert(std::string var, std::optional<VarAttr> attr) {
     auto eq_off = var.find("=");
 
@@ -39,11 +127,21 @@ void ShellVars::upsert(std::string var, std::optional<VarAttr> attr) {
         .attr = {},
     };
 
+    std::optional<size_t> slot{};
+
     auto it = this->vars.find(shell_var);
+
+    if (this->checkpoints != 0) {
+        this->journal.emplace_back(
+            std::string{shell_var.name()},
+            it != this->vars.end() ? std::optional{*it} : std::nullopt);
+    }
+
     if (it != this->vars.end()) {
         if (!attr)
             attr.emplace(it->attr);
 
+        slot = it->slot;
         this->vars.erase(it);
     }
 
@@ -51,7 +149,11 @@ void ShellVars::upsert(std::string var, std::optional<VarAttr> attr) {
         shell_var.attr = take(attr);
     }
 
-    this->vars.insert(std::move(shell_var));
+    const auto [inserted, _] = this->vars.insert(std::move(shell_var));
+    this->update_environment(*inserted, slot);
+
+    if (inserted->name() == "PATH")
+        this->path_generation_ = next_generation();
 }
 
 std::optional<std::string_view> ShellVars::get(std::string_view str) const {
@@ -62,6 +164,35 @@ std::optional<std::string_view> ShellVars::get(std::string_view str) const {
     return it->value();
 }
 
+std::optional<size_t>
+ShellVars::environment_slot(std::string_view name) const {
+    const auto it = this->vars.find(name);
+    if (it == this->vars.end())
+        return std::nullopt;
+
+    return it->slot;
+}
+
+size_t ShellVars::checkpoint() {
+    ++this->checkpoints;
+    return this->journal.size();
+}
+
+void ShellVars::rollback(size_t checkpoint) {
+    assertm(this->checkpoints != 0 && checkpoint <= this->journal.size(),
+            "A rollback must release a checkpoint");
+
+    // The oldest change of a variable is undone last
+    while (this->journal.size() > checkpoint) {
+        auto [name, previous] = std::move(this->journal.back());
+        this->journal.pop_back();
+
+        this->restore(name, std::move(previous));
+    }
+
+    --this->checkpoints;
+}
+
 static void init_environment(ShellVars &vars) {
     for (size_t i = 0; environ[i] != nullptr; i++) {
         vars.upsert(environ[i], VarAttr{.external = true});
@@ -71,6 +202,10 @@ static void init_environment(ShellVars &vars) {
 /* Make sure the shell is running interactively as the foreground job
    before proceeding. */
 Shell::Shell() : pgid(), tmodes(), terminal(), is_interactive(), vars() {
+    /* Block SIGCHLD before the first child is created, its changes are
+     * read from a signalfd.  */
+    reactor();
+
     /* See if we are running interactively.  */
     terminal = STDIN_FILENO;
     is_interactive = isatty(terminal);
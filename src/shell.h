@@ -2,12 +2,17 @@
 #define TESTSH_SHELL_H
 
 #include "util.h"
+#include <cstddef>
+#include <cstdint>
 #include <format>
 #include <optional>
+#include <string>
 #include <string_view>
 #include <termios.h>
+#include <tuple>
 #include <unistd.h>
 #include <unordered_set>
+#include <vector>
 
 struct VarAttr {
     bool external = false;
@@ -17,6 +22,8 @@ struct Var {
     std::string str;
     std::string::size_type eq_off;
     VarAttr attr;
+    // Position of the variable in the environment, if it is exported
+    mutable std::optional<size_t> slot = std::nullopt;
 
     std::string_view name() const;
     std::string_view value() const;
@@ -30,10 +37,41 @@ struct VarP {
     std::string_view operator()(std::string_view vw) const { return vw; }
 };
 
+/**
+ * Variables of the shell.
+ *
+ * The environment given to the programs is kept built: a null-terminated
+ * array with the strings of the exported variables, updated in place when
+ * one of them is upserted. Every update gives it a new generation, unique
+ * among all the ShellVars, so that a copy of it can be reused as long as
+ * the generation does not change.
+ *
+ * A checkpoint records the variables replaced by the following upserts,
+ * so that they can be put back by a rollback: a subshell run by the shell
+ * itself only pays for the variables it changes.
+ */
 class ShellVars {
     std::unordered_set<Var, ProjHash<VarP>, ProjEq<VarP>> vars;
+    // Strings of the exported variables, followed by a nullptr
+    std::vector<char *> exported{nullptr};
+    uint64_t generation_ = 0;
+    uint64_t path_generation_ = 0;
+    // tuple<name, variable replaced by an upsert>, recorded while there is
+    // a checkpoint
+    std::vector<std::tuple<std::string, std::optional<Var>>> journal{};
+    size_t checkpoints = 0;
+
+    void update_environment(const Var &var, std::optional<size_t> slot);
+    void remove_from_environment(size_t slot);
+    void restore(const std::string &name, std::optional<Var> previous);
 
   public:
+    ShellVars() = default;
+    ShellVars(const ShellVars &other);
+    ShellVars(ShellVars &&other) = default;
+    ShellVars &operator=(const ShellVars &other);
+    ShellVars &operator=(ShellVars &&other) = default;
+
     auto begin() { return vars.begin(); }
     auto end() { return vars.end(); }
     auto begin() const { return vars.begin(); }
@@ -42,6 +80,28 @@ class ShellVars {
     void upsert(std::string var, std::optional<VarAttr> attr);
 
     std::optional<std::string_view> get(std::string_view str) const;
+
+    char *const *environment() const { return this->exported.data(); }
+
+    // Number of exported variables
+    size_t environment_size() const { return this->exported.size() - 1; }
+
+    // Position of `name` in the environment, if it is exported
+    std::optional<size_t> environment_slot(std::string_view name) const;
+
+    uint64_t generation() const { return this->generation_; }
+
+    // Changes every time the PATH is upserted
+    uint64_t path_generation() const { return this->path_generation_; }
+
+    /**
+     * Starts recording the upserts. The checkpoints can be nested, each one
+     * must be released by a rollback().
+     */
+    size_t checkpoint();
+
+    // Undoes the upserts made after `checkpoint` and releases it
+    void rollback(size_t checkpoint);
 };
 
 struct Shell {
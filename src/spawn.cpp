@@ -0,0 +1,393 @@
+#include "spawn.h"
+#include "reactor.h"
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <initializer_list>
+#include <optional>
+#include <print>
+#include <spawn.h>
+#include <string_view>
+#include <unistd.h>
+#include <utility>
+
+// Signals handled by the interactive shell, set back to their default in
+// the commands it runs
+static constexpr int job_control_signals[] = {
+    SIGINT, SIGQUIT, SIGTSTP, SIGTTIN, SIGTTOU, SIGCHLD,
+};
+
+static SpawnEngine engine_from_env() {
+    const char *name = std::getenv("TESTSH_SPAWN");
+    if (name == nullptr)
+        return SpawnEngine::spawn;
+
+    const std::string_view engine{name};
+
+    if (engine == "spawn")
+        return SpawnEngine::spawn;
+    if (engine == "fork")
+        return SpawnEngine::fork;
+
+    std::println(stderr, "testsh: unknown TESTSH_SPAWN={}, using spawn",
+                 engine);
+    return SpawnEngine::spawn;
+}
+
+SpawnEngine spawn_engine() {
+    static const SpawnEngine engine = engine_from_env();
+    return engine;
+}
+
+// ------------------------------------
+// Redirections
+// ------------------------------------
+
+/**
+ * Content of the fds of a child while its redirections are planned: the fd
+ * of the shell each one refers to, or -1 if closed. The fds that were never
+ * written refer to themselves.
+ */
+class FdTable {
+    // tuple<fd, fd of the shell>
+    std::vector<std::tuple<int, int>> written{};
+
+  public:
+    int content(int fd) const {
+        for (const auto [written_fd, source] : this->written) {
+            if (written_fd == fd)
+                return source;
+        }
+
+        return fd;
+    }
+
+    void write(int fd, int source) {
+        for (auto &[written_fd, content] : this->written) {
+            if (written_fd == fd) {
+                content = source;
+                return;
+            }
+        }
+
+        this->written.emplace_back(fd, source);
+    }
+
+    // An fd that refers to `source`, if any
+    std::optional<int> holder(int source) const {
+        if (this->content(source) == source)
+            return source;
+
+        for (const auto [fd, content] : this->written) {
+            if (content == source)
+                return fd;
+        }
+
+        return std::nullopt;
+    }
+
+    // Number of fds that refer to `source`
+    size_t holders(int source) const {
+        size_t holders = this->content(source) == source ? 1 : 0;
+
+        for (const auto [fd, content] : this->written) {
+            if (content == source && fd != source)
+                ++holders;
+        }
+
+        return holders;
+    }
+
+    auto begin() const { return this->written.begin(); }
+    auto end() const { return this->written.end(); }
+};
+
+RedirectPlan plan_redirections(
+    std::span<const std::tuple<int, int>> redirects) {
+    RedirectPlan plan{};
+
+    // Content of the fds at the end of the redirections
+    FdTable target{};
+    int highest = -1;
+
+    for (const auto [to_replace, replacer] : redirects) {
+        target.write(to_replace,
+                     replacer == -1 ? -1 : target.content(replacer));
+        highest = std::max({highest, to_replace, replacer});
+    }
+
+    // tuple<fd, fd of the shell> still to duplicate
+    std::vector<std::tuple<int, int>> pending{};
+    std::vector<int> to_close{};
+
+    for (const auto [fd, source] : target) {
+        if (source == -1)
+            to_close.push_back(fd);
+        else if (source == fd)
+            plan.dups.emplace_back(fd, fd);
+        else
+            pending.emplace_back(fd, source);
+    }
+
+    // Content of the fds of the child while the dups are made
+    FdTable current{};
+    int spare = highest + 1;
+
+    // An fd can be overwritten when what it refers to is no longer needed,
+    // or is also in another fd
+    const auto needed = [&](int fd) {
+        const int content = current.content(fd);
+
+        return current.holders(content) == 1 &&
+               std::ranges::any_of(pending, [&](const auto &move) {
+                   return std::get<1>(move) == content;
+               });
+    };
+
+    while (!pending.empty()) {
+        const auto ready = std::ranges::find_if(pending, [&](const auto &move) {
+            return !needed(std::get<0>(move));
+        });
+
+        if (ready != pending.end()) {
+            const auto [fd, source] = *ready;
+
+            plan.dups.emplace_back(fd, *current.holder(source));
+            current.write(fd, source);
+            pending.erase(ready);
+            continue;
+        }
+
+        // Every fd still to write is needed by another one: a cycle. The
+        // first one is saved in a spare fd.
+        const int fd = std::get<0>(pending.front());
+
+        plan.dups.emplace_back(spare, fd);
+        current.write(spare, current.content(fd));
+        to_close.push_back(spare++);
+    }
+
+    // Contiguous fds are closed by a single close_range()
+    std::ranges::sort(to_close);
+
+    for (const int fd : to_close) {
+        if (!plan.closes.empty() && std::get<1>(plan.closes.back()) + 1 == fd)
+            std::get<1>(plan.closes.back()) = fd;
+        else
+            plan.closes.emplace_back(fd, fd);
+    }
+
+    return plan;
+}
+
+bool apply_plan(std::span<const std::tuple<int, int>> dups,
+                std::span<const std::tuple<int, int>> closes) {
+    for (const auto [to_replace, replacer] : dups) {
+        // dup2() of an fd onto itself keeps its close-on-exec flag
+        const int retval = to_replace == replacer
+                               ? fcntl(to_replace, F_SETFD, 0)
+                               : dup2(replacer, to_replace);
+        if (retval == -1)
+            return false;
+    }
+
+    for (const auto [first, last] : closes) {
+#if defined(__GLIBC__) && __GLIBC_PREREQ(2, 34)
+        if (close_range(first, last, 0) == 0)
+            continue;
+#endif
+
+        // Kernels older than 5.9
+        for (int fd = first; fd <= last; ++fd)
+            close(fd);
+    }
+
+    return true;
+}
+
+// ------------------------------------
+// posix_spawn
+// ------------------------------------
+
+/**
+ * Owns the attributes and the file actions of a posix_spawn() call.
+ */
+class SpawnRequest {
+    posix_spawnattr_t attr;
+    posix_spawn_file_actions_t actions;
+
+  public:
+    SpawnRequest() {
+        posix_spawnattr_init(&this->attr);
+        posix_spawn_file_actions_init(&this->actions);
+    }
+
+    SpawnRequest(const SpawnRequest &) = delete;
+    SpawnRequest &operator=(const SpawnRequest &) = delete;
+
+    ~SpawnRequest() {
+        posix_spawn_file_actions_destroy(&this->actions);
+        posix_spawnattr_destroy(&this->attr);
+    }
+
+    // Returns 0 or an error number, as the posix_spawn functions
+    int prepare(const ProcessSetup &setup) {
+        short flags = 0;
+        int error = 0;
+
+        if (setup.pgid != -1) {
+            flags |= POSIX_SPAWN_SETPGROUP;
+            error = posix_spawnattr_setpgroup(&this->attr, setup.pgid);
+        }
+
+        if (error == 0 && setup.default_signals) {
+            sigset_t signals;
+            sigemptyset(&signals);
+            for (const int sig : job_control_signals)
+                sigaddset(&signals, sig);
+
+            flags |= POSIX_SPAWN_SETSIGDEF;
+            error = posix_spawnattr_setsigdefault(&this->attr, &signals);
+        }
+
+        // The program gets SIGCHLD unblocked, the shell blocks it for the
+        // reactor
+        if (error == 0) {
+            sigset_t mask;
+            sigprocmask(SIG_SETMASK, nullptr, &mask);
+            sigdelset(&mask, SIGCHLD);
+
+            flags |= POSIX_SPAWN_SETSIGMASK;
+            error = posix_spawnattr_setsigmask(&this->attr, &mask);
+        }
+
+        if (error == 0)
+            error = posix_spawnattr_setflags(&this->attr, flags);
+
+#if defined(__GLIBC__) && __GLIBC_PREREQ(2, 35)
+        // The terminal is given before the fds are duplicated, which can
+        // replace it. The parent gives it again after the spawn, the child
+        // does it as well so that it owns the terminal when it starts.
+        if (error == 0 && setup.terminal != -1)
+            error = posix_spawn_file_actions_addtcsetpgrp_np(&this->actions,
+                                                             setup.terminal);
+#endif
+
+        // Since glibc 2.29 the dup2 of an fd onto itself clears its
+        // close-on-exec flag, as the plan expects
+        for (const auto [to_replace, replacer] : setup.dups) {
+            if (error != 0)
+                break;
+            error = posix_spawn_file_actions_adddup2(&this->actions, replacer,
+                                                     to_replace);
+        }
+
+        for (const auto [first, last] : setup.closes) {
+            for (int fd = first; error == 0 && fd <= last; ++fd)
+                error = posix_spawn_file_actions_addclose(&this->actions, fd);
+        }
+
+        return error;
+    }
+
+    int spawn(pid_t &pid, const Program &program, char *const argv[],
+              char *const envp[]) const {
+        if (program.path != nullptr)
+            return posix_spawn(&pid, program.path, &this->actions,
+                               &this->attr, argv, envp);
+
+        return posix_spawnp(&pid, argv[0], &this->actions, &this->attr, argv,
+                            envp);
+    }
+};
+
+static pid_t posix_spawn_program(const Program &program, char *const argv[],
+                                 char *const envp[],
+                                 const ProcessSetup &setup) {
+    SpawnRequest request{};
+    pid_t pid = -1;
+
+    int error = request.prepare(setup);
+    if (error == 0)
+        error = request.spawn(pid, program, argv, envp);
+
+    if (error != 0) {
+        errno = error;
+        return -1;
+    }
+
+    return pid;
+}
+
+// ------------------------------------
+// fork
+// ------------------------------------
+
+// Writes `prog: error` on stderr with write() only, the child of fork() must
+// not allocate
+static void write_error(const char *prog, int error) {
+    const char *message = std::strerror(error);
+
+    for (const char *part : {"testsh: ", prog, ": ", message, "\n"}) {
+        if (write(STDERR_FILENO, part, std::strlen(part)) == -1)
+            return;
+    }
+}
+
+[[noreturn]] void exec_program(const Program &program, char *const argv[],
+                               char *const envp[], const ProcessSetup &setup) {
+    if (setup.pgid != -1)
+        setpgid(0, setup.pgid);
+
+    if (setup.terminal != -1)
+        tcsetpgrp(setup.terminal, getpgrp());
+
+    if (setup.default_signals) {
+        for (const int sig : job_control_signals)
+            signal(sig, SIG_DFL);
+    }
+
+    block_sigchld(false);
+
+    if (!apply_plan(setup.dups, setup.closes)) {
+        write_error("dup2", errno);
+        _exit(1);
+    }
+
+    if (program.dir_fd != -1)
+        execveat(program.dir_fd, argv[0], argv, envp, 0);
+    else if (program.path != nullptr)
+        execve(program.path, argv, envp);
+    else
+        execvpe(argv[0], argv, envp);
+
+    const int error = errno;
+    write_error(argv[0], error);
+    _exit(error == ENOENT ? 127 : 126);
+}
+
+static pid_t fork_program(const Program &program, char *const argv[],
+                          char *const envp[], const ProcessSetup &setup) {
+    const pid_t pid = fork();
+
+    if (pid == 0)
+        exec_program(program, argv, envp, setup);
+
+    return pid;
+}
+
+pid_t spawn_program(SpawnEngine engine, const Program &program,
+                    char *const argv[], char *const envp[],
+                    const ProcessSetup &setup) {
+    switch (engine) {
+    case SpawnEngine::spawn:
+        return posix_spawn_program(program, argv, envp, setup);
+    case SpawnEngine::fork:
+        return fork_program(program, argv, envp, setup);
+    }
+
+    std::unreachable();
+}
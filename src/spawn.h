@@ -0,0 +1,123 @@
+#ifndef TESTSH_SPAWN_H
+#define TESTSH_SPAWN_H
+
+#include <span>
+#include <sys/types.h>
+#include <tuple>
+#include <vector>
+
+/**
+ * How the external programs are started.
+ *
+ * `spawn` (the default) uses posix_spawnp(), which glibc implements with
+ * clone(CLONE_VM | CLONE_VFORK): the child runs on the memory of the shell
+ * up to the exec, so the cost does not grow with the heap of the shell.
+ * `fork` copies the page tables of the shell with fork() and sets up the
+ * child by hand, as the shell always did.
+ *
+ * Subshells, command substitutions, async lists and the builtins that
+ * change the shell inside a pipeline run code of the shell, they are always
+ * forked.
+ */
+enum class SpawnEngine {
+    spawn,
+    fork,
+};
+
+/**
+ * Engine selected by the TESTSH_SPAWN environment variable.
+ */
+SpawnEngine spawn_engine();
+
+/**
+ * Where a program is executed from.
+ */
+struct Program {
+    // Full path of the program, nullptr to search argv[0] in the PATH
+    const char *path = nullptr;
+    // Directory of the program opened with O_PATH, -1 if unknown. The fork
+    // engine runs argv[0] relative to it with execveat(), posix_spawn() can
+    // only take the full path.
+    int dir_fd = -1;
+};
+
+/**
+ * The fds of a child, as a minimal schedule of syscalls.
+ *
+ * The fds of the shell are all opened with O_CLOEXEC: the child only has to
+ * duplicate the ones of its redirections, all the others are closed by the
+ * exec. The plan is computed by the shell, the child only makes the
+ * syscalls.
+ */
+struct RedirectPlan {
+    // tuple<to_replace, replacer>, duplicated in order. A replacer equal to
+    // its fd only clears its close-on-exec flag
+    std::vector<std::tuple<int, int>> dups{};
+    // tuple<first, last>, ranges of fds closed after the dups
+    std::vector<std::tuple<int, int>> closes{};
+
+    // Syscalls made by the child to apply the plan
+    size_t syscalls() const { return this->dups.size() + this->closes.size(); }
+};
+
+/**
+ * Plans the redirections of a child. `redirects` are
+ * tuple<to_replace, replacer> in the order of the command line, a replacer
+ * of -1 closes the fd: each one sees the fds left by the previous ones.
+ *
+ * Only the fds whose final content changes are duplicated, in an order
+ * where no fd is overwritten while it is still needed. A cycle, such as
+ * `3>&1 1>&2 2>&3 3>&-`, is broken by moving one fd to a free number above
+ * all the fds of the redirections, closed at the end.
+ */
+RedirectPlan plan_redirections(
+    std::span<const std::tuple<int, int>> redirects);
+
+/**
+ * What the child has to do before the exec.
+ */
+struct ProcessSetup {
+    // Process group of the child: 0 starts a new one led by the child, -1
+    // leaves the child in the group of the shell
+    pid_t pgid = -1;
+    // Terminal given to the process group of the child, -1 for none
+    int terminal = -1;
+    // Reset the job control signals to their default handling
+    bool default_signals = false;
+    // tuple<to_replace, replacer>, duplicated in order, see RedirectPlan
+    std::span<const std::tuple<int, int>> dups{};
+    // tuple<first, last>, closed after the dups
+    std::span<const std::tuple<int, int>> closes{};
+};
+
+/**
+ * Makes the dups and the closes of a RedirectPlan in the calling process,
+ * with syscalls only. Returns false with errno set if a dup2() failed.
+ */
+bool apply_plan(std::span<const std::tuple<int, int>> dups,
+                std::span<const std::tuple<int, int>> closes);
+
+/**
+ * Starts `program`, or `argv[0]` searched in the PATH if it has no path,
+ * with the environment `envp`.
+ *
+ * Returns the pid of the child, or -1 with errno set if the program could
+ * not be started. The fork engine only fails if fork() does: the errors of
+ * the exec are printed by the child, which exits with 127 (not found) or
+ * 126.
+ */
+pid_t spawn_program(SpawnEngine engine, const Program &program,
+                    char *const argv[], char *const envp[],
+                    const ProcessSetup &setup);
+
+/**
+ * Replaces the calling process with `program`, after the setup of the
+ * child. It runs in the child of the fork engine, where everything was
+ * prepared by the parent: it only makes syscalls up to the exec. If the
+ * exec fails the error is printed and the process exits with 127 (not
+ * found) or 126.
+ */
+[[noreturn]] void exec_program(const Program &program, char *const argv[],
+                               char *const envp[], const ProcessSetup &setup);
+
+#endif // TESTSH_SPAWN_H
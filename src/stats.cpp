@@ -0,0 +1,73 @@
+#include "stats.h"
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <print>
+#include <sys/mman.h>
+#include <unistd.h>
+
+static bool stats_enabled = false;
+static pid_t stats_owner = -1;
+// Counter shared with the forked children, mapped by init()
+static std::atomic<size_t> *shared_elided_forks = nullptr;
+
+Stats &stats() {
+    thread_local Stats instance{};
+    return instance;
+}
+
+void Stats::add_counters(const Stats &other) {
+    this->input_bytes += other.input_bytes;
+    this->lexer_scans += other.lexer_scans;
+    this->regex_evals += other.regex_evals;
+    this->tokens += other.tokens;
+    this->lex_chunks += other.lex_chunks;
+    this->ast_nodes += other.ast_nodes;
+    this->ast_allocations += other.ast_allocations;
+    this->instructions += other.instructions;
+    this->spawns += other.spawns;
+    this->forks += other.forks;
+    this->fd_syscalls += other.fd_syscalls;
+    this->environment_copies += other.environment_copies;
+    this->pipeline_builtins += other.pipeline_builtins;
+    this->relays += other.relays;
+    this->parallel_tasks += other.parallel_tasks;
+    this->inline_cmdsubs += other.inline_cmdsubs;
+    this->virtual_subshells += other.virtual_subshells;
+    this->elided_forks += other.elided_forks;
+}
+
+bool Stats::enabled() { return stats_enabled; }
+
+void Stats::count_elided_fork() {
+    if (shared_elided_forks != nullptr)
+        shared_elided_forks->fetch_add(1, std::memory_order_relaxed);
+}
+
+static void print_stats() {
+    // Forked children inherit the exit handlers, only the shell prints
+    if (getpid() != stats_owner)
+        return;
+
+    if (shared_elided_forks != nullptr)
+        stats().elided_forks = shared_elided_forks->load();
+
+    std::println(stderr, "=== STATS ===");
+    std::println(stderr, "{:#?}", stats());
+}
+
+void Stats::init() {
+    if (std::getenv("TESTSH_STATS") == nullptr)
+        return;
+
+    stats_enabled = true;
+    stats_owner = getpid();
+
+    void *shared = mmap(nullptr, sizeof(std::atomic<size_t>),
+                        PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
+                        -1, 0);
+    if (shared != MAP_FAILED)
+        shared_elided_forks = new (shared) std::atomic<size_t>{0};
+
+    std::atexit(print_stats);
+}
@@ -0,0 +1,135 @@
+#ifndef TESTSH_STATS_H
+#define TESTSH_STATS_H
+
+#include "util.h"
+#include <chrono>
+#include <cstddef>
+#include <format>
+
+/**
+ * Counters over the internals of the shell, used to measure the effects
+ * of the optimizations. They are printed on stderr when the shell terminates
+ * if the TESTSH_STATS environment variable is set.
+ */
+struct Stats {
+    // Bytes of input given to the parser
+    size_t input_bytes = 0;
+    // Number of times a lexer engine was run
+    size_t lexer_scans = 0;
+    // Number of regexes evaluated by the lexer engines
+    size_t regex_evals = 0;
+    // Tokens produced for the parser
+    size_t tokens = 0;
+    // Chunks of the scripts lexed in parallel
+    size_t lex_chunks = 0;
+    // Nodes of the syntax trees
+    size_t ast_nodes = 0;
+    // Times the storage of the syntax trees had to grow
+    size_t ast_allocations = 0;
+    // Instructions of the bytecode lowered from the syntax trees
+    size_t instructions = 0;
+    // Programs started with posix_spawn() and children created with fork()
+    size_t spawns = 0;
+    size_t forks = 0;
+    // dup2() and close_range() made by the programs started by the shell to
+    // set up their fds, see RedirectPlan
+    size_t fd_syscalls = 0;
+    // Times the environment of the shell was copied to apply the prefix
+    // assignments of a command
+    size_t environment_copies = 0;
+    // Builtins run by the shell itself inside a pipeline, without a fork
+    size_t pipeline_builtins = 0;
+    // `cat` commands of the pipelines run as splice() relays
+    size_t relays = 0;
+    // Commands started by the `parallel` builtin
+    size_t parallel_tasks = 0;
+    // Command substitutions run by the shell itself, captured in a memory
+    // file without a fork
+    size_t inline_cmdsubs = 0;
+    // Subshells and command substitutions run by the shell itself, whose
+    // changes to the shell are undone afterwards
+    size_t virtual_subshells = 0;
+    // Forks saved by child shells that executed their last command in
+    // place. Counted by the children, see count_elided_fork()
+    size_t elided_forks = 0;
+    std::chrono::nanoseconds lex_time{};
+    std::chrono::nanoseconds parse_time{};
+
+    /**
+     * Adds the counters of `other`. The timers are left untouched: they
+     * measure the wall time spent by the thread that owns them.
+     */
+    void add_counters(const Stats &other);
+
+    static bool enabled();
+
+    /**
+     * Counts a fork saved by a child shell. The counter lives in memory
+     * shared with the children, whose own counters are lost when they
+     * exec or exit.
+     */
+    static void count_elided_fork();
+
+    /**
+     * Reads TESTSH_STATS and registers the printing of the counters
+     * on exit. Must be called once from the main process.
+     */
+    static void init();
+};
+
+/**
+ * Counters of the calling thread. Only the ones of the main thread are
+ * printed, the other threads have to merge theirs with add_counters().
+ */
+Stats &stats();
+
+/**
+ * Adds to `elapsed` the time passed between the construction and the
+ * destruction of the object.
+ */
+class ScopedTimer {
+    std::chrono::nanoseconds &elapsed;
+    std::chrono::steady_clock::time_point start;
+
+  public:
+    explicit ScopedTimer(std::chrono::nanoseconds &elapsed)
+        : elapsed(elapsed), start(std::chrono::steady_clock::now()) {}
+
+    ScopedTimer(const ScopedTimer &) = delete;
+    ScopedTimer &operator=(const ScopedTimer &) = delete;
+
+    ~ScopedTimer() { elapsed += std::chrono::steady_clock::now() - start; }
+};
+
+// ------------------------------------
+// FORMATTER
+// ------------------------------------
+
+template <typename CharT> struct std::formatter<Stats, CharT> : debug_spec {
+    auto format(const Stats &s, auto &ctx) const {
+        this->start<Stats>(ctx);
+        this->field("input_bytes", s.input_bytes, ctx);
+        this->field("lexer_scans", s.lexer_scans, ctx);
+        this->field("regex_evals", s.regex_evals, ctx);
+        this->field("tokens", s.tokens, ctx);
+        this->field("lex_chunks", s.lex_chunks, ctx);
+        this->field("ast_nodes", s.ast_nodes, ctx);
+        this->field("ast_allocations", s.ast_allocations, ctx);
+        this->field("instructions", s.instructions, ctx);
+        this->field("spawns", s.spawns, ctx);
+        this->field("forks", s.forks, ctx);
+        this->field("fd_syscalls", s.fd_syscalls, ctx);
+        this->field("environment_copies", s.environment_copies, ctx);
+        this->field("pipeline_builtins", s.pipeline_builtins, ctx);
+        this->field("relays", s.relays, ctx);
+        this->field("parallel_tasks", s.parallel_tasks, ctx);
+        this->field("inline_cmdsubs", s.inline_cmdsubs, ctx);
+        this->field("virtual_subshells", s.virtual_subshells, ctx);
+        this->field("elided_forks", s.elided_forks, ctx);
+        this->field("lex_time", s.lex_time, ctx);
+        this->field("parse_time", s.parse_time, ctx);
+        return this->finish(ctx);
+    }
+};
+
+#endif // TESTSH_STATS_H
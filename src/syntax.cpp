@@ -4,6 +4,7 @@
 #include <charconv>
 #include <cstdlib>
 #include <optional>
+#include <span>
 #include <string_view>
 #include <variant>
 #include <vector>
@@ -16,38 +17,41 @@ std::string SimpleCommand::text() const {
     std::string cmd{this->program};
 
     for (const auto &arg : this->arguments) {
-        cmd += " " + arg;
+        cmd += " ";
+        cmd += arg;
     }
 
     return cmd;
 }
 
 // ------------------------------------
-// SequentialList
+// Ast
 // ------------------------------------
 
-SequentialList SequentialList::from_async(AsyncList &&async) {
-    if (!async.left)
-        return SequentialList{.right = std::move(async.right)};
-
-    return SequentialList{
-        .left = std::move(*async.left),
-        .right = std::move(async.right),
-    };
+size_t Ast::size() const {
+    return this->lists.size() + this->list_items.size() +
+           this->and_or_items.size() + this->commands.size() +
+           this->words.size() + this->redirects.size() +
+           this->assignments.size();
 }
 
-// ------------------------------------
-// AsyncList
-// ------------------------------------
-
-AsyncList AsyncList::from_seq(SequentialList &&seq) {
-    if (!seq.left)
-        return AsyncList{.right = std::move(seq.right)};
-
-    return AsyncList{
-        .left = std::move(*seq.left),
-        .right = std::move(seq.right),
-    };
+void Ast::clear() {
+    // The nodes are trivially destructible: only the sizes are reset
+    this->lists.clear();
+    this->list_items.clear();
+    this->and_or_items.clear();
+    this->commands.clear();
+    this->words.clear();
+    this->redirects.clear();
+    this->assignments.clear();
+
+    this->staged_lists.clear();
+    this->staged_list_items.clear();
+    this->staged_and_or_items.clear();
+    this->staged_commands.clear();
+    this->staged_words.clear();
+    this->staged_redirects.clear();
+    this->staged_assignments.clear();
 }
 
 // ------------------------------------
@@ -84,7 +88,7 @@ std::optional<CmdSub> SyntaxTree<Tok>::cmdsub(Tok &tokenizer) const {
     tokenizer = sub_tok;
 
     return CmdSub{
-        .seq_list = std::make_unique<List>(take(compound_list)),
+        .seq_list = take(compound_list),
     };
 }
 
@@ -139,7 +143,7 @@ std::optional<ThisProgram> SyntaxTree<Tok>::program(Tok &tokenizer) const {
 template <IsTokenizer Tok>
 std::optional<CompleteCommands>
 SyntaxTree<Tok>::complete_commands(Tok &tokenizer) const {
-    CompleteCommands complete_commands;
+    std::vector<List> complete_commands;
 
     while (auto complete_command = this->complete_command(tokenizer)) {
         complete_commands.emplace_back(std::move(*complete_command));
@@ -148,7 +152,7 @@ SyntaxTree<Tok>::complete_commands(Tok &tokenizer) const {
             break;
     }
 
-    return complete_commands;
+    return this->ast.add_range(std::span<const List>{complete_commands});
 }
 
 /**
@@ -161,7 +165,7 @@ SyntaxTree<Tok>::complete_commands(Tok &tokenizer) const {
  * ```
  *
  * @param tokenizer
- * @return std::optional<SequentialList>
+ * @return std::optional<List>
  */
 template <IsTokenizer Tok>
 std::optional<List> SyntaxTree<Tok>::complete_command(Tok &tokenizer) const {
@@ -173,11 +177,13 @@ std::optional<List> SyntaxTree<Tok>::complete_command(Tok &tokenizer) const {
     // If the next token is a SEMI, the tokenizer will be automatically
     // advanced by the function.
     const auto sep = this->separator_op(tokenizer);
-    if (sep && sep->type == TokenType::andper && list) {
-        return AsyncList::from_seq(std::move(*list));
+    if (sep && sep->type == TokenType::andper) {
+        list->back().op = ListOp::async;
     }
 
-    return list;
+    return List{
+        .items = this->ast.add_range(std::span<const ListItem>{*list}),
+    };
 }
 
 /**
@@ -190,17 +196,18 @@ std::optional<List> SyntaxTree<Tok>::complete_command(Tok &tokenizer) const {
  * ```
  *
  * @param tokenizer
- * @return std::optional<SequentialList>
+ * @return std::optional<std::vector<ListItem>>
  */
 template <IsTokenizer Tok>
-std::optional<SequentialList> SyntaxTree<Tok>::list(Tok &tokenizer) const {
-    SequentialList retval{};
+std::optional<std::vector<ListItem>>
+SyntaxTree<Tok>::list(Tok &tokenizer) const {
+    std::vector<ListItem> retval{};
 
     auto first_op_list = this->and_or(tokenizer);
     if (!first_op_list)
         return std::nullopt;
 
-    retval.right = std::make_unique<OpList>(std::move(*first_op_list));
+    retval.emplace_back(*first_op_list, ListOp::sequential);
 
     // Check if there are other sequential list to concatenate to the return
     // value
@@ -219,23 +226,12 @@ std::optional<SequentialList> SyntaxTree<Tok>::list(Tok &tokenizer) const {
             break;
         }
 
-        SequentialList rotated_list{};
-
+        // The separator tells how the previous and_or is executed
         if (sep->type == TokenType::andper) {
-            // Convert the previous SequentialList to an AsyncList
-            rotated_list = SequentialList{
-                .left = std::make_unique<List>(
-                    AsyncList::from_seq(std::move(retval))),
-                .right = std::make_unique<OpList>(std::move(*next_op_list)),
-            };
-        } else {
-            rotated_list = SequentialList{
-                .left = std::make_unique<List>(std::move(retval)),
-                .right = std::make_unique<OpList>(std::move(*next_op_list)),
-            };
+            retval.back().op = ListOp::async;
         }
 
-        retval = std::move(rotated_list);
+        retval.emplace_back(*next_op_list, ListOp::sequential);
 
         tokenizer = sub_token;
     }
@@ -262,7 +258,7 @@ std::optional<OpList> SyntaxTree<Tok>::and_or(Tok &tokenizer) const {
     if (!pipeline)
         return std::nullopt;
 
-    OpList retval = std::move(*pipeline);
+    std::vector<AndOrItem> retval{{AndOrOp::first, *pipeline}};
 
     for (;;) {
         // Duplicate the tokenizer. By duplicating, if the parsing
@@ -291,19 +287,9 @@ std::optional<OpList> SyntaxTree<Tok>::and_or(Tok &tokenizer) const {
         }
 
         if (next_token->type == TokenType::and_and) {
-            AndList and_and{
-                .left = std::make_unique<OpList>(std::move(retval)),
-                .right = std::make_unique<OpList>(std::move(*rhs_pipeline)),
-            };
-
-            retval = std::move(and_and);
+            retval.emplace_back(AndOrOp::and_if, *rhs_pipeline);
         } else if (next_token->type == TokenType::or_or) {
-            OrList or_or{
-                .left = std::make_unique<OpList>(std::move(retval)),
-                .right = std::make_unique<OpList>(std::move(*rhs_pipeline)),
-            };
-
-            retval = std::move(or_or);
+            retval.emplace_back(AndOrOp::or_if, *rhs_pipeline);
         } else {
             assertm(false, "Should not be here!");
         }
@@ -312,7 +298,9 @@ std::optional<OpList> SyntaxTree<Tok>::and_or(Tok &tokenizer) const {
         tokenizer = sub_tok;
     }
 
-    return retval;
+    return OpList{
+        .items = this->ast.add_range(std::span<const AndOrItem>{retval}),
+    };
 }
 
 /**
@@ -329,17 +317,20 @@ std::optional<OpList> SyntaxTree<Tok>::and_or(Tok &tokenizer) const {
  */
 template <IsTokenizer Tok>
 std::optional<Pipeline> SyntaxTree<Tok>::pipeline(Tok &tokenizer) const {
+    Tok sub_tok{tokenizer};
     bool has_bang = false;
 
-    const auto bang = this->token(tokenizer, TokenType::bang);
+    const auto bang = this->token(sub_tok, TokenType::bang);
     if (bang) {
         has_bang = true;
     }
 
-    auto pipe_sequence = this->pipe_sequence(tokenizer);
-    if (pipe_sequence) {
-        pipe_sequence->negated = has_bang;
-    }
+    auto pipe_sequence = this->pipe_sequence(sub_tok);
+    if (!pipe_sequence)
+        return std::nullopt;
+
+    pipe_sequence->negated = has_bang;
+    tokenizer = sub_tok;
 
     return pipe_sequence;
 }
@@ -358,13 +349,13 @@ std::optional<Pipeline> SyntaxTree<Tok>::pipeline(Tok &tokenizer) const {
  */
 template <IsTokenizer Tok>
 std::optional<Pipeline> SyntaxTree<Tok>::pipe_sequence(Tok &tokenizer) const {
-    Pipeline retval{};
+    std::vector<Command> cmds{};
 
     auto first_command = this->command(tokenizer);
     if (!first_command.has_value())
         return std::nullopt;
 
-    retval.cmds.emplace_back(take(first_command));
+    cmds.emplace_back(take(first_command));
 
     // Check if there are other commands to concatenate to the return value
     for (;;) {
@@ -384,12 +375,14 @@ std::optional<Pipeline> SyntaxTree<Tok>::pipe_sequence(Tok &tokenizer) const {
             break;
         }
 
-        retval.cmds.emplace_back(take(next_command));
+        cmds.emplace_back(take(next_command));
 
         tokenizer = sub_token;
     }
 
-    return retval;
+    return Pipeline{
+        .cmds = this->ast.add_range(std::span<const Command>{cmds}),
+    };
 }
 
 /**
@@ -418,7 +411,8 @@ std::optional<Command> SyntaxTree<Tok>::command(Tok &tokenizer) const {
         // Add redirect list if present
         auto redirect_list = this->redirect_list(subshell_tok);
         if (redirect_list) {
-            subshell->redirections = std::move(*redirect_list);
+            subshell->redirections =
+                this->ast.add_range(std::span<const Redirect>{*redirect_list});
         }
 
         tokenizer = subshell_tok;
@@ -483,7 +477,7 @@ std::optional<Subshell> SyntaxTree<Tok>::subshell(Tok &tokenizer) const {
     tokenizer = sub_tokenizer;
 
     return Subshell{
-        .seq_list = std::make_unique<List>(std::move(*compound_list)),
+        .seq_list = take(compound_list),
     };
 }
 
@@ -497,7 +491,7 @@ std::optional<Subshell> SyntaxTree<Tok>::subshell(Tok &tokenizer) const {
  * ```
  *
  * @param tokenizer
- * @return std::optional<SequentialList>
+ * @return std::optional<List>
  */
 template <IsTokenizer Tok>
 std::optional<List> SyntaxTree<Tok>::compound_list(Tok &tokenizer) const {
@@ -511,14 +505,14 @@ std::optional<List> SyntaxTree<Tok>::compound_list(Tok &tokenizer) const {
 
     const auto sep = this->separator(sub_tok);
     if (sep && sep->type == TokenType::andper) {
-        tokenizer = sub_tok;
-
-        return AsyncList::from_seq(std::move(*term));
+        term->back().op = ListOp::async;
     }
 
     tokenizer = sub_tok;
 
-    return term;
+    return List{
+        .items = this->ast.add_range(std::span<const ListItem>{*term}),
+    };
 }
 
 /**
@@ -531,17 +525,18 @@ std::optional<List> SyntaxTree<Tok>::compound_list(Tok &tokenizer) const {
  * ```
  *
  * @param tokenizer
- * @return std::optional<OpList>
+ * @return std::optional<std::vector<ListItem>>
  */
 template <IsTokenizer Tok>
-std::optional<SequentialList> SyntaxTree<Tok>::term(Tok &tokenizer) const {
-    SequentialList retval{};
+std::optional<std::vector<ListItem>>
+SyntaxTree<Tok>::term(Tok &tokenizer) const {
+    std::vector<ListItem> retval{};
 
     auto and_or = this->and_or(tokenizer);
     if (!and_or)
         return std::nullopt;
 
-    retval.right = std::make_unique<OpList>(std::move(*and_or));
+    retval.emplace_back(*and_or, ListOp::sequential);
 
     // Check if there are other sequential list to concatenate to the return
     // value
@@ -560,23 +555,12 @@ std::optional<SequentialList> SyntaxTree<Tok>::term(Tok &tokenizer) const {
             break;
         }
 
-        SequentialList rotated_list{};
-
+        // The separator tells how the previous and_or is executed
         if (sep->type == TokenType::andper) {
-            // Convert the previous SequentialList to an AsyncList
-            rotated_list = SequentialList{
-                .left = std::make_unique<List>(
-                    AsyncList::from_seq(std::move(retval))),
-                .right = std::make_unique<OpList>(std::move(*next_op_list)),
-            };
-        } else {
-            rotated_list = SequentialList{
-                .left = std::make_unique<List>(std::move(retval)),
-                .right = std::make_unique<OpList>(std::move(*next_op_list)),
-            };
+            retval.back().op = ListOp::async;
         }
 
-        retval = std::move(rotated_list);
+        retval.emplace_back(*next_op_list, ListOp::sequential);
 
         tokenizer = sub_token;
     }
@@ -626,16 +610,20 @@ std::optional<Command> SyntaxTree<Tok>::simple_command(Tok &tokenizer) const {
 
         if (!cmd_word) {
             return SimpleAssignment{
-                .redirections = redirects,
-                .envs = assigments,
+                .redirections =
+                    this->ast.add_range(std::span<const Redirect>{redirects}),
+                .envs = this->ast.add_range(
+                    std::span<const AssignmentWord>{assigments}),
             };
         }
 
         return UnsubCommand{
-            .program = std::make_unique<Word>(take(cmd_word)),
-            .arguments = std::move(args),
-            .redirections = std::move(redirects),
-            .envs = std::move(assigments),
+            .program = take(cmd_word),
+            .arguments = this->ast.add_range(std::span<const Word>{args}),
+            .redirections =
+                this->ast.add_range(std::span<const Redirect>{redirects}),
+            .envs = this->ast.add_range(
+                std::span<const AssignmentWord>{assigments}),
         };
     }
 
@@ -654,9 +642,10 @@ std::optional<Command> SyntaxTree<Tok>::simple_command(Tok &tokenizer) const {
         }
 
         return UnsubCommand{
-            .program = std::make_unique<Word>(take(cmd_name)),
-            .arguments = std::move(args),
-            .redirections = std::move(redirects),
+            .program = take(cmd_name),
+            .arguments = this->ast.add_range(std::span<const Word>{args}),
+            .redirections =
+                this->ast.add_range(std::span<const Redirect>{redirects}),
             .envs = {},
         };
     }
@@ -835,7 +824,7 @@ std::optional<Redirect> SyntaxTree<Tok>::io_redirect(Tok &tokenizer) const {
         return std::nullopt;
 
     if (io_number->type == TokenType::io_number) {
-        const auto tmp_num = std::string(io_number->value);
+        const auto tmp_num = std::string(io_number->view(tokenizer.source()));
         new_redirect_fd = std::atoi(tmp_num.c_str());
 
         // Commit advancement to the tokenizer
@@ -864,8 +853,8 @@ std::optional<Redirect> SyntaxTree<Tok>::io_redirect(Tok &tokenizer) const {
     return redirect;
 }
 
-static Redirect convert_and_redirect(const int default_fd,
-                                     const std::string_view filename) {
+Redirect convert_and_redirect(const int default_fd,
+                              const std::string_view filename) {
     assertm(!filename.empty(),
             "filename must not be empty, other wise std::from_chars will fail");
 
@@ -990,7 +979,7 @@ SyntaxTree<Tok>::filename(Tok &tokenizer) const {
 
     tokenizer.next_token();
 
-    return word->value;
+    return word->view(tokenizer.source());
 }
 
 /**
@@ -1018,7 +1007,7 @@ bool SyntaxTree<Tok>::newline_list(Tok &tokenizer) const {
 
     for (;;) {
         const auto next_newline = tokenizer.peek();
-        if (!newline || next_newline->type != TokenType::new_line)
+        if (!next_newline || next_newline->type != TokenType::new_line)
             break;
 
         tokenizer.next_token();
@@ -1127,13 +1116,14 @@ SyntaxTree<Tok>::assignment_word(Tok &tokenizer) const {
     if (!word)
         return std::nullopt;
 
-    const auto eq_pos = word->value.find(eq);
+    const std::string_view text = word->view(tokenizer.source());
+    const auto eq_pos = text.find(eq);
 
     if (eq_pos == 0 || eq_pos == std::string::npos)
         return std::nullopt;
 
-    std::string_view key = word->value.substr(0, eq_pos);
-    std::string_view value = word->value.substr(eq_pos + eq.size());
+    std::string_view key = text.substr(0, eq_pos);
+    std::string_view value = text.substr(eq_pos + eq.size());
 
     tokenizer = sub_tok;
 
@@ -1159,6 +1149,5 @@ inline std::optional<Token> SyntaxTree<Tok>::token(Tok &tokenizer,
 // TEMPLATE INSTATIATION
 // ------------------------------------
 
-template class SyntaxTree<Tokenizer>;
 template class SyntaxTree<UnbufferedTokenizer>;
 template class SyntaxTree<TokenIter>;
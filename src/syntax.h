@@ -3,10 +3,15 @@
 
 #include "tokenizer.h"
 #include "util.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
 #include <format>
-#include <memory>
 #include <optional>
+#include <span>
 #include <string_view>
+#include <type_traits>
+#include <utility>
 #include <variant>
 #include <vector>
 
@@ -17,6 +22,28 @@ enum class OpenKind {
     rw,
 };
 
+// ------------------------------------
+// Node references
+// ------------------------------------
+
+/**
+ * Index of a node stored in an Ast.
+ */
+template <typename T> struct NodeRef {
+    uint32_t index;
+};
+
+/**
+ * Nodes stored next to each other in an Ast, like the arguments of a
+ * command.
+ */
+template <typename T> struct NodeRange {
+    uint32_t begin = 0;
+    uint32_t size = 0;
+
+    bool empty() const { return this->size == 0; }
+};
+
 struct CmdSub;
 struct VarSub;
 
@@ -47,90 +74,307 @@ struct CloseFd {
 
 using Redirect = std::variant<FileRedirect, FdRedirect, CloseFd>;
 
+/**
+ * Redirect of `<&` and `>&`: `filename` is either a file descriptor or `-`.
+ */
+Redirect convert_and_redirect(int default_fd, std::string_view filename);
+
 struct SimpleAssignment {
-    std::vector<Redirect> redirections;
-    std::vector<AssignmentWord> envs;
+    NodeRange<Redirect> redirections;
+    NodeRange<AssignmentWord> envs;
 };
 
+/**
+ * Command with all the words expanded. The views point either inside the
+ * input or inside the scratch arena of the Executor, they are valid until the
+ * command is executed.
+ */
 struct SimpleCommand {
-    std::string program;
-    std::vector<std::string> arguments;
-    std::vector<Redirect> redirections;
-    std::vector<AssignmentWord> envs;
+    std::string_view program;
+    std::vector<std::string_view> arguments;
+    std::span<const Redirect> redirections;
+    // Assignments in the `key=value` form
+    std::vector<std::string_view> envs;
 
     std::string text() const;
 };
 
-struct UnsubCommand {
-    std::unique_ptr<Word> program;
-    std::vector<Word> arguments;
-    std::vector<Redirect> redirections;
-    std::vector<AssignmentWord> envs;
-};
-
-struct AndList;
-struct OrList;
+struct UnsubCommand;
 struct Subshell;
-struct Pipeline;
-struct SequentialList;
-struct AsyncList;
 
 using Command = std::variant<SimpleAssignment, UnsubCommand, Subshell>;
-using OpList = std::variant<AndList, OrList, Pipeline>;
-using List = std::variant<SequentialList, AsyncList>;
 
-struct AndList {
-    std::unique_ptr<OpList> left;
-    std::unique_ptr<OpList> right;
+/**
+ * Operator that joins a pipeline to the ones before it in an and_or.
+ */
+enum class AndOrOp : uint8_t {
+    // The first pipeline, always executed
+    first,
+    // `&&`: executed if the previous pipelines succeeded
+    and_if,
+    // `||`: executed if the previous pipelines failed
+    or_if,
 };
 
-struct OrList {
-    std::unique_ptr<OpList> left;
-    std::unique_ptr<OpList> right;
+/**
+ * Separator that terminates an and_or inside a list.
+ */
+enum class ListOp : uint8_t {
+    // `;`, a newline or nothing: the shell waits for the and_or
+    sequential,
+    // `&`: the and_or is executed in the background
+    async,
 };
 
-struct Pipeline {
-    std::vector<Command> cmds;
-    bool negated;
+struct AndOrItem;
+struct ListItem;
+
+/**
+ * Pipelines joined by `&&` and `||`. They are kept in a flat range and
+ * evaluated from left to right, both operators have the same precedence.
+ */
+struct OpList {
+    NodeRange<AndOrItem> items;
+};
+
+/**
+ * And_ors terminated by `;`, `&` or a newline, kept in a flat range.
+ */
+struct List {
+    NodeRange<ListItem> items;
+};
+
+// ------------------------------------
+// Substitutions
+// ------------------------------------
+
+struct VarSub {
+    Token token;
 };
 
-struct SequentialList {
-    optional_ptr<List> left;
-    std::unique_ptr<OpList> right;
+struct CmdSub {
+    List seq_list;
+};
 
-    static SequentialList from_async(AsyncList &&async);
+// ------------------------------------
+// Commands
+// ------------------------------------
+
+struct UnsubCommand {
+    Word program;
+    NodeRange<Word> arguments;
+    NodeRange<Redirect> redirections;
+    NodeRange<AssignmentWord> envs;
+};
+
+struct Pipeline {
+    NodeRange<Command> cmds;
+    bool negated;
 };
 
-struct AsyncList {
-    optional_ptr<List> left;
-    std::unique_ptr<OpList> right;
+struct AndOrItem {
+    AndOrOp op;
+    Pipeline pipeline;
+};
 
-    static AsyncList from_seq(SequentialList &&seq);
+struct ListItem {
+    OpList op_list;
+    ListOp op;
 };
 
 struct Subshell {
-    std::unique_ptr<List> seq_list;
-    std::vector<Redirect> redirections;
+    List seq_list;
+    NodeRange<Redirect> redirections;
 };
 
-using CompleteCommands = std::vector<List>;
+using CompleteCommands = NodeRange<List>;
 
 struct ThisProgram {
     CompleteCommands child;
 };
 
 // ------------------------------------
-// Substitutions
+// Ast
 // ------------------------------------
 
-struct VarSub {
-    Token token;
-};
+/**
+ * Storage of the nodes of the syntax trees.
+ *
+ * Each kind of node has its own vector and the nodes refer to each other
+ * with 32-bit indices instead of pointers. Every node is trivially
+ * destructible, so clear() drops all the trees in O(1) and the vectors keep
+ * their memory for the next ones: once the shell has parsed a few commands,
+ * parsing does not allocate anymore.
+ *
+ * The references returned by operator[] are invalidated when a node of the
+ * same kind is added.
+ */
+class Ast {
+    std::vector<List> lists;
+    std::vector<ListItem> list_items;
+    std::vector<AndOrItem> and_or_items;
+    std::vector<Command> commands;
+    std::vector<Word> words;
+    std::vector<Redirect> redirects;
+    std::vector<AssignmentWord> assignments;
+
+    // Children of the nodes that are being parsed, see stage()
+    std::vector<List> staged_lists;
+    std::vector<ListItem> staged_list_items;
+    std::vector<AndOrItem> staged_and_or_items;
+    std::vector<Command> staged_commands;
+    std::vector<Word> staged_words;
+    std::vector<Redirect> staged_redirects;
+    std::vector<AssignmentWord> staged_assignments;
+
+    // Times a vector had to grow
+    size_t growths = 0;
+
+    template <typename T> std::vector<T> &nodes();
+    template <typename T> const std::vector<T> &nodes() const;
+    template <typename T> std::vector<T> &staged_nodes();
+    template <typename T> void reserve_one(std::vector<T> &vec);
 
-struct CmdSub {
-    std::unique_ptr<List> seq_list;
+  public:
+    template <typename T> NodeRef<T> add(T node);
+
+    /**
+     * Copies `nodes` at the end of the storage.
+     */
+    template <typename T> NodeRange<T> add_range(std::span<const T> nodes);
+
+    /**
+     * The children of a node can contain nodes of their same kind (the
+     * commands of a subshell inside a pipeline), so they cannot be added one
+     * by one. They are staged instead and moved at once in the storage by
+     * commit(), which takes the size of the stage before the first child was
+     * staged. Stages that are never committed are dropped by clear().
+     */
+    template <typename T> size_t staged() { return staged_nodes<T>().size(); }
+    template <typename T> void stage(T node);
+    template <typename T> NodeRange<T> commit(size_t begin);
+
+    template <typename T> const T &operator[](NodeRef<T> ref) const {
+        return this->nodes<T>()[ref.index];
+    }
+
+    template <typename T>
+    std::span<const T> operator[](NodeRange<T> range) const {
+        return std::span{this->nodes<T>()}.subspan(range.begin, range.size);
+    }
+
+    /**
+     * Number of nodes stored.
+     */
+    size_t size() const;
+
+    /**
+     * Number of times the storage grew since the Ast was created.
+     */
+    size_t allocations() const { return this->growths; }
+
+    void clear();
 };
 
+template <typename T> std::vector<T> &Ast::nodes() {
+    return const_cast<std::vector<T> &>(std::as_const(*this).nodes<T>());
+}
+
+template <typename T> const std::vector<T> &Ast::nodes() const {
+    static_assert(std::is_trivially_destructible_v<T>,
+                  "clear() must not run any destructor");
+
+    if constexpr (std::is_same_v<T, List>)
+        return this->lists;
+    else if constexpr (std::is_same_v<T, ListItem>)
+        return this->list_items;
+    else if constexpr (std::is_same_v<T, AndOrItem>)
+        return this->and_or_items;
+    else if constexpr (std::is_same_v<T, Command>)
+        return this->commands;
+    else if constexpr (std::is_same_v<T, Word>)
+        return this->words;
+    else if constexpr (std::is_same_v<T, Redirect>)
+        return this->redirects;
+    else if constexpr (std::is_same_v<T, AssignmentWord>)
+        return this->assignments;
+    else
+        static_assert(!sizeof(T), "Not a node of the Ast");
+}
+
+template <typename T> std::vector<T> &Ast::staged_nodes() {
+    if constexpr (std::is_same_v<T, List>)
+        return this->staged_lists;
+    else if constexpr (std::is_same_v<T, ListItem>)
+        return this->staged_list_items;
+    else if constexpr (std::is_same_v<T, AndOrItem>)
+        return this->staged_and_or_items;
+    else if constexpr (std::is_same_v<T, Command>)
+        return this->staged_commands;
+    else if constexpr (std::is_same_v<T, Word>)
+        return this->staged_words;
+    else if constexpr (std::is_same_v<T, Redirect>)
+        return this->staged_redirects;
+    else if constexpr (std::is_same_v<T, AssignmentWord>)
+        return this->staged_assignments;
+    else
+        static_assert(!sizeof(T), "Not a node that can be staged");
+}
+
+template <typename T> void Ast::reserve_one(std::vector<T> &vec) {
+    if (vec.size() == vec.capacity()) {
+        vec.reserve(std::max<size_t>(vec.capacity() * 2, 64));
+        ++this->growths;
+    }
+}
+
+template <typename T> NodeRef<T> Ast::add(T node) {
+    auto &nodes = this->nodes<T>();
+    this->reserve_one(nodes);
+
+    nodes.push_back(std::move(node));
+
+    return NodeRef<T>{static_cast<uint32_t>(nodes.size() - 1)};
+}
+
+template <typename T>
+NodeRange<T> Ast::add_range(std::span<const T> added) {
+    auto &nodes = this->nodes<T>();
+    const NodeRange<T> range{
+        .begin = static_cast<uint32_t>(nodes.size()),
+        .size = static_cast<uint32_t>(added.size()),
+    };
+
+    const size_t size = nodes.size() + added.size();
+
+    if (size > nodes.capacity()) {
+        nodes.reserve(std::max(nodes.capacity() * 2, size));
+        ++this->growths;
+    }
+
+    nodes.insert(nodes.end(), added.begin(), added.end());
+
+    return range;
+}
+
+template <typename T> void Ast::stage(T node) {
+    auto &staged = this->staged_nodes<T>();
+    this->reserve_one(staged);
+
+    staged.push_back(std::move(node));
+}
+
+template <typename T> NodeRange<T> Ast::commit(const size_t begin) {
+    auto &staged = this->staged_nodes<T>();
+    assertm(begin <= staged.size(), "The stage was already committed");
+
+    const auto range =
+        this->add_range(std::span<const T>{staged}.subspan(begin));
+    staged.resize(begin);
+
+    return range;
+}
+
 // ---------------------------
 // SyntaxTree
 // ---------------------------
@@ -142,7 +386,12 @@ struct CmdSub {
  * Remember to add the definitions of new methods in syntax-impl.cpp.
  */
 template <IsTokenizer Tok> class SyntaxTree {
+    // Storage of the parsed nodes
+    Ast &ast;
+
   public:
+    explicit SyntaxTree(Ast &ast) : ast(ast) {}
+
     std::optional<CmdSub> cmdsub(Tok &tokenizer) const;
 
     // --------------------------------
@@ -155,7 +404,7 @@ template <IsTokenizer Tok> class SyntaxTree {
 
     std::optional<List> complete_command(Tok &tokenizer) const;
 
-    std::optional<SequentialList> list(Tok &tokenizer) const;
+    std::optional<std::vector<ListItem>> list(Tok &tokenizer) const;
 
     std::optional<OpList> and_or(Tok &tokenizer) const;
 
@@ -171,7 +420,7 @@ template <IsTokenizer Tok> class SyntaxTree {
 
     std::optional<List> compound_list(Tok &tokenizer) const;
 
-    std::optional<SequentialList> term(Tok &tokenizer) const;
+    std::optional<std::vector<ListItem>> term(Tok &tokenizer) const;
 
     std::optional<Command> simple_command(Tok &tokenizer) const;
 
@@ -227,6 +476,86 @@ constexpr std::string_view to_string(const OpenKind kind) {
     }
 }
 
+constexpr std::string_view to_string(const AndOrOp op) {
+    switch (op) {
+    case AndOrOp::first:
+        return "first";
+    case AndOrOp::and_if:
+        return "and_if";
+    case AndOrOp::or_if:
+        return "or_if";
+    }
+}
+
+constexpr std::string_view to_string(const ListOp op) {
+    switch (op) {
+    case ListOp::sequential:
+        return "sequential";
+    case ListOp::async:
+        return "async";
+    }
+}
+
+/**
+ * Node printed with the Ast that stores the nodes it refers to:
+ *
+ * ```c++
+ * std::println("{:#?}", InAst{ast, program});
+ * ```
+ */
+template <typename T> struct InAst {
+    const Ast &ast;
+    const T &node;
+};
+
+template <typename T, typename CharT>
+struct std::formatter<InAst<T>, CharT> : debug_spec {
+    auto format(const InAst<T> &in, auto &ctx) const {
+        std::formatter<T, CharT> fmt{*this};
+        fmt.context = &in.ast;
+
+        return fmt.format(in.node, ctx);
+    }
+};
+
+template <typename T, typename CharT>
+struct std::formatter<NodeRef<T>, CharT> : debug_spec {
+    template <typename FormatContext>
+    typename FormatContext::iterator format(const NodeRef<T> &ref,
+                                            FormatContext &ctx) const {
+        assertm(this->context != nullptr, "Format the tree with InAst");
+
+        const auto &ast = *static_cast<const Ast *>(this->context);
+        return this->iformat(ast[ref], ctx);
+    }
+};
+
+template <typename T, typename CharT>
+struct std::formatter<NodeRange<T>, CharT> : debug_spec {
+    template <typename FormatContext>
+    typename FormatContext::iterator format(const NodeRange<T> &range,
+                                            FormatContext &ctx) const {
+        assertm(this->context != nullptr, "Format the tree with InAst");
+
+        const auto &ast = *static_cast<const Ast *>(this->context);
+        const std::span<const T> nodes = ast[range];
+
+        auto out = ctx.out();
+        *out++ = '[';
+
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            this->field(std::to_string(i), nodes[i], ctx);
+        }
+
+        if (this->pretty && !nodes.empty()) {
+            std::format_to(out, "\n{}", std::string(this->spaces - 4, ' '));
+        }
+
+        *out++ = ']';
+        return out;
+    }
+};
+
 template <typename CharT>
 struct std::formatter<AssignmentWord, CharT> : debug_spec {
     auto format(const AssignmentWord &a, auto &ctx) const {
@@ -328,17 +657,36 @@ template <HasChild T> struct std::formatter<T> : debug_spec {
     }
 };
 
-template <typename T>
-concept HasLeftRight = requires(T t) {
-    t.left;
-    t.right;
+template <> struct std::formatter<AndOrItem> : debug_spec {
+    auto format(const AndOrItem &item, auto &ctx) const {
+        this->start<AndOrItem>(ctx);
+        this->field("op", to_string(item.op), ctx);
+        this->field("pipeline", item.pipeline, ctx);
+        return this->finish(ctx);
+    }
 };
 
-template <HasLeftRight T> struct std::formatter<T> : debug_spec {
-    auto format(const T &node, auto &ctx) const {
-        this->start<T>(ctx);
-        this->field("left", node.left, ctx);
-        this->field("right", node.right, ctx);
+template <> struct std::formatter<OpList> : debug_spec {
+    auto format(const OpList &op_list, auto &ctx) const {
+        this->start<OpList>(ctx);
+        this->field("items", op_list.items, ctx);
+        return this->finish(ctx);
+    }
+};
+
+template <> struct std::formatter<ListItem> : debug_spec {
+    auto format(const ListItem &item, auto &ctx) const {
+        this->start<ListItem>(ctx);
+        this->field("op_list", item.op_list, ctx);
+        this->field("op", to_string(item.op), ctx);
+        return this->finish(ctx);
+    }
+};
+
+template <> struct std::formatter<List> : debug_spec {
+    auto format(const List &list, auto &ctx) const {
+        this->start<List>(ctx);
+        this->field("items", list.items, ctx);
         return this->finish(ctx);
     }
 };
@@ -1,12 +1,15 @@
 #include "tokenizer.h"
 #include "re2/re2.h"
+#include "scanner.h"
+#include "stats.h"
+#include <algorithm>
 #include <cassert>
+#include <cstdlib>
 #include <deque>
-#include <ranges>
+#include <limits>
+#include <print>
 #include <span>
 
-namespace vw = std::ranges::views;
-
 struct CompiledSpec {
     const re2::RE2 &regex;
     TokenType spec_type;
@@ -50,7 +53,7 @@ static constexpr Specification _specs[] = {
     // - L: match unicode literal
     // - Nd: match unicode numbers
     // - So: other symbol
-    {R"(^((?:[\p{L}\p{Nd}\p{So}=\-\/.]|\\.)+))", TokenType::word},
+    {R"(^((?:[\p{L}\p{Nd}\p{So}=\-\/.:_%+,\[\]]|\\.)+))", TokenType::word},
 
     // Quoatations
     {R"(^('[^']*'))", TokenType::quoted_word},
@@ -98,30 +101,134 @@ std::span<const CompiledSpec> compiled_specs() {
     return specs_ref;
 }
 
+// ------------------------------------
+// Engines
+// ------------------------------------
+
+static std::optional<ScanMatch> scan_re2(std::string_view input) {
+    std::string_view match{};
+
+    for (const auto &spec : compiled_specs()) {
+        ++stats().regex_evals;
+
+        if (!RE2::PartialMatch(input, spec.regex, &match))
+            continue;
+
+        assert(match.length() <= input.length());
+
+        return ScanMatch{spec.spec_type, match.length()};
+    }
+
+    return std::nullopt;
+}
+
+static LexerEngine engine_from_env() {
+    const char *name = std::getenv("TESTSH_LEXER");
+    if (name == nullptr)
+        return LexerEngine::table;
+
+    const std::string_view engine{name};
+
+    if (engine == "table")
+        return LexerEngine::table;
+    if (engine == "re2")
+        return LexerEngine::re2;
+    if (engine == "check")
+        return LexerEngine::check;
+
+    std::println(stderr, "testsh: unknown TESTSH_LEXER={}, using table",
+                 engine);
+    return LexerEngine::table;
+}
+
+std::optional<ScanMatch> scan(std::string_view input) {
+    static const LexerEngine engine = engine_from_env();
+
+    ++stats().lexer_scans;
+
+    switch (engine) {
+    case LexerEngine::table:
+        return scan_table(input);
+
+    case LexerEngine::re2:
+        return scan_re2(input);
+
+    case LexerEngine::check: {
+        const auto table = scan_table(input);
+        const auto reference = scan_re2(input);
+
+        if (table != reference) {
+            const auto describe = [](const std::optional<ScanMatch> &m) {
+                if (!m)
+                    return std::string{"no match"};
+
+                return std::format("{}({})", to_string(m->type), m->length);
+            };
+
+            std::println(stderr,
+                         "testsh: lexer mismatch on \"{}\": table={} re2={}",
+                         input.substr(0, 32), describe(table),
+                         describe(reference));
+            std::abort();
+        }
+
+        return table;
+    }
+    }
+
+    std::unreachable();
+}
+
 // ------------------------------------
 // Token
 // ------------------------------------
 
-std::string Token::text() const {
-    std::string retval;
+// Largest input whose offsets, up to the one of the eof, fit in a Token
+static constexpr size_t max_input = std::numeric_limits<uint32_t>::max();
+
+std::string_view Token::view(std::string_view source) const {
+    return source.substr(this->offset, this->length);
+}
+
+std::string_view Token::text(std::string_view source,
+                             ScratchArena &scratch) const {
+    const std::string_view value = this->view(source);
 
     switch (type) {
-    case TokenType::word:
-        std::ranges::copy(
-            value | vw::filter([](const char c) { return c != '\\'; }),
-            std::back_inserter(retval));
-        break;
+    case TokenType::word: {
+        if (!(this->flags & Flags::has_escapes))
+            return value;
+
+        char *const begin = scratch.allocate(value.size());
+        char *const end = std::ranges::remove_copy(value, begin, '\\').out;
+
+        return {begin, static_cast<size_t>(end - begin)};
+    }
 
     case TokenType::quoted_word:
-        retval = value.substr(1, value.size() - 2);
-        break;
+        return value.substr(1, value.size() - 2);
 
     default:
-        retval = value;
-        break;
+        return value;
     }
+}
+
+static Token make_token(const ScanMatch &match, std::string_view input,
+                        size_t offset) {
+    assertm(offset + match.length <= max_input,
+            "The offsets of the tokens are 32 bits");
 
-    return retval;
+    Token token{
+        .type = match.type,
+        .offset = static_cast<uint32_t>(offset),
+        .length = static_cast<uint32_t>(match.length),
+    };
+
+    if (token.type == TokenType::word &&
+        token.view(input).find('\\') != std::string_view::npos)
+        token.flags |= Token::Flags::has_escapes;
+
+    return token;
 }
 
 // ------------------------------------
@@ -129,29 +236,20 @@ std::string Token::text() const {
 // ------------------------------------
 
 std::optional<Token> UnbufferedTokenizer::next_token() {
-    std::string_view match{};
-
-    for (const auto &spec : compiled_specs()) {
-        if (!RE2::PartialMatch(this->input, spec.regex, &match))
-            continue;
-
-        const Token token{.type = spec.spec_type,
-                          .value = match,
-                          .start = this->string_offset,
-                          .end = this->string_offset + match.length()};
+    for (;;) {
+        const auto match = scan(this->input.substr(this->string_offset));
+        if (!match)
+            return std::nullopt;
 
-        assert(match.length() <= this->input.length());
+        const Token token = make_token(*match, this->input, this->string_offset);
 
-        this->input = this->input.substr(match.length());
-        this->string_offset += match.length();
+        this->string_offset += match->length;
 
         if (token.type == TokenType::separator)
             continue;
 
         return token;
     }
-
-    return std::nullopt;
 }
 
 bool UnbufferedTokenizer::next_is_eof() const {
@@ -167,101 +265,208 @@ std::optional<Token> UnbufferedTokenizer::peek() const {
     return copy.next_token();
 }
 
+std::string_view UnbufferedTokenizer::source() const { return this->input; }
+
 // ------------------------------------
-// TOKENIZER
+// IncrementalLexer
 // ------------------------------------
 
-Tokenizer::Tokenizer(const TokState &state) : state(state), prev_state() {}
+bool IncrementalLexer::fits(size_t size) {
+    if (size <= max_input - this->arena.size())
+        return true;
 
-void Tokenizer::update_prev() { this->prev_state = this->state; }
+    // The input is not truncated, the lexing stops before it
+    if (!this->failed) {
+        std::println(stderr, "testsh: input larger than {} bytes", max_input);
+        this->failed = true;
+    }
+
+    return false;
+}
+
+bool IncrementalLexer::ends_with_continuation() const {
+    const size_t size = this->tokens.size();
+
+    return size >= 2 && this->tokens[size - 1].type == TokenType::new_line &&
+           this->tokens[size - 2].type == TokenType::line_continuation;
+}
+
+void IncrementalLexer::lex_from(size_t offset) {
+    const std::string_view input = this->arena.view();
+
+    for (;;) {
+        const auto match = scan(input.substr(offset));
+        if (!match) {
+            this->failed = true;
+            return;
+        }
 
-/**
- * Advances the `buffered_input` and stores the leftover string
- * into a new UnbufferedTokenizer. The previous tokenizer must
- * be exausted before calling this method.
- *
- * Returns false if the buffer was empty.
- */
-bool Tokenizer::advance_buffer() {
-    if (this->state.buffered_input.size() == 0)
-        return false;
+        if (match->type == TokenType::eof)
+            return;
 
-    assertm(
-        this->state.inner_tokenizer.peek().value().type == TokenType::eof,
-        "The inner tokenizer must be empty before advancing the line buffer!");
+        // Fed one line at a time, a quote that spans lines would not be
+        // terminated yet and the lexing would fail on it
+        if (match->type == TokenType::quoted_word &&
+            input.substr(offset, match->length).contains('\n')) {
+            this->failed = true;
+            return;
+        }
 
-    this->state.inner_tokenizer =
-        UnbufferedTokenizer{this->state.buffered_input[0]};
+        if (match->type != TokenType::separator) {
+            this->tokens.push_back(make_token(*match, input, offset));
 
-    this->state.buffered_input = this->state.buffered_input.subspan(1);
+            ++stats().tokens;
+        }
 
-    return true;
+        offset += match->length;
+    }
 }
 
-Tokenizer::Tokenizer(std::span<std::string> buffered_input)
-    : state{.buffered_input = buffered_input, .inner_tokenizer = {""}} {}
+void IncrementalLexer::feed(std::string_view lines) {
+    ScopedTimer timer{stats().lex_time};
+
+    if (!this->fits(lines.size()))
+        return;
+
+    size_t resume = this->arena.size();
+
+    if (this->ends_with_continuation()) {
+        // Splice the backslash-newline out of the input
+        this->tokens.pop_back();
+        const Token continuation = this->tokens.back();
+        this->tokens.pop_back();
+
+        this->arena.truncate(continuation.offset);
+        resume = continuation.offset;
+
+        // A token attached to the continuation might go on in the new line
+        if (!this->tokens.empty() &&
+            this->tokens.back().end() == continuation.offset) {
+            resume = this->tokens.back().offset;
+            this->tokens.pop_back();
+        }
+    }
+
+    this->line_begin = this->tokens.size();
+    this->arena.append(lines);
+
+    if (this->failed)
+        return;
+
+    this->lex_from(resume);
 
-size_t Tokenizer::buffer_size() const {
-    // +1 because the last buffer is contained inside the UnbufferedTokenizer
-    return this->state.buffered_input.size() + 1;
+    // needs_more() looks at the last line that was fed
+    for (size_t i = this->tokens.size(); i > this->line_begin + 1; --i) {
+        if (this->tokens[i - 2].type == TokenType::new_line) {
+            this->line_begin = i - 1;
+            break;
+        }
+    }
 }
 
-std::optional<Tokenizer> Tokenizer::prev() const {
-    if (!this->prev_state)
-        return std::nullopt;
+void IncrementalLexer::append(const IncrementalLexer &next, LexerMark begin,
+                              LexerMark end) {
+    assertm(!this->failed, "Nothing is lexed after a failure");
+    assertm(!this->ends_with_continuation(),
+            "The appended lines would continue the last one");
+    assertm(!begin.failed, "Nothing is lexed after a failure");
+
+    if (!this->fits(end.input - begin.input))
+        return;
+
+    const std::string_view input = next.input();
+    const auto base = static_cast<uint32_t>(begin.input);
+    const auto shift = static_cast<uint32_t>(this->arena.size());
+
+    const auto tokens = std::span{next.tokens}.subspan(
+        begin.tokens, end.tokens - begin.tokens);
 
-    return Tokenizer{*prev_state};
+    this->arena.append(input.substr(begin.input, end.input - begin.input));
+    // No line was fed between the marks if the line began before them
+    this->line_begin = this->tokens.size() +
+                       std::max(end.line_begin, begin.tokens) - begin.tokens;
+    this->tokens.reserve(this->tokens.size() + tokens.size());
+
+    for (Token token : tokens) {
+        token.offset = token.offset - base + shift;
+        this->tokens.push_back(token);
+    }
+
+    this->failed = end.failed;
 }
 
-std::optional<Token> Tokenizer::next_token() {
-    this->update_prev();
-    auto token = this->state.inner_tokenizer.next_token();
+LexerMark IncrementalLexer::mark() const {
+    return LexerMark{
+        .input = this->arena.size(),
+        .tokens = this->tokens.size(),
+        .line_begin = this->line_begin,
+        .failed = this->failed,
+    };
+}
+
+bool IncrementalLexer::needs_more() const {
+    TokenType prev = TokenType::eof;
 
-    while (token.has_value() && token->type == TokenType::eof) {
-        if (!this->advance_buffer())
+    for (const auto &token : std::span{this->tokens}.subspan(line_begin)) {
+        if (token.type == TokenType::new_line)
             break;
 
-        token = this->state.inner_tokenizer.next_token();
+        prev = token.type;
     }
 
-    return token;
+    return prev == TokenType::line_continuation || prev == TokenType::and_and ||
+           prev == TokenType::or_or || prev == TokenType::pipe;
 }
 
-bool Tokenizer::next_is_eof() const {
-    if (const auto next = this->peek())
-        return next->type == TokenType::eof;
+std::span<const Token> IncrementalLexer::finish() {
+    if (!this->failed) {
+        this->tokens.push_back(Token{
+            .type = TokenType::eof,
+            .offset = static_cast<uint32_t>(this->arena.size()),
+        });
+    }
 
-    return false;
+    return this->tokens;
 }
 
-std::optional<Token> Tokenizer::peek() const {
-    Tokenizer copy{*this};
+std::string_view IncrementalLexer::input() const { return this->arena.view(); }
 
-    return copy.next_token();
+void IncrementalLexer::reset() {
+    this->arena.clear();
+    this->tokens.clear();
+    this->line_begin = 0;
+    this->failed = false;
 }
 
 // ------------------------------------
 // TokenIter
 // ------------------------------------
 
-TokenIter::TokenIter(std::span<Token> tokens) : tokens(tokens) {}
+TokenIter::TokenIter(std::span<const Token> tokens, std::string_view input)
+    : tokens(tokens), input(input) {}
 
 std::optional<Token> TokenIter::next_token() {
-    if (this->tokens.empty())
-        return std::nullopt;
-
-    const Token token = this->tokens.front();
+    const auto token = this->peek();
 
-    this->tokens = this->tokens.subspan(1);
+    // Like the tokenizers, keep returning eof once the input is over
+    if (token && token->type != TokenType::eof)
+        ++this->pos;
 
     return token;
 }
 
-bool TokenIter::next_is_eof() const { return this->tokens.empty(); }
+bool TokenIter::next_is_eof() const {
+    if (const auto next = this->peek())
+        return next->type == TokenType::eof;
+
+    return false;
+}
 
 std::optional<Token> TokenIter::peek() const {
-    if (this->tokens.empty())
+    if (this->pos >= this->tokens.size())
         return std::nullopt;
 
-    return this->tokens.front();
+    return this->tokens[this->pos];
 }
+
+std::string_view TokenIter::source() const { return this->input; }
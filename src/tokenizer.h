@@ -1,15 +1,18 @@
 #ifndef TESTSH_TOKENIZER_H
 #define TESTSH_TOKENIZER_H
 
+#include "arena.h"
 #include "util.h"
+#include <cstdint>
 #include <format>
 #include <optional>
 #include <span>
 #include <string>
 #include <string_view>
 #include <utility>
+#include <vector>
 
-enum class TokenType {
+enum class TokenType : uint8_t {
     word,
     quoted_word,
     separator,
@@ -37,24 +40,78 @@ enum class TokenType {
     eof,
 };
 
+/**
+ * A token only stores its position inside the input, the text is
+ * materialized on demand from the input that was lexed, see view() and
+ * text(). Keeping it small makes the token buffers cheap to fill and scan.
+ */
 struct Token {
+    enum Flags : uint8_t {
+        none = 0,
+        // The word contains at least one backslash
+        has_escapes = 1 << 0,
+    };
+
     // Token type
     TokenType type;
-    // View of the token over the original string
-    std::string_view value;
-    // Offset from the start of the string to the beginning of the token
-    size_t start;
-    // Equal to the offset + lenght of the token
-    size_t end;
-
-    std::string text() const;
+    uint8_t flags = Flags::none;
+    // Offset from the start of the input to the beginning of the token
+    uint32_t offset = 0;
+    // Number of bytes of the token
+    uint32_t length = 0;
+
+    size_t end() const { return size_t{this->offset} + this->length; }
+
+    /**
+     * Raw text of the token over the input it was lexed from.
+     */
+    std::string_view view(std::string_view source) const;
+
+    /**
+     * Text of the token as seen by the commands: quotes and backslashes are
+     * removed. The result is a view over `source` unless some backslash has
+     * to be removed, in that case the text is stored in the `scratch` arena.
+     */
+    std::string_view text(std::string_view source,
+                          ScratchArena &scratch) const;
+
+    bool operator==(const Token &) const = default;
 };
 
+static_assert(sizeof(Token) <= 16);
+
 struct Specification {
     std::string_view regex;
     TokenType spec_type;
 };
 
+/**
+ * Result of matching a single token at the beginning of the input.
+ */
+struct ScanMatch {
+    TokenType type;
+    // Number of bytes matched
+    size_t length;
+
+    bool operator==(const ScanMatch &) const = default;
+};
+
+/**
+ * Engine used to recognize the tokens:
+ * - table: hand written single pass scanner (default)
+ * - re2: the specification table, tried one regex at a time
+ * - check: runs both engines and fails if they ever disagree
+ *
+ * The engine is selected with the TESTSH_LEXER environment variable.
+ */
+enum class LexerEngine {
+    table,
+    re2,
+    check,
+};
+
+std::optional<ScanMatch> scan(std::string_view input);
+
 /**
  * Use UnbufferedTokenizer to process a single line of
  * the user input.
@@ -68,46 +125,117 @@ struct UnbufferedTokenizer {
     bool next_is_eof() const;
 
     std::optional<Token> peek() const;
+
+    std::string_view source() const;
 };
 
-struct TokState {
-    std::span<std::string> buffered_input;
-    UnbufferedTokenizer inner_tokenizer;
+/**
+ * State of an IncrementalLexer after some lines were fed, see
+ * IncrementalLexer::mark().
+ */
+struct LexerMark {
+    // Size of the input
+    size_t input = 0;
+    // Number of tokens
+    size_t tokens = 0;
+    // Index of the first token lexed from the last line
+    size_t line_begin = 0;
+    bool failed = false;
 };
 
-class Tokenizer {
-    TokState state;
-    std::optional<TokState> prev_state;
+/**
+ * Lexer that keeps its state between the lines of the user input.
+ *
+ * The lines are appended to a single InputArena and each byte is lexed once,
+ * as soon as its line is fed. A line continuation is spliced out of the
+ * arena; only the token directly attached to it is lexed again, because it
+ * might continue on the next line.
+ *
+ * The tokens refer to offsets of input(), whose views stay valid until
+ * reset() is called. The offsets are 32 bits: the lexer fails on the lines
+ * that would make the input larger than 4 GiB, without appending them.
+ */
+class IncrementalLexer {
+    InputArena arena;
+    std::vector<Token> tokens;
+    // Index of the first token lexed from the last line
+    size_t line_begin = 0;
+    // Set when some input could not be lexed, nothing after it is lexed
+    bool failed = false;
 
-    Tokenizer(const TokState &state);
-    void update_prev();
-    bool advance_buffer();
+    bool ends_with_continuation() const;
+    void lex_from(size_t offset);
+
+    /**
+     * Checks that `size` more bytes of input keep the offsets of the tokens
+     * in 32 bits. Otherwise the lexer fails, with an error on stderr.
+     */
+    bool fits(size_t size);
 
   public:
-    Tokenizer(std::span<std::string> buffered_input);
+    /**
+     * Appends some lines, the last one terminated by a newline, to the
+     * input and lexes them. Only the last line can end with a line
+     * continuation; feeding many lines at once gives the same tokens as
+     * feeding them one by one.
+     */
+    void feed(std::string_view lines);
 
-    size_t buffer_size() const;
+    /**
+     * Appends the input and the tokens of the lines fed to `next` between
+     * the marks `begin` and `end`, which follow the ones of this lexer. The
+     * lines must not continue the last line of this lexer, nor the line
+     * fed to `next` before `begin`. This lexer must not have failed: past a
+     * failure the lines are only appended to the input, use feed() for
+     * them.
+     */
+    void append(const IncrementalLexer &next, LexerMark begin, LexerMark end);
 
-    std::optional<Tokenizer> prev() const;
+    // The state after the lines fed so far
+    LexerMark mark() const;
 
-    std::optional<Token> next_token();
+    /**
+     * Returns true if the last line fed ends with a line continuation or
+     * with an operator that needs another operand (`&&`, `||`, `|`).
+     */
+    bool needs_more() const;
 
-    bool next_is_eof() const;
+    /**
+     * Returns the tokens of the whole input. They end with the eof token,
+     * unless the lexing failed. In that case they end with the last valid
+     * token.
+     */
+    std::span<const Token> finish();
 
-    std::optional<Token> peek() const;
+    std::string_view input() const;
+
+    bool has_failed() const { return this->failed; }
+
+    /**
+     * Discards the input and the tokens.
+     */
+    void reset();
 };
 
+/**
+ * Iterator over an already tokenized input. Copying it only copies
+ * a span and an index, so peeking and backtracking are O(1).
+ */
 class TokenIter {
     std::span<const Token> tokens;
+    std::string_view input;
+    size_t pos = 0;
 
   public:
-    TokenIter(std::span<Token> tokens);
+    TokenIter(std::span<const Token> tokens, std::string_view input);
 
     std::optional<Token> next_token();
 
     bool next_is_eof() const;
 
     std::optional<Token> peek() const;
+
+    std::string_view source() const;
 };
 
 // ------------------------------------
@@ -181,9 +309,8 @@ template <typename CharT> struct std::formatter<Token, CharT> : debug_spec {
     auto format(const Token &token, auto &ctx) const {
         this->start<Token>(ctx);
         this->field("type", token.type, ctx);
-        this->field("value", token.value, ctx);
-        this->field("start", token.start, ctx);
-        this->field("end", token.end, ctx);
+        this->field("offset", token.offset, ctx);
+        this->field("length", token.length, ctx);
         return this->finish(ctx);
     }
 };
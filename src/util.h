@@ -53,6 +53,7 @@ concept IsTokenizer = std::copyable<T> && std::movable<T> &&
                       requires(const T t) {
                           { t.next_is_eof() } -> std::same_as<bool>;
                           { t.peek() } -> std::same_as<std::optional<Token>>;
+                          { t.source() } -> std::same_as<std::string_view>;
                       } &&
 
                       requires(T t2) {
@@ -157,6 +158,9 @@ struct debug_spec {
     bool debug = false;
     bool pretty = false;
     int spaces = 4;
+    // Passed down to the formatters of the fields, e.g. the storage that
+    // resolves the indices of the syntax tree nodes
+    const void *context = nullptr;
 
     constexpr void set_debug_format() { this->debug = true; }
 
@@ -249,7 +253,7 @@ struct debug_spec {
             this->p_format(p, ctx);
             std::format_to(ctx.out(), ",");
         } else {
-            std::format_to(ctx.out(), "{:?}", p);
+            this->iformat(p, ctx);
             // WARNING: also the last item gets printed with
             std::format_to(ctx.out(), ", ");
         }